@@ -0,0 +1,166 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+#if defined(__linux__) && __has_include(<linux/perf_event.h>)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#define NMAC_HAS_PERF_EVENT 1
+#else
+#define NMAC_HAS_PERF_EVENT 0
+#endif
+
+// Hardware counters around a benchmark region via perf_event_open. Opt in by
+// setting NMAC_PERF_COUNTERS=1. Counters the kernel or hypervisor refuses
+// (perf_event_paranoid, missing PMU in a VM) are reported as unavailable;
+// the benchmark itself always runs.
+namespace nmac::bench {
+    enum Counter { CYCLES, INSTRUCTIONS, BRANCH_MISSES, L1D_MISSES, LLC_MISSES, COUNTER_COUNT };
+
+    inline constexpr std::array<std::string_view, COUNTER_COUNT> counter_names = {
+        "cycles", "instructions", "branch-misses", "L1D-misses", "LLC-misses"
+    };
+
+    // Counter values for one region; empty where the counter could not be read
+    struct PerfSample {
+        std::array<std::optional<uint64_t>, COUNTER_COUNT> values;
+
+        bool any() const {
+            for (const auto& v : values) if (v) return true;
+            return false;
+        }
+
+        // Per-token and per-byte rates, plus IPC when both inputs exist
+        void write_normalized(std::ostream& out, size_t tokens, size_t bytes) const {
+            auto per = [](uint64_t v, size_t n) { return n ? static_cast<double>(v) / static_cast<double>(n) : 0.0; };
+            for (size_t c = 0; c < COUNTER_COUNT; ++c) {
+                out << "    " << counter_names[c] << ": ";
+                if (!values[c]) {
+                    out << "n/a\n";
+                    continue;
+                }
+                out << *values[c] << " (" << per(*values[c], tokens) << "/token, "
+                    << per(*values[c], bytes) << "/byte)\n";
+            }
+            if (values[CYCLES] && values[INSTRUCTIONS] && *values[CYCLES]) {
+                out << "    IPC: " << static_cast<double>(*values[INSTRUCTIONS]) / static_cast<double>(*values[CYCLES])
+                    << "\n";
+            }
+        }
+    };
+
+    // Counts the calling thread, and threads it creates while counting, in
+    // user space only. Multiplexed counters are scaled by enabled/running time.
+    class PerfCounters {
+        std::array<int, COUNTER_COUNT> fds;
+        std::string failure;
+
+#if NMAC_HAS_PERF_EVENT
+        static int open_counter(uint32_t type, uint64_t config) {
+            perf_event_attr attr;
+            std::memset(&attr, 0, sizeof attr);
+            attr.size = sizeof attr;
+            attr.type = type;
+            attr.config = config;
+            attr.disabled = 1;
+            attr.inherit = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            return static_cast<int>(::syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+
+        static uint64_t cache_miss(uint64_t cache) {
+            return cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        }
+#endif
+
+    public:
+        // Opens the counters if NMAC_PERF_COUNTERS is set; see available()
+        PerfCounters() {
+            fds.fill(-1);
+            const char* flag = std::getenv("NMAC_PERF_COUNTERS");
+            if (!flag || std::string_view(flag) == "0") {
+                failure = "disabled (set NMAC_PERF_COUNTERS=1)";
+                return;
+            }
+#if NMAC_HAS_PERF_EVENT
+            fds[CYCLES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+            fds[INSTRUCTIONS] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+            fds[BRANCH_MISSES] = open_counter(PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES);
+            fds[L1D_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_L1D));
+            fds[LLC_MISSES] = open_counter(PERF_TYPE_HW_CACHE, cache_miss(PERF_COUNT_HW_CACHE_LL));
+            int err = errno;
+            if (!available()) {
+                failure = std::string("perf_event_open failed: ") + std::strerror(err) +
+                          " (see /proc/sys/kernel/perf_event_paranoid)";
+            }
+#else
+            failure = "perf_event_open is not supported on this platform";
+#endif
+        }
+
+        PerfCounters(const PerfCounters&) = delete;
+        PerfCounters& operator=(const PerfCounters&) = delete;
+
+        ~PerfCounters() {
+#if NMAC_HAS_PERF_EVENT
+            for (int fd : fds) if (fd >= 0) ::close(fd);
+#endif
+        }
+
+        bool available() const {
+            for (int fd : fds) if (fd >= 0) return true;
+            return false;
+        }
+
+        // Why no counters are open, if none are
+        const std::string& unavailable_reason() const { return failure; }
+
+        void start() {
+#if NMAC_HAS_PERF_EVENT
+            for (int fd : fds) {
+                if (fd < 0) continue;
+                ::ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+                ::ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+            }
+#endif
+        }
+
+        PerfSample stop() {
+            PerfSample sample;
+#if NMAC_HAS_PERF_EVENT
+            for (int fd : fds) if (fd >= 0) ::ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            for (size_t c = 0; c < COUNTER_COUNT; ++c) {
+                uint64_t data[3]; // value, time enabled, time running
+                if (fds[c] < 0 || ::read(fds[c], data, sizeof data) != static_cast<ssize_t>(sizeof data)) continue;
+                if (data[2] == 0) continue; // Never scheduled onto the PMU
+                double scale = static_cast<double>(data[1]) / static_cast<double>(data[2]);
+                sample.values[c] = static_cast<uint64_t>(static_cast<double>(data[0]) * scale);
+            }
+#endif
+            return sample;
+        }
+
+        // Prints `sample` normalized by the work done. Prints nothing when no
+        // counters are open; callers report unavailable_reason() once instead.
+        void report(std::ostream& out, const PerfSample& sample, size_t tokens, size_t bytes) const {
+            if (!available()) return;
+            if (!sample.any()) {
+                out << "    counters: no data\n";
+                return;
+            }
+            sample.write_normalized(out, tokens, bytes);
+        }
+    };
+}
@@ -0,0 +1,127 @@
+#include "nmac/ct_pattern.hpp"
+#include "nmac/driver/builtin_rewriters.hpp"
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/nmac.hpp"
+#include "nmac/tokenizer.hpp"
+#include "perf_counters.hpp"
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Benchmark: Tokenizer, PatternMatcher (interpreted and compiled with
+// ct::Matcher) and FileExpander over one in-memory source, reporting time per
+// token and per byte. With NMAC_PERF_COUNTERS=1
+// hardware counters are reported alongside, normalized the same way.
+//
+// usage: tokenize_match_bench [BYTES] [ROUNDS]
+
+namespace {
+    std::string make_source(size_t target_bytes) {
+        std::string text;
+        text.reserve(target_bytes + 128);
+        for (size_t line = 0; text.size() < target_bytes; ++line) {
+            switch (line % 5) {
+            case 0:
+                text += "auto v" + std::to_string(line) + " = vec![1, 2, 3, " + std::to_string(line) + "];\n";
+                break;
+            case 1:
+                text += "println!(\"value {} at {}\", v, " + std::to_string(line) + ");\n";
+                break;
+            case 2:
+                text += "/* block comment */ if (a < b && c != \"text\") { return 'x'; }\n";
+                break;
+            case 3:
+                text += "double d" + std::to_string(line) + " = 1.5e10 * compute(a, b[2]) - 42;\n";
+                break;
+            default:
+                text += "// plain comment line that the tokenizer skips\n";
+                break;
+            }
+        }
+        return text;
+    }
+
+    // Tokens from `first` onward, so a pattern can be tried at every position
+    struct TokenWindow {
+        using value_type = nmac::Token;
+        const nmac::Token* first;
+        size_t count;
+
+        size_t size() const { return count; }
+        const nmac::Token& operator[](size_t i) const { return first[i]; }
+    };
+
+    template<typename F>
+    void measure(const char* label, size_t rounds, size_t tokens, size_t bytes, nmac::bench::PerfCounters& counters,
+                 F&& body) {
+        body(); // Warm up caches and the allocator
+        counters.start();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t r = 0; r < rounds; ++r) body();
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+        auto sample = counters.stop();
+
+        double total_tokens = static_cast<double>(tokens * rounds);
+        double total_bytes = static_cast<double>(bytes * rounds);
+        std::cout << label << ": " << ns / 1e6 << " ms, " << ns / total_tokens << " ns/token, "
+                  << ns / total_bytes << " ns/byte, " << total_bytes / ns * 1e3 << " MB/s\n";
+        counters.report(std::cout, sample, tokens * rounds, bytes * rounds);
+    }
+}
+
+int main(int argc, char** argv) {
+    size_t bytes = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : (size_t{4} << 20);
+    size_t rounds = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 5;
+
+    std::string source = make_source(bytes);
+    auto tokens = nmac::Tokenizer(source).tokenize();
+    std::cout << source.size() << " bytes, " << tokens.size() << " tokens, " << rounds << " rounds\n";
+
+    nmac::bench::PerfCounters counters;
+    if (!counters.available()) std::cout << "hardware counters: " << counters.unavailable_reason() << "\n";
+
+    size_t sink = 0;
+    measure("tokenize", rounds, tokens.size(), source.size(), counters, [&] {
+        nmac::Tokenizer tokenizer(source);
+        sink += tokenizer.tokenize().size();
+    });
+
+    static constexpr nmac::ct_string match_pattern = "auto $name = vec! \\[ $first";
+    nmac::PatternParser parser(match_pattern.view());
+    auto pattern = parser.parse();
+    size_t matches = 0;
+    measure("match", rounds, tokens.size(), source.size(), counters, [&] {
+        matches = 0;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            TokenWindow window{tokens.data() + i, tokens.size() - i};
+            nmac::PatternMatcher<TokenWindow> matcher(pattern, window);
+            matches += matcher.match();
+        }
+    });
+
+    size_t compiled_matches = 0;
+    measure("match (compiled)", rounds, tokens.size(), source.size(), counters, [&] {
+        compiled_matches = 0;
+        for (size_t i = 0; i < tokens.size(); ++i) {
+            TokenWindow window{tokens.data() + i, tokens.size() - i};
+            nmac::ct::Matcher<match_pattern, TokenWindow> matcher(window);
+            compiled_matches += matcher.match();
+        }
+    });
+    if (compiled_matches != matches) {
+        std::cerr << "compiled matcher disagrees: " << compiled_matches << " vs " << matches << " matches\n";
+        return 1;
+    }
+
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    measure("expand", rounds, tokens.size(), source.size(), counters, [&] {
+        std::string out;
+        sink += expander.expand(source, tokens, out);
+    });
+
+    std::cout << matches << " pattern matches per round (checksum " << sink << ")\n";
+    return 0;
+}
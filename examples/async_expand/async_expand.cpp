@@ -0,0 +1,36 @@
+#include "nmac/async_expand.hpp"
+#include "nmac/driver/builtin_rewriters.hpp"
+#include <iostream>
+#include <string>
+
+// Example: interleaving nmac expansion with other work on a single-threaded loop
+int main() {
+    std::string source =
+        "auto a = vec![1, 2, 3];\n"
+        "auto b = vec![0; 8];\n"
+        "println!(\"{} {}\", a.size(), b.size());\n";
+
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    nmac::manual_executor loop;
+
+    // Yield back to the loop after every invocation
+    auto expansion = nmac::async_expand_source(loop, expander, source, 1);
+    expansion.start();
+
+    size_t ticks = 0;
+    while (!expansion.done()) {
+        // A real service would poll its sockets here
+        loop.run_one();
+        ticks++;
+    }
+
+    std::cout << "Expanded in " << ticks << " loop ticks:\n" << expansion.result();
+
+    // Blocking use from synchronous code
+    nmac::inline_executor inline_exec;
+    auto tokens = nmac::sync_wait(nmac::async_tokenize(inline_exec, source));
+    std::cout << "Token count: " << tokens.size() << "\n";
+
+    return 0;
+}
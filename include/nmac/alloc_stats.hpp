@@ -0,0 +1,212 @@
+#pragma once
+
+// Heap traffic per pipeline stage. Tag regions with NMAC_ALLOC_SCOPE(stage);
+// the tags compile to nothing unless NMAC_ALLOC_STATS is defined to 1. Counts
+// are only collected in a program that expands NMAC_INSTALL_ALLOCATION_TRACKER()
+// in exactly one translation unit, which replaces the global operator new and
+// delete with versions that record the current stage.
+#ifndef NMAC_ALLOC_STATS
+#define NMAC_ALLOC_STATS 0
+#endif
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <ostream>
+#include <string_view>
+
+namespace nmac::alloc {
+    enum class Stage : uint8_t { other, tokenize, parse, match, expand, format, count };
+
+    inline constexpr std::array<std::string_view, static_cast<size_t>(Stage::count)> stage_names = {
+        "other", "tokenize", "parse", "match", "expand", "format"
+    };
+
+    struct StageStats {
+        uint64_t allocations = 0;
+        uint64_t deallocations = 0;
+        uint64_t bytes = 0;       // Total requested
+        int64_t live_bytes = 0;   // Allocated in this stage and not yet freed
+        int64_t peak_bytes = 0;   // Highest live_bytes seen
+    };
+
+    // Counters for every stage at one point in time. Subtracting an earlier
+    // snapshot gives the traffic in between (peaks are kept from the later one).
+    struct AllocStats {
+        std::array<StageStats, static_cast<size_t>(Stage::count)> stages{};
+
+        const StageStats& operator[](Stage stage) const { return stages[static_cast<size_t>(stage)]; }
+
+        AllocStats operator-(const AllocStats& earlier) const {
+            AllocStats out = *this;
+            for (size_t s = 0; s < stages.size(); ++s) {
+                out.stages[s].allocations -= earlier.stages[s].allocations;
+                out.stages[s].deallocations -= earlier.stages[s].deallocations;
+                out.stages[s].bytes -= earlier.stages[s].bytes;
+                out.stages[s].live_bytes -= earlier.stages[s].live_bytes;
+            }
+            return out;
+        }
+
+        void write_text(std::ostream& out) const {
+            char line[128];
+            std::snprintf(line, sizeof line, "%-9s %12s %12s %14s %14s %14s\n",
+                          "stage", "allocs", "frees", "bytes", "live", "peak");
+            out << line;
+            for (size_t s = 0; s < stages.size(); ++s) {
+                const StageStats& st = stages[s];
+                std::snprintf(line, sizeof line, "%-9s %12llu %12llu %14llu %14lld %14lld\n",
+                              stage_names[s].data(), static_cast<unsigned long long>(st.allocations),
+                              static_cast<unsigned long long>(st.deallocations),
+                              static_cast<unsigned long long>(st.bytes), static_cast<long long>(st.live_bytes),
+                              static_cast<long long>(st.peak_bytes));
+                out << line;
+            }
+        }
+    };
+
+    namespace detail {
+        struct StageCounters {
+            std::atomic<uint64_t> allocations{0};
+            std::atomic<uint64_t> deallocations{0};
+            std::atomic<uint64_t> bytes{0};
+            std::atomic<int64_t> live_bytes{0};
+            std::atomic<int64_t> peak_bytes{0};
+        };
+
+        inline std::array<StageCounters, static_cast<size_t>(Stage::count)> counters;
+        inline std::atomic<bool> installed{false};
+        inline thread_local Stage current = Stage::other;
+
+        // Stored just before each tracked block
+        struct alignas(16) BlockHeader {
+            size_t size;
+            uint32_t offset;  // From the start of the underlying allocation to the user pointer
+            Stage stage;
+        };
+
+        inline void* tracked_new(size_t size, size_t align) {
+            size_t offset = align > sizeof(BlockHeader) ? align : sizeof(BlockHeader);
+            size_t total = offset + size;
+            void* base = align > alignof(std::max_align_t)
+                ? std::aligned_alloc(align, (total + align - 1) / align * align)
+                : std::malloc(total);
+            if (!base) return nullptr;
+
+            char* user = static_cast<char*>(base) + offset;
+            Stage stage = current;
+            new (user - sizeof(BlockHeader)) BlockHeader{size, static_cast<uint32_t>(offset), stage};
+
+            auto& c = counters[static_cast<size_t>(stage)];
+            c.allocations.fetch_add(1, std::memory_order_relaxed);
+            c.bytes.fetch_add(size, std::memory_order_relaxed);
+            int64_t live = c.live_bytes.fetch_add(static_cast<int64_t>(size), std::memory_order_relaxed) +
+                           static_cast<int64_t>(size);
+            int64_t peak = c.peak_bytes.load(std::memory_order_relaxed);
+            while (live > peak && !c.peak_bytes.compare_exchange_weak(peak, live, std::memory_order_relaxed)) {}
+            return user;
+        }
+
+        inline void tracked_delete(void* p) {
+            if (!p) return;
+            char* user = static_cast<char*>(p);
+            const auto* header = reinterpret_cast<const BlockHeader*>(user - sizeof(BlockHeader));
+            auto& c = counters[static_cast<size_t>(header->stage)];
+            c.deallocations.fetch_add(1, std::memory_order_relaxed);
+            c.live_bytes.fetch_sub(static_cast<int64_t>(header->size), std::memory_order_relaxed);
+            std::free(user - header->offset);
+        }
+
+        inline void* tracked_new_or_throw(size_t size, size_t align) {
+            if (size == 0) size = 1;
+            for (;;) {
+                if (void* p = tracked_new(size, align)) return p;
+                std::new_handler handler = std::get_new_handler();
+                if (!handler) throw std::bad_alloc();
+                handler();
+            }
+        }
+    }
+
+    // Whether NMAC_INSTALL_ALLOCATION_TRACKER() is in the program
+    inline bool tracking() { return detail::installed.load(std::memory_order_relaxed); }
+
+    inline AllocStats snapshot() {
+        AllocStats out;
+        for (size_t s = 0; s < out.stages.size(); ++s) {
+            const auto& c = detail::counters[s];
+            out.stages[s] = {c.allocations.load(std::memory_order_relaxed),
+                             c.deallocations.load(std::memory_order_relaxed),
+                             c.bytes.load(std::memory_order_relaxed),
+                             c.live_bytes.load(std::memory_order_relaxed),
+                             c.peak_bytes.load(std::memory_order_relaxed)};
+        }
+        return out;
+    }
+
+    // Restarts every stage's peak from its current live bytes
+    inline void reset_peaks() {
+        for (auto& c : detail::counters) {
+            c.peak_bytes.store(c.live_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        }
+    }
+
+    // Attributes allocations on this thread to `stage` until destroyed
+    class Scope {
+        Stage previous;
+
+    public:
+        explicit Scope(Stage stage) : previous(detail::current) { detail::current = stage; }
+        ~Scope() { detail::current = previous; }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+    };
+}
+
+#if NMAC_ALLOC_STATS
+#define NMAC_ALLOC_CONCAT_(a, b) a##b
+#define NMAC_ALLOC_CONCAT(a, b) NMAC_ALLOC_CONCAT_(a, b)
+#define NMAC_ALLOC_SCOPE(stage) \
+    ::nmac::alloc::Scope NMAC_ALLOC_CONCAT(nmac_alloc_scope_, __LINE__)(::nmac::alloc::Stage::stage)
+#else
+#define NMAC_ALLOC_SCOPE(stage) static_cast<void>(0)
+#endif
+
+// Replaces the global allocation functions. Expand at namespace scope in one
+// .cpp file of the program (a test or a profiling build of a tool).
+#define NMAC_INSTALL_ALLOCATION_TRACKER()                                                                    \
+    namespace nmac::alloc::detail {                                                                          \
+        [[maybe_unused]] static const bool installed_here = (installed.store(true), true);                   \
+    }                                                                                                        \
+    void* operator new(std::size_t n) { return ::nmac::alloc::detail::tracked_new_or_throw(n, 0); }          \
+    void* operator new[](std::size_t n) { return ::nmac::alloc::detail::tracked_new_or_throw(n, 0); }        \
+    void* operator new(std::size_t n, std::align_val_t a) {                                                  \
+        return ::nmac::alloc::detail::tracked_new_or_throw(n, static_cast<std::size_t>(a));                  \
+    }                                                                                                        \
+    void* operator new[](std::size_t n, std::align_val_t a) {                                                \
+        return ::nmac::alloc::detail::tracked_new_or_throw(n, static_cast<std::size_t>(a));                  \
+    }                                                                                                        \
+    void* operator new(std::size_t n, const std::nothrow_t&) noexcept {                                      \
+        return ::nmac::alloc::detail::tracked_new(n ? n : 1, 0);                                             \
+    }                                                                                                        \
+    void* operator new[](std::size_t n, const std::nothrow_t&) noexcept {                                    \
+        return ::nmac::alloc::detail::tracked_new(n ? n : 1, 0);                                             \
+    }                                                                                                        \
+    void operator delete(void* p) noexcept { ::nmac::alloc::detail::tracked_delete(p); }                     \
+    void operator delete[](void* p) noexcept { ::nmac::alloc::detail::tracked_delete(p); }                   \
+    void operator delete(void* p, std::size_t) noexcept { ::nmac::alloc::detail::tracked_delete(p); }        \
+    void operator delete[](void* p, std::size_t) noexcept { ::nmac::alloc::detail::tracked_delete(p); }      \
+    void operator delete(void* p, std::align_val_t) noexcept { ::nmac::alloc::detail::tracked_delete(p); }   \
+    void operator delete[](void* p, std::align_val_t) noexcept { ::nmac::alloc::detail::tracked_delete(p); } \
+    void operator delete(void* p, std::size_t, std::align_val_t) noexcept {                                  \
+        ::nmac::alloc::detail::tracked_delete(p);                                                            \
+    }                                                                                                        \
+    void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {                                \
+        ::nmac::alloc::detail::tracked_delete(p);                                                            \
+    }                                                                                                        \
+    void operator delete(void* p, const std::nothrow_t&) noexcept { ::nmac::alloc::detail::tracked_delete(p); } \
+    void operator delete[](void* p, const std::nothrow_t&) noexcept { ::nmac::alloc::detail::tracked_delete(p); }
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "nmac/nmac.hpp"
+#include "nmac/tokenizer.hpp"
+#include "nmac/macro_expander.hpp"
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/task.hpp"
+#include <array>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// co_await-able variants of tokenize, match and expand. Each one first hops onto
+// the given executor, then yields back to it every `yield_every` steps so that
+// long inputs do not monopolise an event loop. The executor, source text and
+// inputs must outlive the returned task.
+
+namespace nmac {
+    inline constexpr size_t default_yield_every = 4096;
+
+    // Steps are tokens
+    template<AsyncExecutor E>
+    task<std::vector<Token>> async_tokenize(E& executor, std::string_view source,
+                                            size_t yield_every = default_yield_every) {
+        co_await schedule_on(executor);
+
+        Tokenizer tokenizer(source);
+        std::vector<Token> tokens;
+        size_t steps = 0;
+        while (tokenizer.next(tokens)) {
+            if (++steps == yield_every) {
+                steps = 0;
+                co_await schedule_on(executor);
+            }
+        }
+        co_return tokens;
+    }
+
+    // A single match is not interruptible; this only moves it onto the executor
+    template<AsyncExecutor E, typename Input>
+    task<bool> async_match(E& executor, PatternMatcher<Input>& matcher) {
+        co_await schedule_on(executor);
+        co_return matcher.match();
+    }
+
+    // Steps are rule attempts, over the rules that can match `input`
+    template<typename Expander, AsyncExecutor E, typename Input>
+    auto async_expand(E& executor, const Input& input, size_t yield_every = 1)
+        -> task<decltype(Expander::expand(input))> {
+        using Result = decltype(Expander::expand(input));
+        using Attempt = bool (*)(const Input&, std::optional<Result>&);
+
+        static constexpr auto attempts = []<size_t... I>(std::index_sequence<I...>) {
+            return std::array<Attempt, sizeof...(I)>{&Expander::template try_rule<I, Input, Result>...};
+        }(std::make_index_sequence<Expander::size()>{});
+
+        co_await schedule_on(executor);
+
+        std::optional<Result> result;
+        size_t steps = 0;
+        for (size_t rule : Expander::candidate_rules(input)) {
+            if (attempts[rule](input, result)) co_return std::move(*result);
+            if (++steps == yield_every) {
+                steps = 0;
+                co_await schedule_on(executor);
+            }
+        }
+        throw std::runtime_error("No matching macro rule found");
+    }
+
+    // Whole-file expansion; steps are tokens while tokenizing, then invocations
+    template<AsyncExecutor E>
+    task<std::string> async_expand_source(E& executor, const driver::FileExpander& expander,
+                                          std::string_view source,
+                                          size_t yield_every = default_yield_every) {
+        std::vector<Token> tokens = co_await async_tokenize(executor, source, yield_every);
+
+        std::string out;
+        out.reserve(source.size());
+        driver::FileExpander::Progress progress;
+        size_t steps = 0;
+        while (expander.expand_next(source, tokens, progress, out)) {
+            if (++steps == yield_every) {
+                steps = 0;
+                co_await schedule_on(executor);
+            }
+        }
+        co_return out;
+    }
+}
@@ -0,0 +1,481 @@
+#pragma once
+
+#include "nmac/nmac.hpp"
+#include <array>
+#include <cstddef>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Patterns compiled into types. ct::Matcher<"vec! \\[ $x \\]", Input> parses
+// its pattern during compilation, with the same grammar as PatternParser, and
+// turns every node into a template whose static match() calls its children's
+// directly. The compiler sees the whole matcher for a rule at once and can
+// inline it into straight-line code. Matching follows PatternMatcher node for
+// node, so both produce the same captures.
+namespace nmac::ct {
+    namespace detail {
+        inline constexpr size_t none = static_cast<size_t>(-1);
+
+        struct Node {
+            PatternNode::Type type = PatternNode::SEQUENCE;
+            size_t begin = 0;    // Text of a literal, operator or variable name
+            size_t length = 0;
+            char op = 0;         // Repetition operator
+            size_t first = none; // First child
+            size_t next = none;  // Next sibling
+            size_t count = 0;    // Number of children
+        };
+
+        // A pattern of N characters parses into at most 2N + 1 nodes, and
+        // factoring alternatives adds at most two per literal
+        template<size_t Capacity>
+        struct Ast {
+            std::array<Node, Capacity> nodes{};
+            size_t size = 0;
+            size_t root = 0;
+            const char* error = nullptr;
+        };
+
+        constexpr bool is_space(char c) {
+            return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+        }
+
+        constexpr bool is_word(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+        }
+
+        constexpr bool is_operator(char c) { return c == '+' || c == '-' || c == '*' || c == '/' || c == '='; }
+
+        // PatternParser, step for step, building a fixed node array. Anything
+        // PatternParser would report as an error, or never finish parsing,
+        // leaves `error` set instead.
+        template<size_t Capacity>
+        class Parser {
+            std::string_view pattern;
+            size_t pos = 0;
+
+            constexpr char peek() const { return pos < pattern.size() ? pattern[pos] : '\0'; }
+
+            constexpr void skip_whitespace() {
+                while (pos < pattern.size() && is_space(pattern[pos])) pos++;
+            }
+
+            constexpr void fail(const char* message) {
+                if (!ast.error) ast.error = message;
+            }
+
+            constexpr size_t add(Node node) {
+                if (ast.size == Capacity) {
+                    fail("Pattern has too many nodes to compile");
+                    return 0;
+                }
+                ast.nodes[ast.size] = node;
+                return ast.size++;
+            }
+
+            constexpr bool same_literal(size_t a, size_t b) const {
+                const Node& x = ast.nodes[a];
+                const Node& y = ast.nodes[b];
+                return (x.type == PatternNode::LITERAL || x.type == PatternNode::OPERATOR) && x.type == y.type &&
+                       pattern.substr(x.begin, x.length) == pattern.substr(y.begin, y.length);
+            }
+
+            // PatternParser::factor_prefixes over the sibling list starting at
+            // `head`; returns the head of the factored list
+            constexpr size_t factor(size_t head) {
+                size_t out_head = none;
+                size_t out_last = none;
+                for (size_t branch = head; branch != none && !ast.error;) {
+                    size_t lead = ast.nodes[branch].first;
+                    size_t run_last = branch;
+                    while (lead != none && ast.nodes[run_last].next != none) {
+                        size_t next_lead = ast.nodes[ast.nodes[run_last].next].first;
+                        if (next_lead == none || !same_literal(next_lead, lead)) break;
+                        run_last = ast.nodes[run_last].next;
+                    }
+                    size_t after = ast.nodes[run_last].next;
+
+                    size_t result = branch;
+                    if (run_last != branch) {
+                        // Drop the shared literal from each branch of the run
+                        ast.nodes[run_last].next = none;
+                        for (size_t b = branch; b != none; b = ast.nodes[b].next) {
+                            ast.nodes[b].first = ast.nodes[ast.nodes[b].first].next;
+                            ast.nodes[b].count--;
+                        }
+                        size_t rest = factor(branch);
+                        result = add({});
+                        ast.nodes[result].first = lead;
+                        if (ast.nodes[rest].next == none) {
+                            ast.nodes[lead].next = ast.nodes[rest].first;
+                            ast.nodes[result].count = 1 + ast.nodes[rest].count;
+                        } else {
+                            ast.nodes[lead].next = alternation_of(rest);
+                            ast.nodes[result].count = 2;
+                        }
+                    }
+
+                    ast.nodes[result].next = none;
+                    if (out_last == none) out_head = result;
+                    else ast.nodes[out_last].next = result;
+                    out_last = result;
+                    branch = after;
+                }
+                return out_head;
+            }
+
+            constexpr size_t alternation_of(size_t head) {
+                size_t node = add({PatternNode::ALTERNATION});
+                ast.nodes[node].first = head;
+                for (size_t b = head; b != none; b = ast.nodes[b].next) ast.nodes[node].count++;
+                return node;
+            }
+
+            constexpr size_t alternation() {
+                size_t head = sequence();
+                size_t last = head;
+                bool several = false;
+                while (!ast.error && peek() == '|') {
+                    pos++;
+                    size_t next = sequence();
+                    ast.nodes[last].next = next;
+                    last = next;
+                    several = true;
+                }
+                if (!several || ast.error) return head;
+                head = factor(head);
+                return ast.nodes[head].next == none ? head : alternation_of(head);
+            }
+
+            constexpr size_t sequence() {
+                size_t seq = add({});
+                size_t last = none;
+                size_t before_last = none;
+                auto push = [&](size_t child) {
+                    if (last == none) ast.nodes[seq].first = child;
+                    else ast.nodes[last].next = child;
+                    ast.nodes[seq].count++;
+                    before_last = last;
+                    last = child;
+                };
+
+                while (!ast.error && pos < pattern.size() && peek() != ')' && peek() != '}' && peek() != ']' &&
+                       peek() != '|') {
+                    skip_whitespace();
+                    if (pos >= pattern.size()) break;
+
+                    char c = peek();
+                    if (c == '$') {
+                        size_t start = ++pos;
+                        while (pos < pattern.size() && is_word(pattern[pos])) pos++;
+                        if (start == pos) fail("Empty variable name");
+                        push(add({PatternNode::VARIABLE, start, pos - start}));
+                    } else if (c == '\\') {
+                        if (++pos >= pattern.size()) {
+                            fail("Unexpected end of pattern after escape character");
+                            break;
+                        }
+                        push(add({PatternNode::LITERAL, pos++, 1}));
+                    } else if (is_operator(c)) {
+                        // `x*` and `x+` repeat x; with a space before they are operators
+                        if ((c == '*' || c == '+') && last != none && !is_space(pattern[pos - 1])) {
+                            size_t rep = add({PatternNode::REPETITION, 0, 0, c, last, none, 1});
+                            if (before_last == none) ast.nodes[seq].first = rep;
+                            else ast.nodes[before_last].next = rep;
+                            last = rep;
+                        } else {
+                            push(add({PatternNode::OPERATOR, pos, 1}));
+                        }
+                        pos++;
+                    } else if (c == '(') {
+                        pos++;
+                        size_t group = alternation();
+                        if (peek() == ')') pos++;
+                        else fail("Unclosed group: missing ')'");
+                        push(group);
+                    } else if (c == '[') {
+                        pos++;
+                        size_t optional = add({PatternNode::OPTIONAL});
+                        size_t body = alternation();
+                        ast.nodes[optional].first = body;
+                        ast.nodes[optional].count = 1;
+                        if (peek() == ']') pos++;
+                        else fail("Unclosed optional group: missing ']'");
+                        push(optional);
+                    } else {
+                        size_t start = pos;
+                        while (pos < pattern.size() && !is_space(peek()) && peek() != '$' && peek() != '(' &&
+                               peek() != ')' && peek() != '[' && peek() != ']' && peek() != '\\' &&
+                               !is_operator(peek()) && peek() != '?' && peek() != ',' && peek() != '|') {
+                            pos++;
+                        }
+                        if (pos > start) push(add({PatternNode::LITERAL, start, pos - start}));
+                        else if (c != ')' && c != ']' && c != '|') fail("Unexpected character in pattern");
+                    }
+                }
+                return seq;
+            }
+
+        public:
+            Ast<Capacity> ast;
+
+            constexpr explicit Parser(std::string_view p) : pattern(p) {}
+
+            constexpr void parse() {
+                skip_whitespace();
+                ast.root = alternation();
+                skip_whitespace();
+                if (pos < pattern.size()) fail("Unexpected characters at end of pattern");
+            }
+        };
+
+        template<ct_string Pattern>
+        inline constexpr auto ast = [] {
+            Parser<4 * Pattern.size + 4> parser(Pattern.view());
+            parser.parse();
+            return parser.ast;
+        }();
+
+        // Match state: the input and the capture log, which backtracking
+        // truncates exactly as PatternMatcher's does
+        template<typename Input>
+        struct Context {
+            using Capture = std::pair<std::string_view, typename Input::value_type>;
+
+            const Input& input;
+            std::vector<Capture> log;
+            size_t log_size = 0;
+
+            explicit Context(const Input& in) : input(in) {}
+
+            void record(std::string_view name, const typename Input::value_type& value) {
+                if (log_size < log.size()) log[log_size] = Capture(name, value);
+                else log.emplace_back(name, value);
+                log_size++;
+            }
+        };
+
+        template<typename T>
+        std::string_view token_text(const T& token) {
+            if constexpr (requires { token.content; }) {
+                return std::string_view(token.content);
+            } else if constexpr (std::is_convertible_v<const T&, std::string_view>) {
+                return token;
+            } else {
+                return {};
+            }
+        }
+    }
+
+    // Node types. Each match() advances `pos` past what it consumed, or
+    // returns false leaving the position and the capture log as it found them.
+
+    // Literals and operators both match one token with exactly this text
+    template<ct_string Pattern, size_t Begin, size_t Length>
+    struct Literal {
+        static constexpr std::string_view text = Pattern.view().substr(Begin, Length);
+
+        template<typename Input>
+        static bool match(detail::Context<Input>& context, size_t& pos) {
+            if (pos >= context.input.size() || detail::token_text(context.input[pos]) != text) return false;
+            pos++;
+            return true;
+        }
+    };
+
+    template<ct_string Pattern, size_t Begin, size_t Length>
+    struct Variable {
+        static constexpr std::string_view name = Pattern.view().substr(Begin, Length);
+
+        template<typename Input>
+        static bool match(detail::Context<Input>& context, size_t& pos) {
+            if (pos >= context.input.size()) return false;
+            context.record(name, context.input[pos]);
+            pos++;
+            return true;
+        }
+    };
+
+    template<typename... Nodes>
+    struct Sequence {
+        template<typename Input>
+        static bool match(detail::Context<Input>& context, size_t& pos) {
+            size_t saved = pos;
+            size_t mark = context.log_size;
+            if ((Nodes::match(context, pos) && ...)) return true;
+            pos = saved;
+            context.log_size = mark;
+            return false;
+        }
+    };
+
+    // Alternatives in order; each is a Sequence, so a failed one leaves no trace
+    template<typename... Branches>
+    struct Alternation {
+        template<typename Input>
+        static bool match(detail::Context<Input>& context, size_t& pos) {
+            return (Branches::match(context, pos) || ...);
+        }
+    };
+
+    template<typename Body>
+    struct Optional {
+        template<typename Input>
+        static bool match(detail::Context<Input>& context, size_t& pos) {
+            Body::match(context, pos);
+            return true;
+        }
+    };
+
+    // Greedy, like PatternMatcher. A pass that consumes nothing ends the
+    // loop, where the interpreter would spin on it forever.
+    template<char Op, typename Body>
+    struct Repeat {
+        template<typename Input>
+        static bool match(detail::Context<Input>& context, size_t& pos) {
+            size_t matches = 0;
+            while (pos < context.input.size()) {
+                size_t before = pos;
+                size_t mark = context.log_size;
+                if (!Body::match(context, pos)) {
+                    pos = before;
+                    context.log_size = mark;
+                    break;
+                }
+                matches++;
+                if (pos == before) break;
+            }
+            if constexpr (Op == '+') return matches > 0;
+            else if constexpr (Op == '?') return matches <= 1;
+            else return true;
+        }
+    };
+
+    namespace detail {
+        template<ct_string Pattern, size_t I>
+        constexpr auto select();
+
+        // Type of node I of Pattern
+        template<ct_string Pattern, size_t I>
+        using node_t = typename decltype(select<Pattern, I>())::type;
+
+        template<ct_string Pattern, size_t I, size_t K>
+        constexpr size_t child() {
+            size_t node = ast<Pattern>.nodes[I].first;
+            for (size_t k = 0; k < K; ++k) node = ast<Pattern>.nodes[node].next;
+            return node;
+        }
+
+        // Node I's children as the arguments of Into
+        template<template<typename...> class Into, ct_string Pattern, size_t I,
+                 typename = std::make_index_sequence<ast<Pattern>.nodes[I].count>>
+        struct children_of;
+
+        template<template<typename...> class Into, ct_string Pattern, size_t I, size_t... K>
+        struct children_of<Into, Pattern, I, std::index_sequence<K...>> {
+            using type = Into<node_t<Pattern, child<Pattern, I, K>()>...>;
+        };
+
+        template<ct_string Pattern, size_t I>
+        constexpr auto select() {
+            constexpr Node node = ast<Pattern>.nodes[I];
+            if constexpr (node.type == PatternNode::SEQUENCE) {
+                return std::type_identity<typename children_of<Sequence, Pattern, I>::type>{};
+            } else if constexpr (node.type == PatternNode::ALTERNATION) {
+                return std::type_identity<typename children_of<Alternation, Pattern, I>::type>{};
+            } else if constexpr (node.type == PatternNode::OPTIONAL) {
+                return std::type_identity<Optional<node_t<Pattern, node.first>>>{};
+            } else if constexpr (node.type == PatternNode::REPETITION) {
+                return std::type_identity<Repeat<node.op, node_t<Pattern, node.first>>>{};
+            } else if constexpr (node.type == PatternNode::VARIABLE) {
+                return std::type_identity<Variable<Pattern, node.begin, node.length>>{};
+            } else {
+                return std::type_identity<Literal<Pattern, node.begin, node.length>>{};
+            }
+        }
+    }
+
+    // Whether Pattern parses without errors; only then can it be compiled
+    template<ct_string Pattern>
+    inline constexpr bool compiles = detail::ast<Pattern>.error == nullptr;
+
+    namespace detail {
+        template<ct_string Pattern>
+        constexpr size_t literal_prefix_length() {
+            const auto& tree = ast<Pattern>;
+            const Node& root = tree.nodes[tree.root];
+            if (tree.error || root.type != PatternNode::SEQUENCE) return 0;
+            size_t n = 0;
+            for (size_t c = root.first; c != none; c = tree.nodes[c].next, ++n) {
+                auto type = tree.nodes[c].type;
+                if (type != PatternNode::LITERAL && type != PatternNode::OPERATOR) break;
+            }
+            return n;
+        }
+
+        template<size_t Skip, typename Root>
+        struct drop {
+            using type = Root;
+        };
+
+        template<size_t Skip, typename First, typename... Rest>
+            requires(Skip > 0)
+        struct drop<Skip, Sequence<First, Rest...>> : drop<Skip - 1, Sequence<Rest...>> {};
+    }
+
+    // Texts of the literals every match of Pattern starts with, in order
+    template<ct_string Pattern>
+    inline constexpr auto literal_prefix = [] {
+        std::array<std::string_view, detail::literal_prefix_length<Pattern>()> out{};
+        const auto& tree = detail::ast<Pattern>;
+        size_t c = tree.nodes[tree.root].first;
+        for (auto& text : out) {
+            text = Pattern.view().substr(tree.nodes[c].begin, tree.nodes[c].length);
+            c = tree.nodes[c].next;
+        }
+        return out;
+    }();
+
+    // The pattern as a type: nested Sequence, Alternation, Optional, Repeat,
+    // Literal and Variable templates
+    template<ct_string Pattern>
+        requires compiles<Pattern>
+    using compiled_t = detail::node_t<Pattern, detail::ast<Pattern>.root>;
+
+    // Drop-in for PatternMatcher<Input> on a fixed pattern
+    template<ct_string Pattern, typename Input>
+    class Matcher {
+        static_assert(compiles<Pattern>, "Pattern does not parse; PatternParser reports why");
+
+        using Capture = typename detail::Context<Input>::Capture;
+
+        detail::Context<Input> context;
+        std::vector<Capture> captures;
+
+    public:
+        explicit Matcher(const Input& input) : context{input} {}
+
+        bool match() { return match_after<0>(0); }
+
+        // match() for when the first Skip literals of literal_prefix<Pattern>
+        // are already known to match tokens [0, pos)
+        template<size_t Skip>
+        bool match_after(size_t pos) {
+            static_assert(Skip <= literal_prefix<Pattern>.size(), "Only leading literals can be skipped");
+            NMAC_TRACE_SCOPE("match");
+            NMAC_ALLOC_SCOPE(match);
+            context.log_size = 0;
+            captures.clear();
+            if (!detail::drop<Skip, compiled_t<Pattern>>::type::match(context, pos)) return false;
+            context.log.erase(context.log.begin() + static_cast<std::ptrdiff_t>(context.log_size), context.log.end());
+            captures = std::move(context.log);
+            context.log.clear();
+            return true;
+        }
+
+        // Captures of the last successful match()
+        const std::vector<Capture>& get_captures() const { return captures; }
+    };
+}
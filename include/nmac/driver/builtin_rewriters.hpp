@@ -0,0 +1,89 @@
+#pragma once
+
+#include "nmac/driver/file_expander.hpp"
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nmac::driver {
+    inline std::string_view trim(std::string_view s) {
+        size_t begin = 0;
+        size_t end = s.size();
+        while (begin < end && std::isspace(static_cast<unsigned char>(s[begin]))) begin++;
+        while (end > begin && std::isspace(static_cast<unsigned char>(s[end - 1]))) end--;
+        return s.substr(begin, end - begin);
+    }
+
+    // Splits on `separator` outside of brackets and string/char literals
+    inline std::vector<std::string_view> split_top_level(std::string_view text, char separator) {
+        std::vector<std::string_view> parts;
+        size_t depth = 0;
+        size_t start = 0;
+        char quote = '\0';
+
+        for (size_t i = 0; i < text.size(); ++i) {
+            char c = text[i];
+            if (quote) {
+                if (c == '\\') ++i;
+                else if (c == quote) quote = '\0';
+            } else if (c == '"' || c == '\'') {
+                quote = c;
+            } else if (c == '(' || c == '[' || c == '{') {
+                depth++;
+            } else if ((c == ')' || c == ']' || c == '}') && depth > 0) {
+                depth--;
+            } else if (c == separator && depth == 0) {
+                parts.push_back(text.substr(start, i - start));
+                start = i + 1;
+            }
+        }
+        parts.push_back(text.substr(start));
+        return parts;
+    }
+
+    // vec![]        -> nmac::dsl::vec<int>()
+    // vec![a, b]    -> (nmac::dsl::vec)(a, b)
+    // vec![x; n]    -> (nmac::dsl::vec_repeat)(x, n)
+    // The parenthesised names keep vec.hpp's function-like macros from re-expanding them.
+    inline std::string rewrite_vec(const MacroCall& call) {
+        std::string_view body = trim(call.body);
+        if (body.empty()) {
+            return "nmac::dsl::vec<int>()";
+        }
+
+        auto parts = split_top_level(body, ';');
+        if (parts.size() == 2) {
+            std::string out = "(nmac::dsl::vec_repeat)(";
+            out += trim(parts[0]);
+            out += ", ";
+            out += trim(parts[1]);
+            out += ")";
+            return out;
+        }
+        if (parts.size() > 2) {
+            throw std::runtime_error("vec! expects `[value; count]` or a comma separated list");
+        }
+
+        std::string out = "(nmac::dsl::vec)(";
+        out += body;
+        out += ")";
+        return out;
+    }
+
+    // println!("fmt", args...) -> nmac::dsl::println("fmt", args...)
+    inline std::string rewrite_println(const MacroCall& call) {
+        std::string out = "nmac::dsl::println(";
+        out += trim(call.body);
+        out += ")";
+        return out;
+    }
+
+    inline RewriteTable builtin_rewriters() {
+        RewriteTable table;
+        table.add("vec", rewrite_vec);
+        table.add("println", rewrite_println);
+        return table;
+    }
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "nmac/io/file_batch.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <cctype>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nmac::driver {
+    // One entry of a clang-style compilation database
+    struct CompileCommand {
+        std::string directory;
+        std::string file;                    // Absolute, resolved against `directory`
+        std::vector<std::string> arguments;  // From "arguments", or "command" split like a shell would
+    };
+
+    namespace detail {
+        // Reads just enough JSON for compile_commands.json: an array of objects
+        // whose interesting members are strings or arrays of strings. Other
+        // values are validated and skipped.
+        class CompileCommandsParser {
+            std::string_view text;
+            size_t pos = 0;
+
+            [[noreturn]] void fail(const char* what) const {
+                throw std::runtime_error("compile_commands.json: " + std::string(what) +
+                                         " at offset " + std::to_string(pos));
+            }
+
+            void skip_whitespace() {
+                while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                             text[pos] == '\n' || text[pos] == '\r')) {
+                    pos++;
+                }
+            }
+
+            bool consume(char c) {
+                skip_whitespace();
+                if (pos < text.size() && text[pos] == c) {
+                    pos++;
+                    return true;
+                }
+                return false;
+            }
+
+            void expect(char c) {
+                if (!consume(c)) fail("unexpected character");
+            }
+
+            static void append_utf8(std::string& out, uint32_t cp) {
+                if (cp < 0x80) {
+                    out += static_cast<char>(cp);
+                } else if (cp < 0x800) {
+                    out += static_cast<char>(0xC0 | (cp >> 6));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else if (cp < 0x10000) {
+                    out += static_cast<char>(0xE0 | (cp >> 12));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                } else {
+                    out += static_cast<char>(0xF0 | (cp >> 18));
+                    out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                    out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                    out += static_cast<char>(0x80 | (cp & 0x3F));
+                }
+            }
+
+            uint32_t parse_hex4() {
+                if (pos + 4 > text.size()) fail("truncated \\u escape");
+                uint32_t value = 0;
+                for (int i = 0; i < 4; ++i) {
+                    char c = text[pos++];
+                    value <<= 4;
+                    if (c >= '0' && c <= '9') value |= static_cast<uint32_t>(c - '0');
+                    else if (c >= 'a' && c <= 'f') value |= static_cast<uint32_t>(c - 'a' + 10);
+                    else if (c >= 'A' && c <= 'F') value |= static_cast<uint32_t>(c - 'A' + 10);
+                    else fail("invalid \\u escape");
+                }
+                return value;
+            }
+
+            std::string parse_string() {
+                skip_whitespace();
+                if (pos >= text.size() || text[pos] != '"') fail("expected string");
+                pos++;
+
+                std::string out;
+                while (true) {
+                    if (pos >= text.size()) fail("unterminated string");
+                    char c = text[pos++];
+                    if (c == '"') return out;
+                    if (c != '\\') {
+                        out += c;
+                        continue;
+                    }
+                    if (pos >= text.size()) fail("unterminated string");
+                    switch (text[pos++]) {
+                        case '"': out += '"'; break;
+                        case '\\': out += '\\'; break;
+                        case '/': out += '/'; break;
+                        case 'b': out += '\b'; break;
+                        case 'f': out += '\f'; break;
+                        case 'n': out += '\n'; break;
+                        case 'r': out += '\r'; break;
+                        case 't': out += '\t'; break;
+                        case 'u': {
+                            uint32_t cp = parse_hex4();
+                            if (cp >= 0xD800 && cp < 0xDC00 && text.substr(pos, 2) == "\\u") {
+                                pos += 2;
+                                uint32_t low = parse_hex4();
+                                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                            }
+                            append_utf8(out, cp);
+                            break;
+                        }
+                        default: fail("invalid escape");
+                    }
+                }
+            }
+
+            void skip_value() {
+                skip_whitespace();
+                if (pos >= text.size()) fail("unexpected end of input");
+                char c = text[pos];
+                if (c == '"') {
+                    parse_string();
+                } else if (c == '[') {
+                    pos++;
+                    if (consume(']')) return;
+                    do skip_value(); while (consume(','));
+                    expect(']');
+                } else if (c == '{') {
+                    pos++;
+                    if (consume('}')) return;
+                    do {
+                        parse_string();
+                        expect(':');
+                        skip_value();
+                    } while (consume(','));
+                    expect('}');
+                } else {
+                    // Number, true, false or null
+                    size_t start = pos;
+                    while (pos < text.size() && (std::isalnum(static_cast<unsigned char>(text[pos])) ||
+                                                 text[pos] == '-' || text[pos] == '+' || text[pos] == '.')) {
+                        pos++;
+                    }
+                    if (pos == start) fail("unexpected character");
+                }
+            }
+
+            std::vector<std::string> parse_string_array() {
+                std::vector<std::string> items;
+                expect('[');
+                if (consume(']')) return items;
+                do items.push_back(parse_string()); while (consume(','));
+                expect(']');
+                return items;
+            }
+
+        public:
+            explicit CompileCommandsParser(std::string_view t) : text(t) {}
+
+            std::vector<CompileCommand> parse() {
+                std::vector<CompileCommand> commands;
+                expect('[');
+                if (!consume(']')) {
+                    do {
+                        CompileCommand command;
+                        std::string shell_command;
+                        expect('{');
+                        if (!consume('}')) {
+                            do {
+                                std::string key = parse_string();
+                                expect(':');
+                                if (key == "directory") command.directory = parse_string();
+                                else if (key == "file") command.file = parse_string();
+                                else if (key == "arguments") command.arguments = parse_string_array();
+                                else if (key == "command") shell_command = parse_string();
+                                else skip_value();
+                            } while (consume(','));
+                            expect('}');
+                        }
+                        if (command.file.empty()) fail("entry without \"file\"");
+                        if (command.arguments.empty()) command.arguments = split_command(shell_command);
+                        commands.push_back(std::move(command));
+                    } while (consume(','));
+                    expect(']');
+                }
+                skip_whitespace();
+                if (pos != text.size()) fail("trailing characters");
+                return commands;
+            }
+
+            // POSIX shell word splitting without expansions
+            static std::vector<std::string> split_command(std::string_view command) {
+                std::vector<std::string> words;
+                std::string word;
+                bool in_word = false;
+                char quote = '\0';
+
+                for (size_t i = 0; i < command.size(); ++i) {
+                    char c = command[i];
+                    if (quote == '\'') {
+                        if (c == '\'') quote = '\0';
+                        else word += c;
+                    } else if (quote == '"') {
+                        if (c == '"') quote = '\0';
+                        else if (c == '\\' && i + 1 < command.size() &&
+                                 (command[i + 1] == '"' || command[i + 1] == '\\')) word += command[++i];
+                        else word += c;
+                    } else if (c == '\'' || c == '"') {
+                        quote = c;
+                        in_word = true;
+                    } else if (c == '\\' && i + 1 < command.size()) {
+                        word += command[++i];
+                        in_word = true;
+                    } else if (c == ' ' || c == '\t' || c == '\n') {
+                        if (in_word) words.push_back(std::move(word));
+                        word.clear();
+                        in_word = false;
+                    } else {
+                        word += c;
+                        in_word = true;
+                    }
+                }
+                if (in_word) words.push_back(std::move(word));
+                return words;
+            }
+        };
+    }
+
+    inline std::vector<CompileCommand> parse_compile_commands(std::string_view json) {
+        auto commands = detail::CompileCommandsParser(json).parse();
+        for (auto& command : commands) {
+            std::filesystem::path file(command.file);
+            if (file.is_relative()) command.file = (std::filesystem::path(command.directory) / file).string();
+        }
+        return commands;
+    }
+
+    inline std::vector<CompileCommand> load_compile_commands(const std::string& path) {
+        int fd = io::detail::open_or_throw(path, O_RDONLY);
+        size_t size = io::detail::file_size(fd, path);
+        std::string json(size, '\0');
+        try {
+            json.resize(io::detail::pread_all(fd, json.data(), size, path));
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+        return parse_compile_commands(json);
+    }
+
+    // Header search path of a compile command, in lookup order
+    struct IncludePaths {
+        std::vector<std::string> quote;   // -iquote: only for "..." includes
+        std::vector<std::string> angled;  // -I, -isystem, -idirafter
+
+        static IncludePaths from(const CompileCommand& command) {
+            IncludePaths paths;
+            auto resolve = [&](std::string_view dir) {
+                std::filesystem::path p(dir);
+                return (p.is_relative() ? std::filesystem::path(command.directory) / p : p).string();
+            };
+
+            const auto& args = command.arguments;
+            for (size_t i = 0; i < args.size(); ++i) {
+                std::string_view arg = args[i];
+                for (std::string_view flag : {"-iquote", "-isystem", "-idirafter", "-I"}) {
+                    if (!arg.starts_with(flag)) continue;
+                    std::string_view dir = arg.substr(flag.size());
+                    if (dir.empty()) {
+                        if (i + 1 >= args.size()) break;
+                        dir = args[++i];
+                    }
+                    (flag == "-iquote" ? paths.quote : paths.angled).push_back(resolve(dir));
+                    break;
+                }
+            }
+            return paths;
+        }
+    };
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+#include "nmac/nmac.hpp"
+#include "nmac/tokenizer.hpp"
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace nmac::driver {
+    // A `name!(...)` or `name![...]` invocation found in a source file.
+    // Nested invocations inside `body` have already been expanded.
+    struct MacroCall {
+        std::string_view name;
+        std::string_view body;  // Text between the delimiters
+        char delimiter;         // '(' or '['
+    };
+
+    using Rewriter = std::function<std::string(const MacroCall&)>;
+
+    struct StringHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view s) const { return std::hash<std::string_view>{}(s); }
+    };
+
+    // Maps macro names (without the '!') to their text rewriters. Rewriters
+    // are also indexed by the interned symbol of their name, which is what
+    // MACRO_BANG tokens carry, so finding one costs a single array load.
+    class RewriteTable {
+        std::unordered_map<std::string, Rewriter, StringHash, std::equal_to<>> rewriters;
+        std::vector<const Rewriter*> by_symbol; // Points into `rewriters`
+
+        void index(const std::string& name, const Rewriter& rewriter) {
+            uint32_t symbol = intern_symbol(name);
+            if (by_symbol.size() <= symbol) by_symbol.resize(symbol + 1, nullptr);
+            by_symbol[symbol] = &rewriter;
+        }
+
+    public:
+        RewriteTable() = default;
+        RewriteTable(RewriteTable&&) noexcept = default;
+        RewriteTable& operator=(RewriteTable&&) noexcept = default;
+
+        // A copy gets its own index into its own map
+        RewriteTable(const RewriteTable& other) : rewriters(other.rewriters) {
+            for (const auto& [name, rewriter] : rewriters) index(name, rewriter);
+        }
+
+        RewriteTable& operator=(const RewriteTable& other) {
+            if (this != &other) {
+                rewriters = other.rewriters;
+                by_symbol.clear();
+                for (const auto& [name, rewriter] : rewriters) index(name, rewriter);
+            }
+            return *this;
+        }
+
+        void add(std::string name, Rewriter rewriter) {
+            auto& slot = rewriters[name];
+            slot = std::move(rewriter);
+            index(name, slot);
+        }
+
+        const Rewriter* find(std::string_view name) const {
+            auto it = rewriters.find(name);
+            return it != rewriters.end() ? &it->second : nullptr;
+        }
+
+        const Rewriter* find(uint32_t symbol) const {
+            return symbol < by_symbol.size() ? by_symbol[symbol] : nullptr;
+        }
+
+        bool empty() const { return rewriters.empty(); }
+    };
+
+    // Byte offsets of a token within the source it was scanned from
+    inline size_t begin_offset(std::string_view source, const Token& token) {
+        return static_cast<size_t>(token.content.data() - source.data());
+    }
+
+    inline size_t end_offset(std::string_view source, const Token& token) {
+        return begin_offset(source, token) + token.content.size();
+    }
+
+    inline bool is_open_delimiter(const Token& token) {
+        return token.type == LPAREN || token.type == LBRACE ||
+               (token.type == PUNCT && token.content == "{");
+    }
+
+    inline bool is_close_delimiter(const Token& token) {
+        return token.type == RPAREN || token.type == RBRACE ||
+               (token.type == PUNCT && token.content == "}");
+    }
+
+    // Index of the token closing the delimiter at `open`, searching before `last`.
+    inline size_t find_closing(const std::vector<Token>& tokens, size_t open, size_t last) {
+        size_t depth = 0;
+        for (size_t i = open; i < last; ++i) {
+            if (is_open_delimiter(tokens[i])) {
+                depth++;
+            } else if (is_close_delimiter(tokens[i])) {
+                if (--depth == 0) return i;
+            }
+        }
+        throw std::runtime_error("Unterminated macro invocation");
+    }
+
+    // Index of the delimiter closing the invocation whose MACRO_BANG name is at
+    // `name`; the opening delimiter is the token right after it.
+    inline size_t invocation_close(const std::vector<Token>& tokens, size_t name, size_t last) {
+        return find_closing(tokens, name + 1, last);
+    }
+
+    // Expands every registered macro invocation in a source file, copying the
+    // text around invocations through unchanged.
+    class FileExpander {
+    public:
+        // Resume point for incremental expansion with expand_next()
+        struct Progress {
+            size_t token = 0;
+            size_t byte = 0;
+            size_t invocations = 0;
+        };
+
+    private:
+        const RewriteTable& table;
+
+        const Rewriter* invocation_at(const std::vector<Token>& tokens, size_t i, size_t last) const {
+            const Token& name = tokens[i];
+            if (name.type != MACRO_BANG || i + 1 >= last) return nullptr;
+            if (tokens[i + 1].type != LPAREN && tokens[i + 1].type != LBRACE) return nullptr;
+            return table.find(name.symbol);
+        }
+
+        // Copies text up to and including the next invocation before token `last`,
+        // or the remaining text up to `byte_end` if there is none.
+        bool step(std::string_view source, const std::vector<Token>& tokens, size_t last,
+                  size_t byte_end, Progress& progress, std::string& out) const {
+            if (progress.byte >= byte_end && progress.token >= last) return false;
+
+            for (size_t i = progress.token; i < last; ++i) {
+                const Rewriter* rewriter = invocation_at(tokens, i, last);
+                if (!rewriter) continue;
+
+                size_t open = i + 1;
+                size_t close = invocation_close(tokens, i, last);
+
+                // Expand nested invocations first so the rewriter sees final text
+                std::string body;
+                progress.invocations += expand_range(source, tokens, open + 1, close,
+                                                     end_offset(source, tokens[open]),
+                                                     begin_offset(source, tokens[close]), body);
+
+                out.append(source.substr(progress.byte, begin_offset(source, tokens[i]) - progress.byte));
+                NMAC_TRACE_SCOPE("generate");
+                std::string_view name = tokens[i].content;
+                name.remove_suffix(1); // The '!'
+                out += (*rewriter)(MacroCall{name, body, tokens[open].content[0]});
+                progress.invocations++;
+
+                progress.byte = end_offset(source, tokens[close]);
+                progress.token = close + 1;
+                return true;
+            }
+
+            out.append(source.substr(progress.byte, byte_end - progress.byte));
+            progress.byte = byte_end;
+            progress.token = last;
+            return false;
+        }
+
+    public:
+        explicit FileExpander(const RewriteTable& t) : table(t) {}
+
+        // Expands tokens [first, last) covering bytes [byte_begin, byte_end). Ranges
+        // split at top-level invocation boundaries expand independently, and
+        // concatenating their outputs gives the same text as expanding the whole.
+        size_t expand_range(std::string_view source, const std::vector<Token>& tokens,
+                            size_t first, size_t last, size_t byte_begin, size_t byte_end,
+                            std::string& out) const {
+            NMAC_ALLOC_SCOPE(expand);
+            Progress progress{first, byte_begin, 0};
+            while (step(source, tokens, last, byte_end, progress, out)) {}
+            return progress.invocations;
+        }
+
+        // Whether tokens[i] names a registered invocation
+        bool is_invocation(const std::vector<Token>& tokens, size_t i) const {
+            return invocation_at(tokens, i, tokens.size()) != nullptr;
+        }
+
+        // Token indices of the names of invocations that are not nested in another one
+        std::vector<size_t> top_level_invocations(const std::vector<Token>& tokens) const {
+            std::vector<size_t> starts;
+            for (size_t i = 0; i < tokens.size(); ++i) {
+                if (!invocation_at(tokens, i, tokens.size())) continue;
+                starts.push_back(i);
+                i = invocation_close(tokens, i, tokens.size());
+            }
+            return starts;
+        }
+
+        // Appends the expansion of `source` to `out`; returns the number of invocations expanded.
+        size_t expand(std::string_view source, const std::vector<Token>& tokens, std::string& out) const {
+            out.reserve(out.size() + source.size());
+            return expand_range(source, tokens, 0, tokens.size(), 0, source.size(), out);
+        }
+
+        // Incremental form of expand(): emits text up to and including the next
+        // invocation. Returns false once the whole source has been emitted.
+        bool expand_next(std::string_view source, const std::vector<Token>& tokens,
+                         Progress& progress, std::string& out) const {
+            NMAC_ALLOC_SCOPE(expand);
+            return step(source, tokens, tokens.size(), source.size(), progress, out);
+        }
+
+        std::string expand(std::string_view source) const {
+            Tokenizer tokenizer(source);
+            auto tokens = tokenizer.tokenize();
+            std::string out;
+            expand(source, tokens, out);
+            return out;
+        }
+    };
+}
@@ -0,0 +1,171 @@
+#pragma once
+
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/tokenizer.hpp"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace nmac::driver {
+    // Re-expands files as they change, keeping everything from the previous
+    // run that is still valid: each file's source, token buffer and output, and
+    // the expansion of every top-level invocation keyed by its exact source
+    // text. Only the edited region is re-tokenized, and rewriters are pure, so
+    // an invocation whose text did not change is copied from the cache instead
+    // of being expanded again.
+    //
+    // Different files may be updated concurrently; one file may not.
+    class IncrementalExpander {
+        struct Cached {
+            std::string expansion;
+            uint64_t generation; // Last version of the file that contained the invocation
+        };
+
+        struct Entry {
+            bool loaded = false;
+            uint64_t generation = 0;
+            std::string source;
+            std::string previous;      // The version before `source`; buffer reused by the next update
+            std::vector<Token> tokens; // Views into `source`
+            std::vector<Token> spare;  // Scratch for retokenize(); capacity kept across updates
+            std::string output;
+            size_t invocation_count = 0;
+            std::unordered_map<std::string, Cached, StringHash, std::equal_to<>> invocations;
+        };
+
+        const FileExpander& expander;
+        std::vector<Entry> entries;
+
+        // The same token, symbol included, in a copy of the text shifted by `shift` bytes
+        static Token rebase(const Token& token, std::string_view from, std::string_view to, ptrdiff_t shift) {
+            size_t offset = static_cast<size_t>(static_cast<ptrdiff_t>(begin_offset(from, token)) + shift);
+            return Token(token.type, to.substr(offset, token.content.size()), token.position, token.symbol);
+        }
+
+        // Re-scans `current` given the tokens of `previous`. Tokens ending before
+        // the first changed byte are kept; scanning resumes after the last of them
+        // and stops as soon as it lands on the start of an old token inside the
+        // unchanged tail, on a later line than the edit, from where the old tokens
+        // are identical apart from their offset.
+        static void retokenize(std::string_view previous, std::string_view current,
+                               std::vector<Token>& tokens, std::vector<Token>& old_tail_tokens) {
+            size_t limit = std::min(previous.size(), current.size());
+            size_t prefix = static_cast<size_t>(
+                std::ranges::mismatch(previous.substr(0, limit), current.substr(0, limit)).in1 - previous.begin());
+            size_t tail = 0;
+            while (tail < limit - prefix && previous[previous.size() - 1 - tail] == current[current.size() - 1 - tail]) {
+                tail++;
+            }
+            size_t old_tail = previous.size() - tail;
+            size_t new_tail = current.size() - tail;
+
+            auto first_tail = std::ranges::partition_point(tokens, [&](const Token& t) {
+                return begin_offset(previous, t) < old_tail;
+            });
+            old_tail_tokens.assign(first_tail, tokens.end());
+
+            auto kept = std::ranges::partition_point(tokens, [&](const Token& t) {
+                return end_offset(previous, t) < prefix;
+            });
+            tokens.erase(kept, tokens.end());
+            for (Token& token : tokens) token = rebase(token, previous, current, 0);
+
+            Tokenizer tokenizer(current, tokens.empty() ? 0 : end_offset(current, tokens.back()));
+            while (tokenizer.next(tokens)) {
+                size_t start = begin_offset(current, tokens.back());
+                if (start < new_tail) continue;
+                if (current.substr(new_tail, start - new_tail).find('\n') == std::string_view::npos) continue;
+
+                size_t old_start = start - new_tail + old_tail;
+                auto it = std::ranges::partition_point(old_tail_tokens, [&](const Token& t) {
+                    return begin_offset(previous, t) < old_start;
+                });
+                if (it == old_tail_tokens.end() || begin_offset(previous, *it) != old_start) continue;
+
+                tokens.pop_back();
+                ptrdiff_t shift = static_cast<ptrdiff_t>(new_tail) - static_cast<ptrdiff_t>(old_tail);
+                for (; it != old_tail_tokens.end(); ++it) tokens.push_back(rebase(*it, previous, current, shift));
+                return;
+            }
+        }
+
+    public:
+        struct Stats {
+            size_t invocations = 0; // Top-level invocations in the file
+            size_t reused = 0;      // ...whose expansion came from the cache
+            bool unchanged = false; // Contents identical to the previous version
+        };
+
+        IncrementalExpander(const FileExpander& e, size_t files) : expander(e), entries(files) {}
+
+        // Replaces the contents of file `index` and re-expands it
+        Stats update(size_t index, std::string_view contents) {
+            Entry& entry = entries[index];
+            Stats stats;
+            if (entry.loaded && entry.source == contents) {
+                stats.invocations = stats.reused = entry.invocation_count;
+                stats.unchanged = true;
+                return stats;
+            }
+
+            bool had_tokens = entry.loaded;
+            entry.loaded = false; // Until the new version has expanded cleanly
+            entry.source.swap(entry.previous);
+            entry.source.assign(contents);
+
+            if (had_tokens) {
+                retokenize(entry.previous, entry.source, entry.tokens, entry.spare);
+            } else {
+                entry.tokens.clear();
+                Tokenizer tokenizer(entry.source);
+                while (tokenizer.next(entry.tokens)) {}
+            }
+
+            std::string_view source = entry.source;
+            const auto& tokens = entry.tokens;
+            uint64_t generation = ++entry.generation;
+
+            std::string& out = entry.output;
+            out.clear();
+            out.reserve(source.size());
+
+            size_t byte = 0;
+            for (size_t name : expander.top_level_invocations(tokens)) {
+                size_t close = invocation_close(tokens, name, tokens.size());
+                size_t begin = begin_offset(source, tokens[name]);
+                size_t end = end_offset(source, tokens[close]);
+                std::string_view text = source.substr(begin, end - begin);
+
+                out.append(source.substr(byte, begin - byte));
+                byte = end;
+                stats.invocations++;
+
+                if (auto hit = entry.invocations.find(text); hit != entry.invocations.end()) {
+                    out += hit->second.expansion;
+                    hit->second.generation = generation;
+                    stats.reused++;
+                    continue;
+                }
+
+                std::string expansion;
+                expander.expand_range(source, tokens, name, close + 1, begin, end, expansion);
+                out += expansion;
+                entry.invocations.emplace(text, Cached{std::move(expansion), generation});
+            }
+            out.append(source.substr(byte));
+
+            // Forget invocations that were edited away
+            std::erase_if(entry.invocations, [&](const auto& item) { return item.second.generation != generation; });
+
+            entry.invocation_count = stats.invocations;
+            entry.loaded = true;
+            return stats;
+        }
+
+        const std::string& output(size_t index) const { return entries[index].output; }
+    };
+}
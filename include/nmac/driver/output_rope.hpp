@@ -0,0 +1,147 @@
+#pragma once
+
+#include "nmac/io/file_batch.hpp"
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nmac::driver {
+    // Piece table over an original buffer (typically a MappedFile): edits
+    // replace byte ranges of the original with owned text and are kept in a
+    // map ordered by original offset, so each edit costs O(log n) and the
+    // original is never copied. Output is emitted as a list of slices.
+    //
+    // For streaming, seal(offset) promises that no further edit will start
+    // before `offset`; flush() then writes the sealed prefix and forgets the
+    // edits in it, so memory stays bounded by the unsealed part.
+    class OutputRope {
+        struct Edit {
+            size_t end;         // Original range replaced is [key, end)
+            std::string text;
+            size_t inserted;    // Leading bytes of `text` inserted before the replacement
+        };
+
+        std::string_view original;
+        std::map<size_t, Edit> edits;
+        size_t sealed = 0;   // No edits may start before this original offset
+        size_t flushed = 0;  // Original bytes before this have been written
+        size_t bytes;        // Current output size
+
+        // First edit at or after `offset`; insertions at the very end belong to the last region
+        auto edits_from(size_t offset) const {
+            return offset == original.size() ? edits.end() : edits.lower_bound(offset);
+        }
+
+        // Slices of the output covering original bytes [from, to)
+        void collect(size_t from, size_t to, std::vector<std::string_view>& out) const {
+            size_t byte = from;
+            for (auto it = edits.lower_bound(from); it != edits_from(to); ++it) {
+                if (it->first > byte) out.push_back(original.substr(byte, it->first - byte));
+                if (!it->second.text.empty()) out.push_back(it->second.text);
+                byte = it->second.end;
+            }
+            if (to > byte) out.push_back(original.substr(byte, to - byte));
+        }
+
+    public:
+        OutputRope() : OutputRope(std::string_view{}) {}
+        explicit OutputRope(std::string_view source) : original(source), bytes(source.size()) {}
+
+        // Replaces original bytes [begin, end) with `text`. Ranges may not
+        // overlap earlier edits; an empty range inserts, and inserting again at
+        // the same offset appends to the earlier insertion.
+        void replace(size_t begin, size_t end, std::string text) {
+            if (begin > end || end > original.size()) throw std::out_of_range("OutputRope edit outside the source");
+            if (begin < sealed) throw std::logic_error("OutputRope edit before the sealed prefix");
+
+            auto next = edits.lower_bound(begin);
+            if (next != edits.begin() && std::prev(next)->second.end > begin) {
+                throw std::invalid_argument("Overlapping OutputRope edits");
+            }
+
+            if (next != edits.end() && next->first == begin) {
+                // Another edit starts here; an insertion always comes first
+                Edit& edit = next->second;
+                bool was_insert = edit.end == begin;
+                if (begin == end) {
+                    edit.text.insert(edit.inserted, text);
+                    edit.inserted += text.size();
+                    bytes += text.size();
+                    return;
+                }
+                auto after = std::next(next);
+                if (!was_insert || (after != edits.end() && after->first < end)) {
+                    throw std::invalid_argument("Overlapping OutputRope edits");
+                }
+                edit.text += text;
+                edit.end = end;
+                bytes += text.size();
+                bytes -= end - begin;
+                return;
+            }
+            if (next != edits.end() && next->first < end) {
+                throw std::invalid_argument("Overlapping OutputRope edits");
+            }
+
+            bytes += text.size();
+            bytes -= end - begin;
+            size_t inserted = begin == end ? text.size() : 0;
+            edits.emplace_hint(next, begin, Edit{end, std::move(text), inserted});
+        }
+
+        void insert(size_t at, std::string text) { replace(at, at, std::move(text)); }
+        void erase(size_t begin, size_t end) { replace(begin, end, {}); }
+
+        // Promises that every later edit starts at or after `offset`. It may not
+        // fall strictly inside an edit.
+        void seal(size_t offset) {
+            if (offset > original.size()) offset = original.size();
+            if (offset <= sealed) return;
+            auto it = edits.lower_bound(offset);
+            if (it != edits.begin() && std::prev(it)->second.end > offset) {
+                throw std::logic_error("OutputRope sealed inside an edit");
+            }
+            sealed = offset;
+        }
+
+        // Writes output for the sealed but unwritten prefix and drops its edits
+        void flush(int fd, const std::string& what) {
+            // Once everything is sealed, an insertion at the very end may still arrive
+            if (flushed == sealed && edits.lower_bound(flushed) == edits_from(sealed)) return;
+            std::vector<std::string_view> out;
+            collect(flushed, sealed, out);
+            io::write_vectored(fd, out, what);
+            edits.erase(edits.lower_bound(flushed), edits_from(sealed));
+            flushed = sealed;
+        }
+
+        // Seals everything and writes what is left
+        void finish(int fd, const std::string& what) {
+            seal(original.size());
+            flush(fd, what);
+        }
+
+        // Output not yet flushed, as slices of the original and of edit text
+        std::vector<std::string_view> slices() const {
+            std::vector<std::string_view> out;
+            collect(flushed, original.size(), out);
+            return out;
+        }
+
+        std::string str() const {
+            std::string out;
+            for (auto slice : slices()) out += slice;
+            return out;
+        }
+
+        // Writes the output not yet flushed, leaving the rope as it is
+        void write_to(int fd, const std::string& what) const { io::write_vectored(fd, slices(), what); }
+
+        // Size of the whole output, including any part already flushed
+        size_t size() const { return bytes; }
+        size_t edit_count() const { return edits.size(); }
+    };
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/driver/output_rope.hpp"
+#include "nmac/executor.hpp"
+#include "nmac/reorder_buffer.hpp"
+#include <algorithm>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nmac::driver {
+    struct ParallelOptions {
+        size_t grain = 16;  // Top-level invocations per job
+        size_t window = 0;  // Chunks held for reordering; 0 means four per worker
+    };
+
+    namespace detail {
+        // Token indices splitting a file into jobs of `grain` top-level
+        // invocations; the first job also carries the text before the first one.
+        inline std::vector<size_t> chunk_bounds(const FileExpander& expander, const std::vector<Token>& tokens,
+                                                size_t grain) {
+            std::vector<size_t> starts = expander.top_level_invocations(tokens);
+            std::vector<size_t> bounds{0};
+            grain = std::max<size_t>(grain, 1);
+            for (size_t i = grain; i < starts.size(); i += grain) bounds.push_back(starts[i]);
+            bounds.push_back(tokens.size());
+            return bounds;
+        }
+
+        // Byte offsets of the token bounds. The first job starts at byte 0 and
+        // the last ends at the end of the source, even when there are no
+        // tokens at all and both token bounds are 0.
+        inline std::vector<size_t> byte_bounds(std::string_view source, const std::vector<Token>& tokens,
+                                               const std::vector<size_t>& bounds) {
+            std::vector<size_t> bytes(bounds.size());
+            for (size_t i = 1; i + 1 < bounds.size(); ++i) bytes[i] = begin_offset(source, tokens[bounds[i]]);
+            bytes.back() = source.size();
+            return bytes;
+        }
+    }
+
+    // Expands the invocations of one file on the pool and streams the output to
+    // `sink` in source order as soon as each prefix is complete. The text passed
+    // to `sink` is byte-identical to FileExpander::expand(). Returns the number
+    // of invocations expanded.
+    inline size_t parallel_expand(executor& pool, const FileExpander& expander,
+                                  std::string_view source, const std::vector<Token>& tokens,
+                                  const std::function<void(std::string_view)>& sink,
+                                  ParallelOptions options = {}) {
+        std::vector<size_t> bounds = detail::chunk_bounds(expander, tokens, options.grain);
+        std::vector<size_t> bytes = detail::byte_bounds(source, tokens, bounds);
+
+        struct Chunk {
+            std::string text;
+            size_t invocations = 0;
+        };
+
+        size_t window = options.window ? options.window : 4 * pool.concurrency();
+        size_t invocations = 0;
+        ordered_parallel(pool, bounds.size() - 1, window,
+            [&](size_t i) {
+                NMAC_TRACE_SCOPE("expand chunk");
+                Chunk chunk;
+                chunk.text.reserve(bytes[i + 1] - bytes[i]);
+                chunk.invocations = expander.expand_range(source, tokens, bounds[i], bounds[i + 1],
+                                                          bytes[i], bytes[i + 1], chunk.text);
+                return chunk;
+            },
+            [&](Chunk&& chunk) {
+                invocations += chunk.invocations;
+                sink(chunk.text);
+            });
+        return invocations;
+    }
+
+    // Like parallel_expand(), but records each top-level invocation as an edit
+    // of `rope` (built over `source`) instead of copying the text around it.
+    // After each job's edits are applied in order, the rope is sealed up to the
+    // end of that job and `ready` is called, so the caller can flush() the
+    // finished prefix while later jobs are still expanding.
+    inline size_t parallel_splice(executor& pool, const FileExpander& expander,
+                                  std::string_view source, const std::vector<Token>& tokens,
+                                  OutputRope& rope, const std::function<void()>& ready,
+                                  ParallelOptions options = {}) {
+        std::vector<size_t> bounds = detail::chunk_bounds(expander, tokens, options.grain);
+        std::vector<size_t> bytes = detail::byte_bounds(source, tokens, bounds);
+
+        struct Edit {
+            size_t begin;
+            size_t end;
+            std::string text;
+        };
+        struct Chunk {
+            std::vector<Edit> edits;
+            size_t byte_end = 0;
+            size_t invocations = 0;
+        };
+
+        size_t window = options.window ? options.window : 4 * pool.concurrency();
+        size_t invocations = 0;
+        ordered_parallel(pool, bounds.size() - 1, window,
+            [&](size_t i) {
+                NMAC_TRACE_SCOPE("expand chunk");
+                Chunk chunk;
+                chunk.byte_end = bytes[i + 1];
+                for (size_t t = bounds[i]; t < bounds[i + 1]; ++t) {
+                    if (!expander.is_invocation(tokens, t)) continue;
+                    size_t close = invocation_close(tokens, t, tokens.size());
+                    Edit edit{begin_offset(source, tokens[t]), end_offset(source, tokens[close]), {}};
+                    chunk.invocations += expander.expand_range(source, tokens, t, close + 1,
+                                                               edit.begin, edit.end, edit.text);
+                    chunk.edits.push_back(std::move(edit));
+                    t = close;
+                }
+                return chunk;
+            },
+            [&](Chunk&& chunk) {
+                for (auto& edit : chunk.edits) rope.replace(edit.begin, edit.end, std::move(edit.text));
+                rope.seal(chunk.byte_end);
+                invocations += chunk.invocations;
+                ready();
+            });
+        return invocations;
+    }
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include "nmac/driver/compile_commands.hpp"
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/driver/splice.hpp"
+#include "nmac/executor.hpp"
+#include "nmac/io/file_batch.hpp"
+#include "nmac/tokenizer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace nmac::driver {
+    // A translation unit from the compilation database, or a header reached from one
+    struct ProjectFile {
+        std::string path;                     // Canonical, so shared headers appear once
+        bool translation_unit = false;
+        std::shared_ptr<const IncludePaths> search; // Of the first translation unit that reached it
+
+        std::string source;
+        std::vector<Token> tokens;            // Tokenized once while scanning; released after expansion
+        std::vector<size_t> includes;         // Project files this one includes
+        std::vector<size_t> includers;        // Project files that include this one
+
+        OutputRope output;                    // Over `source`, with an edit per expansion
+        size_t token_count = 0;
+        size_t invocations = 0;
+        double tokenize_ms = 0;
+        double expand_ms = 0;
+    };
+
+    // Whole-project expansion: scan() discovers every file reachable through
+    // #include from the compilation database, reading and tokenizing each one
+    // exactly once. expand() then runs the include graph on the pool, expanding
+    // a file only after the headers it includes, largest ready file first.
+    class Project {
+        std::deque<ProjectFile> files; // Never relocated: tokens and output point into `source`
+        std::unordered_map<std::string, size_t> by_path;
+
+        using clock = std::chrono::steady_clock;
+
+        static double elapsed_ms(clock::time_point since) {
+            return std::chrono::duration<double, std::milli>(clock::now() - since).count();
+        }
+
+        static std::optional<std::string> canonical(const std::filesystem::path& path) {
+            std::error_code ec;
+            auto resolved = std::filesystem::canonical(path, ec);
+            if (ec || !std::filesystem::is_regular_file(resolved, ec)) return std::nullopt;
+            return resolved.string();
+        }
+
+        // Index of the file at `path`, registering it if it is new
+        std::pair<size_t, bool> add(std::string path, std::shared_ptr<const IncludePaths> search) {
+            auto [it, inserted] = by_path.try_emplace(path, files.size());
+            if (inserted) {
+                ProjectFile& file = files.emplace_back();
+                file.path = std::move(path);
+                file.search = std::move(search);
+            }
+            return {it->second, inserted};
+        }
+
+        // #include targets that resolve to existing files. `<...>` headers that
+        // are not on the search path (the standard library, say) are skipped.
+        static std::vector<std::string> resolve_includes(const ProjectFile& file) {
+            std::vector<std::string> found;
+            const auto& tokens = file.tokens;
+            std::string_view source = file.source;
+
+            for (size_t i = 0; i + 2 < tokens.size(); ++i) {
+                if (tokens[i].type != PUNCT || tokens[i].content != "#") continue;
+                if (tokens[i + 1].content != "include") continue;
+
+                // The directive must start its line
+                size_t line = source.rfind('\n', begin_offset(source, tokens[i]));
+                line = line == std::string_view::npos ? 0 : line + 1;
+                if (source.substr(line, begin_offset(source, tokens[i]) - line)
+                        .find_first_not_of(" \t") != std::string_view::npos) continue;
+
+                const Token& target = tokens[i + 2];
+                std::string_view name;
+                bool quoted = target.type == LITERAL && target.content.starts_with('"');
+                if (quoted) {
+                    name = target.content.substr(1, target.content.size() - 2);
+                } else if (target.type == PUNCT && target.content == "<") {
+                    size_t close = i + 3;
+                    while (close < tokens.size() && tokens[close].content != ">") close++;
+                    if (close == tokens.size()) continue;
+                    size_t from = end_offset(source, target);
+                    name = source.substr(from, begin_offset(source, tokens[close]) - from);
+                } else {
+                    continue;
+                }
+
+                std::optional<std::string> resolved;
+                if (quoted) {
+                    resolved = canonical(std::filesystem::path(file.path).parent_path() / name);
+                    for (size_t d = 0; !resolved && d < file.search->quote.size(); ++d) {
+                        resolved = canonical(std::filesystem::path(file.search->quote[d]) / name);
+                    }
+                }
+                for (size_t d = 0; !resolved && d < file.search->angled.size(); ++d) {
+                    resolved = canonical(std::filesystem::path(file.search->angled[d]) / name);
+                }
+                if (resolved) found.push_back(std::move(*resolved));
+            }
+            return found;
+        }
+
+    public:
+        static Project scan(const std::vector<CompileCommand>& commands, io::BatchIo& io) {
+            Project project;
+            std::vector<size_t> frontier;
+            for (const auto& command : commands) {
+                auto path = canonical(command.file);
+                if (!path) throw std::runtime_error("Cannot find translation unit: " + command.file);
+                auto [index, added] = project.add(std::move(*path),
+                                                  std::make_shared<IncludePaths>(IncludePaths::from(command)));
+                project.files[index].translation_unit = true;
+                if (added) frontier.push_back(index);
+            }
+
+            // Breadth-first over the include graph, one batched read per level
+            while (!frontier.empty()) {
+                std::vector<std::string> paths;
+                paths.reserve(frontier.size());
+                for (size_t index : frontier) paths.push_back(project.files[index].path);
+
+                std::vector<std::vector<std::string>> found(frontier.size());
+                io.read(paths, [&](size_t k, std::string_view contents) {
+                    ProjectFile& file = project.files[frontier[k]];
+                    file.source.assign(contents);
+
+                    auto start = clock::now();
+                    Tokenizer tokenizer(file.source);
+                    file.tokens = tokenizer.tokenize();
+                    file.tokenize_ms = elapsed_ms(start);
+                    file.token_count = file.tokens.size();
+
+                    found[k] = resolve_includes(file);
+                });
+
+                std::vector<size_t> next;
+                for (size_t k = 0; k < frontier.size(); ++k) {
+                    size_t includer = frontier[k];
+                    for (auto& path : found[k]) {
+                        auto [index, added] = project.add(std::move(path), project.files[includer].search);
+                        if (added) next.push_back(index);
+                        auto& includes = project.files[includer].includes;
+                        if (index == includer || std::ranges::find(includes, index) != includes.end()) continue;
+                        includes.push_back(index);
+                        project.files[index].includers.push_back(includer);
+                    }
+                }
+                frontier = std::move(next);
+            }
+            return project;
+        }
+
+        // Expansion is file-local: a file's output never depends on the files
+        // it includes, so every file is ready at once. Jobs take them largest
+        // first, so the longest expansions start earliest and small files fill
+        // in around them.
+        void expand(const FileExpander& expander, executor& pool) {
+            std::vector<size_t> order(files.size());
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+            std::ranges::stable_sort(order, [&](size_t a, size_t b) {
+                return files[a].source.size() > files[b].source.size();
+            });
+
+            std::atomic<size_t> next{0};
+            task_group group(pool);
+            auto run_largest = [&] {
+                ProjectFile& file = files[order[next.fetch_add(1, std::memory_order_relaxed)]];
+                auto start = clock::now();
+                file.output = OutputRope(file.source);
+                file.invocations = splice_expansion(expander, file.source, file.tokens, file.output);
+                file.expand_ms = elapsed_ms(start);
+                std::vector<Token>().swap(file.tokens);
+            };
+            for (size_t i = 0; i < order.size(); ++i) group.spawn(run_largest);
+            group.sync();
+        }
+
+        const std::deque<ProjectFile>& contents() const { return files; }
+
+        // Per-file timings, slowest first, followed by totals
+        void write_report(std::ostream& out) const {
+            std::vector<size_t> order(files.size());
+            for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+            auto total = [&](size_t i) { return files[i].tokenize_ms + files[i].expand_ms; };
+            std::ranges::stable_sort(order, [&](size_t a, size_t b) { return total(a) > total(b); });
+
+            char line[128];
+            std::snprintf(line, sizeof line, "%10s %10s %10s %10s %9s %7s %9s  %s\n",
+                          "total ms", "tokenize", "expand", "bytes", "tokens", "macros", "includers", "file");
+            out << line;
+
+            size_t units = 0, shared = 0, bytes = 0, invocations = 0;
+            double tokenize = 0, expand = 0;
+            for (size_t i : order) {
+                const ProjectFile& f = files[i];
+                std::snprintf(line, sizeof line, "%10.3f %10.3f %10.3f %10zu %9zu %7zu %9zu  ",
+                              total(i), f.tokenize_ms, f.expand_ms, f.source.size(), f.token_count,
+                              f.invocations, f.includers.size());
+                out << line << f.path << '\n';
+
+                units += f.translation_unit;
+                shared += f.includers.size() > 1;
+                bytes += f.source.size();
+                invocations += f.invocations;
+                tokenize += f.tokenize_ms;
+                expand += f.expand_ms;
+            }
+
+            out << files.size() << " files (" << units << " translation units, "
+                << files.size() - units << " headers, " << shared << " shared), "
+                << bytes << " bytes, " << invocations << " invocations; "
+                << "tokenize " << tokenize << " ms, expand " << expand << " ms of CPU time\n";
+        }
+    };
+}
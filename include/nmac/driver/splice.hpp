@@ -0,0 +1,27 @@
+#pragma once
+
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/driver/output_rope.hpp"
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace nmac::driver {
+    // Splice form of FileExpander::expand(): each top-level invocation becomes
+    // an edit of `out`, a rope over `source`, so everything between them is
+    // referenced in place. Returns the number of invocations expanded.
+    inline size_t splice_expansion(const FileExpander& expander, std::string_view source,
+                                   const std::vector<Token>& tokens, OutputRope& out) {
+        size_t invocations = 0;
+        for (size_t name : expander.top_level_invocations(tokens)) {
+            size_t close = invocation_close(tokens, name, tokens.size());
+            size_t begin = begin_offset(source, tokens[name]);
+            size_t end = end_offset(source, tokens[close]);
+
+            std::string expansion;
+            invocations += expander.expand_range(source, tokens, name, close + 1, begin, end, expansion);
+            out.replace(begin, end, std::move(expansion));
+        }
+        return invocations;
+    }
+}
@@ -0,0 +1,357 @@
+#pragma once
+
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/io/file_batch.hpp"
+#include "nmac/io/mapped_file.hpp"
+#include "nmac/tokenizer.hpp"
+#include <unistd.h>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace nmac::driver {
+    namespace detail {
+        // 64-bit content hash, eight bytes at a time. Used as a cache key
+        // together with the source size, not for anything adversarial.
+        inline uint64_t content_hash(std::string_view data) {
+            constexpr uint64_t k = 0x9e3779b97f4a7c15ull;
+            uint64_t h = data.size() * k;
+            size_t i = 0;
+            for (; i + 8 <= data.size(); i += 8) {
+                uint64_t word;
+                std::memcpy(&word, data.data() + i, 8);
+                h = (h ^ (word * 0xbf58476d1ce4e5b9ull)) * k;
+                h ^= h >> 29;
+            }
+            uint64_t tail = 0;
+            if (i < data.size()) std::memcpy(&tail, data.data() + i, data.size() - i);
+            h = (h ^ (tail * 0x94d049bb133111ebull)) * k;
+            h ^= h >> 32;
+            h *= 0xd6e8feb86659fd93ull;
+            return h ^ (h >> 32);
+        }
+
+        // On-disk image: a header followed by 8-byte aligned arrays, in this order
+        struct TokenImageHeader {
+            char magic[8];
+            uint32_t version;
+            uint32_t token_count;
+            uint64_t source_hash;
+            uint64_t source_size;
+            uint32_t symbol_count;
+            uint32_t symbol_bytes;
+        };
+
+        inline constexpr char token_image_magic[8] = {'N', 'M', 'A', 'C', 'T', 'O', 'K', '\0'};
+        inline constexpr uint32_t token_image_version = 2;
+
+        // Byte offsets of each array within an image
+        struct TokenImageLayout {
+            size_t types, offsets, lengths, columns, symbols, jumps, symbol_offsets, symbol_chars, total;
+
+            static constexpr size_t align(size_t n) { return (n + 7) & ~size_t{7}; }
+
+            static TokenImageLayout of(size_t tokens, size_t symbols, size_t symbol_bytes) {
+                TokenImageLayout l;
+                l.types = align(sizeof(TokenImageHeader));
+                l.offsets = align(l.types + tokens);
+                l.lengths = align(l.offsets + 4 * tokens);
+                l.columns = align(l.lengths + 4 * tokens);
+                l.symbols = align(l.columns + 4 * tokens);
+                l.jumps = align(l.symbols + 4 * tokens);
+                l.symbol_offsets = align(l.jumps + 4 * tokens);
+                l.symbol_chars = align(l.symbol_offsets + 4 * (symbols + 1));
+                l.total = align(l.symbol_chars + symbol_bytes);
+                return l;
+            }
+        };
+    }
+
+    // A tokenized file as parallel arrays (types, byte offsets and lengths,
+    // columns, interned symbols and a delimiter jump table) laid out exactly as
+    // in the on-disk cache, so a mapped cache file is used without decoding.
+    // Token text is sliced from the source it was built from, which must
+    // outlive the buffer. Indexing yields Tokens, so PatternMatcher<TokenBuffer>
+    // runs over the arrays directly.
+    class TokenBuffer {
+    public:
+        using value_type = Token;
+        static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+    private:
+        std::vector<uint64_t> owned;  // Image built in memory
+        io::MappedFile mapped;        // Or a cache file mapped from disk
+        std::string_view source;
+
+        size_t count = 0;
+        const uint8_t* types = nullptr;
+        const uint32_t* offsets = nullptr;
+        const uint32_t* lengths = nullptr;
+        const uint32_t* columns = nullptr;
+        const uint32_t* symbols = nullptr;
+        const uint32_t* jumps = nullptr;
+        size_t symbol_count = 0;
+        const uint32_t* symbol_offsets = nullptr;
+        const char* symbol_chars = nullptr;
+
+        // Process-wide symbol (see intern_symbol) of each image symbol that
+        // names a MACRO_BANG token. Image symbols are local to the file, so
+        // this is rebuilt whenever an image is bound.
+        std::vector<uint32_t> bang_symbols;
+
+        const char* image() const {
+            return owned.empty() ? mapped.view().data() : reinterpret_cast<const char*>(owned.data());
+        }
+
+        const detail::TokenImageHeader& header() const {
+            return *reinterpret_cast<const detail::TokenImageHeader*>(image());
+        }
+
+        // Points the arrays into the image and checks every index they hold,
+        // so a corrupt or foreign image is rejected rather than trusted.
+        // Returns false, leaving the buffer unusable, if any is out of range.
+        bool bind() {
+            const auto& h = header();
+            auto layout = detail::TokenImageLayout::of(h.token_count, h.symbol_count, h.symbol_bytes);
+            const char* base = image();
+            count = h.token_count;
+            types = reinterpret_cast<const uint8_t*>(base + layout.types);
+            offsets = reinterpret_cast<const uint32_t*>(base + layout.offsets);
+            lengths = reinterpret_cast<const uint32_t*>(base + layout.lengths);
+            columns = reinterpret_cast<const uint32_t*>(base + layout.columns);
+            symbols = reinterpret_cast<const uint32_t*>(base + layout.symbols);
+            jumps = reinterpret_cast<const uint32_t*>(base + layout.jumps);
+            symbol_count = h.symbol_count;
+            symbol_offsets = reinterpret_cast<const uint32_t*>(base + layout.symbol_offsets);
+            symbol_chars = base + layout.symbol_chars;
+
+            if (symbol_offsets[0] != 0 || symbol_offsets[symbol_count] > h.symbol_bytes) return false;
+            for (size_t s = 0; s < symbol_count; ++s) {
+                if (symbol_offsets[s] > symbol_offsets[s + 1]) return false;
+            }
+
+            bang_symbols.assign(symbol_count, no_symbol);
+            for (size_t i = 0; i < count; ++i) {
+                if (types[i] > MACRO_BANG || uint64_t{offsets[i]} + lengths[i] > source.size() ||
+                    (symbols[i] != none && symbols[i] >= symbol_count) || (jumps[i] != none && jumps[i] >= count)) {
+                    return false;
+                }
+                if (types[i] != MACRO_BANG) continue;
+                if (symbols[i] == none) return false;
+                uint32_t& global = bang_symbols[symbols[i]];
+                if (global == no_symbol) global = intern_symbol(symbol_name(symbols[i]));
+            }
+            return true;
+        }
+
+        uint32_t token_symbol(size_t i) const {
+            return types[i] == MACRO_BANG ? bang_symbols[symbols[i]] : no_symbol;
+        }
+
+        TokenBuffer() = default;
+
+    public:
+        // Builds the arrays for `tokens`, which were scanned from `src`
+        static TokenBuffer build(std::string_view src, const std::vector<Token>& tokens) {
+            if (src.size() >= none || tokens.size() >= none) {
+                throw std::length_error("Source too large for a TokenBuffer");
+            }
+
+            std::unordered_map<std::string_view, uint32_t> interned;
+            std::vector<std::string_view> names;
+            std::vector<uint32_t> symbol_ids(tokens.size(), none);
+            size_t symbol_bytes = 0;
+            for (size_t i = 0; i < tokens.size(); ++i) {
+                if (tokens[i].type != IDENT && tokens[i].type != KEYWORD && tokens[i].type != MACRO_BANG) continue;
+                // `vec!` shares the symbol of `vec`
+                std::string_view name = tokens[i].content;
+                if (tokens[i].type == MACRO_BANG) name.remove_suffix(1);
+                auto [it, added] = interned.try_emplace(name, static_cast<uint32_t>(names.size()));
+                if (added) {
+                    names.push_back(name);
+                    symbol_bytes += name.size();
+                }
+                symbol_ids[i] = it->second;
+            }
+
+            auto layout = detail::TokenImageLayout::of(tokens.size(), names.size(), symbol_bytes);
+            TokenBuffer buffer;
+            buffer.owned.assign(layout.total / 8, 0);
+            char* base = reinterpret_cast<char*>(buffer.owned.data());
+
+            detail::TokenImageHeader h{};
+            std::memcpy(h.magic, detail::token_image_magic, sizeof h.magic);
+            h.version = detail::token_image_version;
+            h.token_count = static_cast<uint32_t>(tokens.size());
+            h.source_hash = detail::content_hash(src);
+            h.source_size = src.size();
+            h.symbol_count = static_cast<uint32_t>(names.size());
+            h.symbol_bytes = static_cast<uint32_t>(symbol_bytes);
+            std::memcpy(base, &h, sizeof h);
+
+            auto* types = reinterpret_cast<uint8_t*>(base + layout.types);
+            auto* offsets = reinterpret_cast<uint32_t*>(base + layout.offsets);
+            auto* lengths = reinterpret_cast<uint32_t*>(base + layout.lengths);
+            auto* columns = reinterpret_cast<uint32_t*>(base + layout.columns);
+            auto* jumps = reinterpret_cast<uint32_t*>(base + layout.jumps);
+            std::memcpy(base + layout.symbols, symbol_ids.data(), 4 * symbol_ids.size());
+
+            std::vector<uint32_t> open;
+            for (size_t i = 0; i < tokens.size(); ++i) {
+                types[i] = static_cast<uint8_t>(tokens[i].type);
+                offsets[i] = static_cast<uint32_t>(begin_offset(src, tokens[i]));
+                lengths[i] = static_cast<uint32_t>(tokens[i].content.size());
+                columns[i] = static_cast<uint32_t>(tokens[i].position);
+                jumps[i] = none;
+                if (is_open_delimiter(tokens[i])) {
+                    open.push_back(static_cast<uint32_t>(i));
+                } else if (is_close_delimiter(tokens[i]) && !open.empty()) {
+                    jumps[i] = open.back();
+                    jumps[open.back()] = static_cast<uint32_t>(i);
+                    open.pop_back();
+                }
+            }
+
+            auto* symbol_offsets = reinterpret_cast<uint32_t*>(base + layout.symbol_offsets);
+            char* chars = base + layout.symbol_chars;
+            uint32_t at = 0;
+            for (size_t s = 0; s < names.size(); ++s) {
+                symbol_offsets[s] = at;
+                std::memcpy(chars + at, names[s].data(), names[s].size());
+                at += static_cast<uint32_t>(names[s].size());
+            }
+            symbol_offsets[names.size()] = at;
+
+            buffer.source = src;
+            if (!buffer.bind()) throw std::logic_error("TokenBuffer built an inconsistent image");
+            return buffer;
+        }
+
+        // Maps a cache file; nullopt if it is not a valid image for `src`,
+        // including one whose arrays index outside the image or the source
+        static std::optional<TokenBuffer> map(const std::string& path, std::string_view src) {
+            return map(path, src, detail::content_hash(src));
+        }
+
+        static std::optional<TokenBuffer> map(const std::string& path, std::string_view src, uint64_t hash) {
+            TokenBuffer buffer;
+            buffer.mapped = io::MappedFile(path);
+            std::string_view bytes = buffer.mapped.view();
+            if (bytes.size() < sizeof(detail::TokenImageHeader)) return std::nullopt;
+
+            const auto& h = buffer.header();
+            if (std::memcmp(h.magic, detail::token_image_magic, sizeof h.magic) != 0 ||
+                h.version != detail::token_image_version || h.source_hash != hash || h.source_size != src.size() ||
+                detail::TokenImageLayout::of(h.token_count, h.symbol_count, h.symbol_bytes).total > bytes.size()) {
+                return std::nullopt;
+            }
+            buffer.source = src;
+            if (!buffer.bind()) return std::nullopt;
+            return buffer;
+        }
+
+        TokenBuffer(TokenBuffer&&) noexcept = default;
+        TokenBuffer& operator=(TokenBuffer&&) noexcept = default;
+
+        size_t size() const { return count; }
+        bool empty() const { return count == 0; }
+
+        Token operator[](size_t i) const {
+            return Token(type(i), content(i), columns[i], token_symbol(i));
+        }
+
+        TokenType type(size_t i) const { return static_cast<TokenType>(types[i]); }
+        size_t offset(size_t i) const { return offsets[i]; }
+        std::string_view content(size_t i) const { return source.substr(offsets[i], lengths[i]); }
+
+        // Interned id of an identifier, keyword or macro name token within
+        // this image, or `none`
+        uint32_t symbol(size_t i) const { return symbols[i]; }
+        size_t symbols_size() const { return symbol_count; }
+        std::string_view symbol_name(uint32_t id) const {
+            return {symbol_chars + symbol_offsets[id], symbol_offsets[id + 1] - symbol_offsets[id]};
+        }
+
+        // Index of the delimiter matching the one at `i`, or `none`
+        uint32_t matching(size_t i) const { return jumps[i]; }
+
+        uint64_t source_hash() const { return header().source_hash; }
+
+        // Serialized image, as written to the cache
+        std::string_view bytes() const {
+            const auto& h = header();
+            return {image(), detail::TokenImageLayout::of(h.token_count, h.symbol_count, h.symbol_bytes).total};
+        }
+
+        // Tokens as the Tokenizer returns them, for code that needs a vector
+        std::vector<Token> tokens() const {
+            std::vector<Token> out;
+            out.reserve(count);
+            for (size_t i = 0; i < count; ++i) out.emplace_back(type(i), content(i), columns[i], token_symbol(i));
+            return out;
+        }
+    };
+
+    // Directory of TokenBuffer images named by the content hash of their
+    // source, so an unchanged file is never tokenized twice.
+    class TokenCache {
+        std::filesystem::path dir;
+
+        std::string path_for(uint64_t hash) const {
+            char name[24];
+            std::snprintf(name, sizeof name, "%016llx.tok", static_cast<unsigned long long>(hash));
+            return (dir / name).string();
+        }
+
+    public:
+        explicit TokenCache(std::filesystem::path directory) : dir(std::move(directory)) {
+            std::filesystem::create_directories(dir);
+        }
+
+        std::optional<TokenBuffer> load(std::string_view source) const {
+            uint64_t hash = detail::content_hash(source);
+            std::string path = path_for(hash);
+            std::error_code ec;
+            if (!std::filesystem::exists(path, ec)) return std::nullopt;
+            return TokenBuffer::map(path, source, hash);
+        }
+
+        // Writes through a temporary file and rename, so readers in other
+        // processes see either nothing or a complete image
+        void store(const TokenBuffer& buffer) const {
+            std::string path = path_for(buffer.source_hash());
+            static std::atomic<unsigned> serial{0};
+            std::string temp = path + "." + std::to_string(::getpid()) + "." +
+                               std::to_string(serial.fetch_add(1, std::memory_order_relaxed)) + ".tmp";
+            int fd = io::detail::open_or_throw(temp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            try {
+                std::string_view bytes = buffer.bytes();
+                io::write_vectored(fd, {&bytes, 1}, temp);
+            } catch (...) {
+                ::close(fd);
+                ::unlink(temp.c_str());
+                throw;
+            }
+            ::close(fd);
+            std::filesystem::rename(temp, path);
+        }
+
+        // The cached tokens of `source`, tokenizing and storing them on a miss
+        TokenBuffer tokens(std::string_view source) const {
+            if (auto cached = load(source)) return std::move(*cached);
+            Tokenizer tokenizer(source);
+            auto buffer = TokenBuffer::build(source, tokenizer.tokenize());
+            store(buffer);
+            return buffer;
+        }
+    };
+}
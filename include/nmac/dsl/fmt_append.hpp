@@ -0,0 +1,225 @@
+#pragma once
+
+#include <bit>
+#include <charconv>
+#include <concepts>
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <ranges>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+// Appends the text of a value straight onto an output string. Scalars read
+// exactly as they would through operator<< on a default std::ostream, and
+// types with their own operator<< use it. Ranges, maps and tuples are written
+// as [a, b], {k: v} and (a, b). Only operator<< types go through a temporary.
+namespace nmac::dsl::fmt {
+    // Brackets and separator used for a range
+    struct RangeStyle {
+        std::string_view open = "[";
+        std::string_view separator = ", ";
+        std::string_view close = "]";
+    };
+
+    // A range together with the style to write it in; see join() and styled()
+    template<typename R>
+    struct StyledRange {
+        const R& range;
+        RangeStyle style;
+    };
+
+    // Elements separated by `separator`, without brackets
+    template<std::ranges::input_range R>
+    StyledRange<R> join(const R& range, std::string_view separator) { return {range, {"", separator, ""}}; }
+
+    template<std::ranges::input_range R>
+    StyledRange<R> styled(const R& range, RangeStyle style) { return {range, style}; }
+
+    namespace detail {
+        inline constexpr char digit_pairs[] =
+            "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+            "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+            "8081828384858687888990919293949596979899";
+
+        inline constexpr uint64_t powers_of_10[] = {
+            1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull,
+            1000000000ull, 10000000000ull, 100000000000ull, 1000000000000ull, 10000000000000ull,
+            100000000000000ull, 1000000000000000ull, 10000000000000000ull, 100000000000000000ull,
+            1000000000000000000ull, 10000000000000000000ull
+        };
+
+        // Number of decimal digits in `v`, without a loop
+        constexpr unsigned digit_count(uint64_t v) {
+            v |= 1; // Zero has one digit; no power of ten is odd
+            unsigned guess = (static_cast<unsigned>(std::bit_width(v)) * 1233) >> 12;
+            return guess + (v >= powers_of_10[guess]);
+        }
+
+        // Writes `v` so that it ends just before `end`, two digits per step.
+        // Usable in constant expressions, where it stands in for to_chars.
+        constexpr void write_digits(char* end, uint64_t v) {
+            while (v >= 100) {
+                end -= 2;
+                end[0] = digit_pairs[2 * (v % 100)];
+                end[1] = digit_pairs[2 * (v % 100) + 1];
+                v /= 100;
+            }
+            if (v >= 10) {
+                end[-2] = digit_pairs[2 * v];
+                end[-1] = digit_pairs[2 * v + 1];
+            } else {
+                end[-1] = static_cast<char>('0' + v);
+            }
+        }
+
+        template<std::integral T>
+        constexpr uint64_t magnitude(T v) {
+            if constexpr (std::is_signed_v<T>) {
+                return v < 0 ? uint64_t{0} - static_cast<uint64_t>(v) : static_cast<uint64_t>(v);
+            } else {
+                return static_cast<uint64_t>(v);
+            }
+        }
+
+        template<std::integral T>
+        constexpr size_t integer_length(T v) {
+            return digit_count(magnitude(v)) + (std::is_signed_v<T> && v < 0);
+        }
+
+        template<typename T>
+        concept character = std::same_as<T, char> || std::same_as<T, signed char> || std::same_as<T, unsigned char>;
+
+        template<typename T>
+        concept number = std::integral<T> && !character<T> && !std::same_as<T, bool> && sizeof(T) <= 8;
+
+        template<typename T>
+        concept string_like = std::is_convertible_v<const T&, std::string_view>;
+
+        template<typename T>
+        concept tuple_like = requires { std::tuple_size<T>::value; };
+
+        template<typename R>
+        concept map_like = std::ranges::input_range<R> && requires {
+            typename R::key_type;
+            typename R::mapped_type;
+        };
+
+        template<typename T>
+        concept streamable = requires(std::ostream& os, const T& v) { os << v; };
+
+        template<typename T>
+        struct is_styled : std::false_type {};
+        template<typename R>
+        struct is_styled<StyledRange<R>> : std::true_type {};
+    }
+
+    template<typename T>
+    void append_value(std::string& out, const T& value);
+
+    template<detail::number T>
+    void append_integer(std::string& out, T value) {
+        size_t length = detail::integer_length(value);
+        size_t at = out.size();
+        out.resize(at + length);
+        if (value < 0) out[at] = '-';
+        detail::write_digits(out.data() + at + length, detail::magnitude(value));
+    }
+
+    // Integer arrays are measured first, so the output grows once and every
+    // element is written in place with no per-element bounds checks.
+    template<std::ranges::contiguous_range R>
+        requires detail::number<std::ranges::range_value_t<R>>
+    void append_integers(std::string& out, const R& range, RangeStyle style) {
+        auto first = std::ranges::data(range);
+        size_t count = std::ranges::size(range);
+
+        size_t length = style.open.size() + style.close.size();
+        if (count) length += style.separator.size() * (count - 1);
+        for (size_t i = 0; i < count; ++i) length += detail::integer_length(first[i]);
+
+        size_t at = out.size();
+        out.resize(at + length);
+        char* p = out.data() + at;
+        std::memcpy(p, style.open.data(), style.open.size());
+        p += style.open.size();
+        for (size_t i = 0; i < count; ++i) {
+            if (i) {
+                std::memcpy(p, style.separator.data(), style.separator.size());
+                p += style.separator.size();
+            }
+            size_t n = detail::integer_length(first[i]);
+            if (first[i] < 0) *p = '-';
+            detail::write_digits(p + n, detail::magnitude(first[i]));
+            p += n;
+        }
+        std::memcpy(p, style.close.data(), style.close.size());
+    }
+
+    template<std::ranges::input_range R>
+    void append_range(std::string& out, const R& range, RangeStyle style = {}) {
+        if constexpr (std::ranges::contiguous_range<R> && std::ranges::sized_range<R> &&
+                      detail::number<std::ranges::range_value_t<R>>) {
+            append_integers(out, range, style);
+        } else {
+            out += style.open;
+            bool first = true;
+            for (const auto& element : range) {
+                if (!first) out += style.separator;
+                first = false;
+                if constexpr (detail::map_like<R>) {
+                    append_value(out, element.first);
+                    out += ": ";
+                    append_value(out, element.second);
+                } else {
+                    append_value(out, element);
+                }
+            }
+            out += style.close;
+        }
+    }
+
+    template<typename T>
+    void append_value(std::string& out, const T& value) {
+        if constexpr (detail::is_styled<T>::value) {
+            append_range(out, value.range, value.style);
+        } else if constexpr (std::is_same_v<T, bool>) {
+            out += value ? '1' : '0';
+        } else if constexpr (detail::character<T>) {
+            out += static_cast<char>(value);
+        } else if constexpr (std::is_pointer_v<T> && detail::character<std::remove_cv_t<std::remove_pointer_t<T>>>) {
+            if (value) out += reinterpret_cast<const char*>(value);
+        } else if constexpr (detail::string_like<T>) {
+            out += std::string_view(value);
+        } else if constexpr (detail::number<T>) {
+            append_integer(out, value);
+        } else if constexpr (std::is_floating_point_v<T>) {
+            // Same digits as a default ostream: %g with six significant digits
+            char buffer[64];
+            auto result = std::to_chars(buffer, buffer + sizeof buffer, value, std::chars_format::general, 6);
+            out.append(buffer, result.ptr);
+        } else if constexpr (detail::streamable<T>) {
+            // A type's own operator<< wins over treating it as a range
+            std::ostringstream ss;
+            ss << value;
+            out += ss.view();
+        } else if constexpr (detail::map_like<T>) {
+            append_range(out, value, {"{", ", ", "}"});
+        } else if constexpr (std::ranges::input_range<T>) {
+            append_range(out, value);
+        } else if constexpr (detail::tuple_like<T>) {
+            out += '(';
+            std::apply([&](const auto&... elements) {
+                bool first = true;
+                ((out += first ? "" : ", ", first = false, append_value(out, elements)), ...);
+            }, value);
+            out += ')';
+        } else {
+            static_assert(detail::tuple_like<T>, "append_value needs a range, tuple or type with operator<<");
+        }
+    }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include "nmac/nmac.hpp"
+#include "nmac/dsl/fmt_append.hpp"
+#include <array>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Format arguments known at compile time. Passing fmt::constant<V> instead of
+// V to FormatTemplate or a "..."_println literal formats V during compilation
+// and merges it into the literal text around it, so a call whose arguments
+// are all constants prints one precomputed string.
+namespace nmac::dsl::fmt {
+    template<auto V>
+    struct Constant {
+        static constexpr auto value = V;
+    };
+
+    template<auto V>
+    inline constexpr Constant<V> constant{};
+
+    namespace detail {
+        template<typename T>
+        struct is_ct_string : std::false_type {};
+        template<size_t N>
+        struct is_ct_string<nmac::ct_string<N>> : std::true_type {};
+
+        // Values whose text can be produced in a constant expression. Floating
+        // point is not among them: it still formats at run time.
+        template<typename T>
+        concept foldable = std::is_same_v<T, bool> || character<T> || number<T> || is_ct_string<T>::value;
+
+        template<auto V>
+        constexpr size_t constant_length() {
+            using T = std::remove_cvref_t<decltype(V)>;
+            if constexpr (is_ct_string<T>::value) return V.size;
+            else if constexpr (std::is_same_v<T, bool> || character<T>) return 1;
+            else return integer_length(V);
+        }
+
+        template<auto V>
+        constexpr std::array<char, constant_length<V>()> constant_chars() {
+            using T = std::remove_cvref_t<decltype(V)>;
+            std::array<char, constant_length<V>()> out{};
+            if constexpr (is_ct_string<T>::value) {
+                for (size_t i = 0; i < V.size; ++i) out[i] = V.data[i];
+            } else if constexpr (std::is_same_v<T, bool>) {
+                out[0] = V ? '1' : '0';
+            } else if constexpr (character<T>) {
+                out[0] = static_cast<char>(V);
+            } else {
+                if (V < 0) out[0] = '-';
+                write_digits(out.data() + out.size(), magnitude(V));
+            }
+            return out;
+        }
+
+        template<auto V>
+        inline constexpr auto constant_storage = constant_chars<V>();
+
+        template<typename T>
+        struct folded_text {
+            static constexpr bool folded = false;
+            static constexpr std::string_view text{};
+        };
+        template<auto V>
+            requires foldable<std::remove_cvref_t<decltype(V)>>
+        struct folded_text<Constant<V>> {
+            static constexpr bool folded = true;
+            static constexpr std::string_view text{constant_storage<V>.data(), constant_storage<V>.size()};
+        };
+    }
+
+    // A constant that cannot be folded formats like its value
+    template<auto V>
+    void append_value(std::string& out, const Constant<V>&) {
+        using T = std::remove_cvref_t<decltype(V)>;
+        if constexpr (detail::is_ct_string<T>::value) out += V.view();
+        else append_value(out, V);
+    }
+
+    // A "{}" format with its constant arguments already written into the
+    // literal text. What remains is `runtime_count` placeholders, so segment
+    // i is followed by the i-th runtime argument and the last segment ends
+    // the output. The stored text ends with a newline for println, which
+    // segment() leaves out.
+    template<nmac::ct_string Format, typename... Args>
+    class FoldedFormat {
+        static constexpr std::string_view format_view = Format.view();
+        static constexpr std::array<bool, sizeof...(Args)> folded = {detail::folded_text<std::remove_cvref_t<Args>>::folded...};
+        static constexpr std::array<std::string_view, sizeof...(Args)> constants = {
+            detail::folded_text<std::remove_cvref_t<Args>>::text...
+        };
+
+    public:
+        static constexpr size_t runtime_count = (size_t{0} + ... + !detail::folded_text<std::remove_cvref_t<Args>>::folded);
+
+    private:
+        // Walks the format once; `emit` sees every output byte and every
+        // segment boundary, so measuring and filling share one loop.
+        template<typename Char, typename Boundary>
+        static constexpr void walk(Char emit, Boundary boundary) {
+            size_t arg = 0;
+            for (size_t i = 0; i < format_view.size(); ++i) {
+                if (arg < folded.size() && format_view.substr(i, 2) == "{}") {
+                    if (folded[arg]) {
+                        for (char c : constants[arg]) emit(c);
+                    } else {
+                        boundary();
+                    }
+                    ++arg;
+                    ++i;
+                } else {
+                    emit(format_view[i]);
+                }
+            }
+            emit('\n');
+        }
+
+        static constexpr size_t text_size = [] {
+            size_t n = 0;
+            walk([&](char) { ++n; }, [] {});
+            return n;
+        }();
+
+        struct Layout {
+            std::array<char, text_size> text{};
+            std::array<size_t, runtime_count + 1> ends{};
+        };
+
+        static constexpr Layout layout = [] {
+            Layout out;
+            size_t n = 0;
+            size_t segment = 0;
+            walk([&](char c) { out.text[n++] = c; }, [&] { out.ends[segment++] = n; });
+            out.ends[segment] = n - 1;
+            return out;
+        }();
+
+    public:
+        static constexpr std::string_view segment(size_t i) {
+            size_t begin = i == 0 ? 0 : layout.ends[i - 1];
+            return std::string_view(layout.text.data() + begin, layout.ends[i] - begin);
+        }
+
+        // The whole output including the trailing newline; only complete
+        // when every argument was folded.
+        static constexpr std::string_view line() { return std::string_view(layout.text.data(), layout.text.size()); }
+
+        static constexpr size_t literal_bytes() { return text_size - 1; }
+
+        static void append(std::string& out, const Args&... args) {
+            out += segment(0);
+            [[maybe_unused]] size_t next = 0;
+            ([&](const auto& arg) {
+                if constexpr (!detail::folded_text<std::remove_cvref_t<decltype(arg)>>::folded) {
+                    append_value(out, arg);
+                    out += segment(++next);
+                }
+            }(args), ...);
+        }
+    };
+}
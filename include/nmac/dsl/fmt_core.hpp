@@ -1,43 +1,46 @@
 #pragma once
 
+#include "nmac/alloc_stats.hpp"
+#include "nmac/dsl/fmt_append.hpp"
+#include "nmac/trace.hpp"
 #include <string>
 #include <string_view>
-#include <sstream>
 #include <vector>
 #include <utility>
 #include <stdexcept>
 
 namespace nmac::dsl::fmt {
+    // Formats each argument into the next "{}" with append_value, so ranges,
+    // maps and tuples format too and nothing goes through a temporary stream.
     class FormatCore {
     public:
         template<typename... Args>
         static std::string format(std::string_view fmt, Args&&... args) {
-            std::string result(fmt);
+            NMAC_TRACE_SCOPE("format");
+            NMAC_ALLOC_SCOPE(format);
+            std::string result;
+            result.reserve(fmt.size());
             size_t pos = 0;
 
             ([&](const auto& arg) {
-                std::ostringstream ss;
-                ss << arg;
-                std::string arg_str = ss.str();
-
-                size_t placeholder_pos = result.find("{}", pos);
-                if (placeholder_pos != std::string::npos) {
-                    result.replace(placeholder_pos, 2, arg_str);
-                    pos = placeholder_pos + arg_str.length();
-                } else {
+                size_t placeholder_pos = fmt.find("{}", pos);
+                if (placeholder_pos == std::string_view::npos) {
                     throw std::invalid_argument("Too many arguments for format string");
                 }
-            }(std::forward<Args>(args)), ...);
+                result += fmt.substr(pos, placeholder_pos - pos);
+                append_value(result, arg);
+                pos = placeholder_pos + 2;
+            }(args), ...);
 
-            if (result.find("{}", pos) != std::string::npos) {
+            if (fmt.find("{}", pos) != std::string_view::npos) {
                 throw std::invalid_argument("Not enough arguments for format string");
             }
+            result += fmt.substr(pos);
             return result;
         }
 
         // Compile-time validation of format string (requires C++20)
-        template<std::string_view fmt>
-        static constexpr bool validate_format() {
+        static constexpr bool validate_format(std::string_view fmt) {
             size_t open_count = 0;
             bool in_placeholder = false;
 
@@ -1,56 +1,122 @@
 #pragma once
 
+#include "nmac/alloc_stats.hpp"
+#include "nmac/dsl/fmt_append.hpp"
+#include "nmac/dsl/println_sink.hpp"
+#include "nmac/trace.hpp"
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
 #include <string>
-#include <sstream>
+#include <string_view>
 #include <vector>
 #include <iostream>
 
 namespace nmac::dsl {
 
-    // Simple formatter for string interpolation
-    class FormatString {
-    public:
-        // Format a string with variadic arguments
-        template<typename... Args>
-        static std::string format(const std::string& fmt, Args&&... args) {
-            std::string result = fmt;
+    // A format string split at its "{}" placeholders: literal i is followed
+    // by placeholder i, and the last literal ends the string.
+    struct ParsedFormat {
+        std::string text;
+        std::vector<size_t> bounds;  // Literal i is text[bounds[2i], bounds[2i+1])
 
-            // Call helper with each argument
-            format_helper(result, 0, std::forward<Args>(args)...);
-
-            return result;
+        explicit ParsedFormat(std::string_view fmt) : text(fmt) {
+            size_t start = 0;
+            size_t placeholder;
+            while ((placeholder = text.find("{}", start)) != std::string::npos) {
+                bounds.push_back(start);
+                bounds.push_back(placeholder);
+                start = placeholder + 2;
+            }
+            bounds.push_back(start);
+            bounds.push_back(text.size());
         }
 
-        // Print formatted string to stdout
-        template<typename... Args>
-        static void println(const std::string& fmt, Args&&... args) {
-            std::cout << format(fmt, std::forward<Args>(args)...) << std::endl;
+        size_t placeholders() const { return bounds.size() / 2 - 1; }
+
+        std::string_view literal(size_t i) const {
+            return std::string_view(text).substr(bounds[2 * i], bounds[2 * i + 1] - bounds[2 * i]);
         }
 
+        size_t literal_bytes() const { return text.size() - 2 * placeholders(); }
+    };
+
+    // Per-thread cache of parsed runtime format strings. Slots are picked by
+    // hash and verified against the stored text, so a hit never returns the
+    // wrong format; a colliding format simply replaces the slot. Callers hold
+    // a shared reference, so a replacement made while they still use the old
+    // format (say, by a nested format() in some operator<<) does not free it.
+    class FormatCache {
+    public:
+        static constexpr size_t slot_count = 64;
+
     private:
-        // Base case for recursion
-        static void format_helper(std::string& /*result*/, size_t /*pos*/) {
-            // Nothing to do when there are no more arguments
+
+        struct Slot {
+            size_t hash = 0;
+            std::shared_ptr<const ParsedFormat> parsed;
+        };
+        std::array<Slot, slot_count> slots;
+
+    public:
+        static FormatCache& local() {
+            thread_local FormatCache cache;
+            return cache;
+        }
+
+        std::shared_ptr<const ParsedFormat> get(std::string_view fmt) {
+            size_t hash = std::hash<std::string_view>{}(fmt);
+            Slot& slot = slots[hash % slot_count];
+            if (!slot.parsed || slot.hash != hash || slot.parsed->text != fmt) {
+                slot.parsed = std::make_shared<const ParsedFormat>(fmt);
+                slot.hash = hash;
+            }
+            return slot.parsed;
         }
+    };
+
+    // Simple formatter for string interpolation. Each "{}" takes the next
+    // argument; extra arguments are ignored and missing ones leave "{}".
+    class FormatString {
+    public:
+        // Format a string with variadic arguments
+        template<typename... Args>
+        static std::string format(std::string_view fmt, Args&&... args) {
+            NMAC_TRACE_SCOPE("format");
+            NMAC_ALLOC_SCOPE(format);
+            std::shared_ptr<const ParsedFormat> held = FormatCache::local().get(fmt);
+            const ParsedFormat& parsed = *held;
+
+            std::string result;
+            result.reserve(parsed.literal_bytes() + 16 * parsed.placeholders());
 
-        // Replace the next placeholder with the first argument
-        template<typename T, typename... Rest>
-        static void format_helper(std::string& result, size_t pos, T&& arg, Rest&&... rest) {
-            // Convert argument to string
-            std::ostringstream ss;
-            ss << arg;
-            std::string arg_str = ss.str();
-
-            // Find and replace next placeholder
-            size_t placeholder_pos = result.find("{}", pos);
-            if (placeholder_pos != std::string::npos) {
-                result.replace(placeholder_pos, 2, arg_str);
-                pos = placeholder_pos + arg_str.length();
+            // Each argument with a placeholder is appended straight after its literal
+            size_t used = std::min(sizeof...(Args), parsed.placeholders());
+            size_t next = 0;
+            ([&](const auto& arg) {
+                if (next >= used) return;
+                result += parsed.literal(next++);
+                using fmt::append_value; // Leaves room for overloads found by ADL, such as Value's
+                append_value(result, arg);
+            }(args), ...);
+            for (size_t i = used; i < parsed.placeholders(); ++i) {
+                result += parsed.literal(i);
+                result += "{}";
             }
+            result += parsed.literal(parsed.placeholders());
+            return result;
+        }
 
-            // Process remaining arguments
-            format_helper(result, pos, std::forward<Rest>(rest)...);
+        // Print formatted string to the println sink (stdout by default)
+        template<typename... Args>
+        static void println(std::string_view fmt, Args&&... args) {
+            NMAC_TRACE_SCOPE("print");
+            NMAC_ALLOC_SCOPE(format);
+            std::string line = format(fmt, std::forward<Args>(args)...);
+            line += '\n';
+            println_sink().write(line);
         }
     };
 
-} // namespace nmac::dsl
\ No newline at end of file
+} // namespace nmac::dsl
@@ -47,13 +47,13 @@ namespace nmac::dsl {
 
     // Simple function to directly format and print
     template<typename... Args>
-    void println(const std::string& format, Args&&... args) {
+    void println(std::string_view format, Args&&... args) {
         FormatString::println(format, std::forward<Args>(args)...);
     }
 
     // Simple function to format without printing
     template<typename... Args>
-    std::string format(const std::string& format, Args&&... args) {
+    std::string format(std::string_view format, Args&&... args) {
         return FormatString::format(format, std::forward<Args>(args)...);
     }
 
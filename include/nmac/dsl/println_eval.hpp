@@ -1,6 +1,13 @@
 #pragma once
 
 #include "nmac/nmac.hpp"
+#include "nmac/dsl/fmt_append.hpp"
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <limits>
+#include <optional>
+#include <span>
 #include <iostream>
 #include <string>
 #include <string_view>
@@ -40,8 +47,9 @@ struct ExprToken {
     ExprToken(TokenType t, std::string v) : type(t), value(std::move(v)) {}
 };
 
-// Value type for evaluated expressions
-using Value = std::variant<
+// Value type for evaluated expressions. A struct rather than an alias so that
+// arrays can hold Values; it is still visited like the variant it derives from.
+struct Value : std::variant<
     std::nullptr_t,       // null
     bool,                 // boolean
     int,                  // integer
@@ -49,23 +57,302 @@ using Value = std::variant<
     std::string,          // string
     std::vector<Value>    // array/list
     // Could add more types as needed
->;
+> {
+    using variant::variant;
+    using variant::operator=;
+};
+
+// Append the text of a Value to `out`. Numbers read as std::to_string would
+// write them; arrays are written element by element into the same string.
+// Found by argument-dependent lookup, so Values also format through
+// fmt::append_value, FormatCore and FormatString, including inside containers.
+inline void append_value(std::string& out, const Value& value) {
+    std::visit([&](const auto& arg) {
+        using T = std::decay_t<decltype(arg)>;
+        if constexpr (std::is_same_v<T, std::nullptr_t>) {
+            out += "null";
+        } else if constexpr (std::is_same_v<T, bool>) {
+            out += arg ? "true" : "false";
+        } else if constexpr (std::is_same_v<T, int>) {
+            fmt::append_integer(out, arg);
+        } else if constexpr (std::is_same_v<T, double>) {
+            char buffer[512]; // Enough for DBL_MAX in fixed notation
+            auto result = std::to_chars(buffer, buffer + sizeof buffer, arg, std::chars_format::fixed, 6);
+            out.append(buffer, result.ptr);
+        } else if constexpr (std::is_same_v<T, std::string>) {
+            out += arg;
+        } else {
+            out += '[';
+            for (size_t i = 0; i < arg.size(); ++i) {
+                if (i > 0) out += ", ";
+                append_value(out, arg[i]);
+            }
+            out += ']';
+        }
+    }, value);
+}
+
+// Convert a Value to a string
+inline std::string value_to_string(const Value& value) {
+    std::string out;
+    append_value(out, value);
+    return out;
+}
+
 
-// Type representing a captured expression
+// Node of a parsed expression. Operands are indices into the owning
+// Expression's node list.
+struct ExprNode {
+    enum class Kind {
+        LITERAL,     // literal
+        VARIABLE,    // name
+        UNARY,       // name is the operator; one operand
+        BINARY,      // name is the operator; two operands
+        AND,         // a && b, b only evaluated when a is true
+        OR,          // a || b, b only evaluated when a is false
+        CONDITIONAL, // c ? a : b, only the chosen branch is evaluated
+        SUM,         // a + b + c ..., see ExpressionEvaluator::sum
+        CALL         // name(operands...)
+    };
+
+    Kind kind;
+    std::string name;
+    Value literal;
+    std::vector<size_t> operands;
+};
+
+// Type representing a captured expression. The text is tokenized and parsed
+// once, on construction; a syntax error throws std::runtime_error. The
+// grammar, from lowest to highest precedence:
+//   c ? a : b    ||    &&    == !=    < <= > >=    + -    * / %    ! -(unary)
+// plus parentheses, calls f(a, b), identifiers, numbers, "strings",
+// true, false and null.
 class Expression {
 private:
     std::string expr_string;
     std::vector<ExprToken> tokens;
+    std::vector<ExprNode> node_list;
+    size_t root_node = 0;
+    size_t next = 0; // Parser position in tokens
+
+    [[noreturn]] void syntax_error(const std::string& what) const {
+        throw std::runtime_error("Syntax error in expression '" + expr_string + "': " + what);
+    }
+
+    void tokenize() {
+        std::string_view text = expr_string;
+        size_t i = 0;
+        auto is_ident = [](char c, bool first) {
+            return c == '_' || std::isalpha(static_cast<unsigned char>(c)) ||
+                   (!first && std::isdigit(static_cast<unsigned char>(c)));
+        };
+        while (i < text.size()) {
+            char c = text[i];
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                ++i;
+            } else if (is_ident(c, true)) {
+                size_t start = i;
+                while (i < text.size() && is_ident(text[i], false)) ++i;
+                tokens.emplace_back(TokenType::IDENTIFIER, std::string(text.substr(start, i - start)));
+            } else if (std::isdigit(static_cast<unsigned char>(c)) ||
+                       (c == '.' && i + 1 < text.size() && std::isdigit(static_cast<unsigned char>(text[i + 1])))) {
+                size_t start = i;
+                while (i < text.size() && (std::isalnum(static_cast<unsigned char>(text[i])) || text[i] == '.' ||
+                                           ((text[i] == '+' || text[i] == '-') && (text[i - 1] == 'e' || text[i - 1] == 'E')))) {
+                    ++i;
+                }
+                tokens.emplace_back(TokenType::NUMBER_LITERAL, std::string(text.substr(start, i - start)));
+            } else if (c == '"') {
+                std::string value;
+                for (++i; i < text.size() && text[i] != '"'; ++i) {
+                    if (text[i] == '\\' && i + 1 < text.size()) {
+                        char e = text[++i];
+                        value += e == 'n' ? '\n' : e == 't' ? '\t' : e;
+                    } else {
+                        value += text[i];
+                    }
+                }
+                if (i == text.size()) syntax_error("unterminated string");
+                ++i;
+                tokens.emplace_back(TokenType::STRING_LITERAL, std::move(value));
+            } else if (c == '(') {
+                tokens.emplace_back(TokenType::OPEN_PAREN, "(");
+                ++i;
+            } else if (c == ')') {
+                tokens.emplace_back(TokenType::CLOSE_PAREN, ")");
+                ++i;
+            } else if (c == ',') {
+                tokens.emplace_back(TokenType::COMMA, ",");
+                ++i;
+            } else if (c == '.') {
+                tokens.emplace_back(TokenType::DOT, ".");
+                ++i;
+            } else {
+                std::string_view two = text.substr(i, 2);
+                if (two == "&&" || two == "||" || two == "==" || two == "!=" || two == "<=" || two == ">=") {
+                    tokens.emplace_back(TokenType::OPERATOR, std::string(two));
+                    i += 2;
+                } else if (std::string_view("+-*/%<>!?:").find(c) != std::string_view::npos) {
+                    tokens.emplace_back(TokenType::OPERATOR, std::string(1, c));
+                    ++i;
+                } else {
+                    syntax_error(std::string("unexpected character '") + c + "'");
+                }
+            }
+        }
+    }
+
+    size_t add(ExprNode node) {
+        node_list.push_back(std::move(node));
+        return node_list.size() - 1;
+    }
+
+    bool at_operator(std::string_view op) const {
+        return next < tokens.size() && tokens[next].type == TokenType::OPERATOR && tokens[next].value == op;
+    }
+
+    // Left binding power of a binary operator; 0 if `op` is not one
+    static int binding_power(std::string_view op) {
+        if (op == "?") return 1;
+        if (op == "||") return 2;
+        if (op == "&&") return 3;
+        if (op == "==" || op == "!=") return 4;
+        if (op == "<" || op == "<=" || op == ">" || op == ">=") return 5;
+        if (op == "+" || op == "-") return 6;
+        if (op == "*" || op == "/" || op == "%") return 7;
+        return 0;
+    }
+
+    size_t parse_number(const std::string& text) {
+        const char* first = text.data();
+        const char* last = first + text.size();
+        if (text.find_first_of(".eE") == std::string::npos) {
+            int i = 0;
+            auto result = std::from_chars(first, last, i);
+            if (result.ec == std::errc{} && result.ptr == last) return add({ExprNode::Kind::LITERAL, {}, Value{i}, {}});
+        }
+        double d = 0;
+        auto result = std::from_chars(first, last, d);
+        if (result.ec != std::errc{} || result.ptr != last) syntax_error("invalid number '" + text + "'");
+        return add({ExprNode::Kind::LITERAL, {}, Value{d}, {}});
+    }
+
+    size_t parse_prefix() {
+        if (next == tokens.size()) syntax_error("unexpected end");
+        const ExprToken& token = tokens[next++];
+        switch (token.type) {
+            case TokenType::NUMBER_LITERAL:
+                return parse_number(token.value);
+            case TokenType::STRING_LITERAL:
+                return add({ExprNode::Kind::LITERAL, {}, Value{token.value}, {}});
+            case TokenType::OPEN_PAREN: {
+                size_t inner = parse(0);
+                if (next == tokens.size() || tokens[next].type != TokenType::CLOSE_PAREN) syntax_error("expected ')'");
+                ++next;
+                return inner;
+            }
+            case TokenType::OPERATOR:
+                if (token.value == "!" || token.value == "-") {
+                    size_t operand = parse(8);
+                    return add({ExprNode::Kind::UNARY, token.value, {}, {operand}});
+                }
+                break;
+            case TokenType::IDENTIFIER: {
+                if (token.value == "true") return add({ExprNode::Kind::LITERAL, {}, Value{true}, {}});
+                if (token.value == "false") return add({ExprNode::Kind::LITERAL, {}, Value{false}, {}});
+                if (token.value == "null") return add({ExprNode::Kind::LITERAL, {}, Value{nullptr}, {}});
+                if (next < tokens.size() && tokens[next].type == TokenType::OPEN_PAREN) {
+                    ++next;
+                    ExprNode call{ExprNode::Kind::CALL, token.value, {}, {}};
+                    if (next < tokens.size() && tokens[next].type == TokenType::CLOSE_PAREN) {
+                        ++next;
+                        return add(std::move(call));
+                    }
+                    for (;;) {
+                        call.operands.push_back(parse(0));
+                        if (next == tokens.size()) syntax_error("unterminated call to " + token.value);
+                        if (tokens[next].type == TokenType::CLOSE_PAREN) break;
+                        if (tokens[next].type != TokenType::COMMA) syntax_error("expected ',' or ')'");
+                        ++next;
+                    }
+                    ++next;
+                    return add(std::move(call));
+                }
+                return add({ExprNode::Kind::VARIABLE, token.value, {}, {}});
+            }
+            default:
+                break;
+        }
+        syntax_error("unexpected '" + token.value + "'");
+    }
+
+    // Pratt parser: parses operators that bind tighter than `min_power`
+    size_t parse(int min_power) {
+        size_t left = parse_prefix();
+        while (next < tokens.size() && tokens[next].type == TokenType::OPERATOR) {
+            const std::string& op = tokens[next].value;
+            int power = binding_power(op);
+            if (power == 0 || power <= min_power) break;
+            ++next;
+            if (op == "?") {
+                size_t then = parse(0);
+                if (!at_operator(":")) syntax_error("expected ':'");
+                ++next;
+                size_t otherwise = parse(power - 1); // Right associative
+                left = add({ExprNode::Kind::CONDITIONAL, {}, {}, {left, then, otherwise}});
+                continue;
+            }
+            size_t right = parse(power);
+            if (op == "+") {
+                // A left-nested chain of + becomes one node with every operand
+                if (node_list[left].kind == ExprNode::Kind::SUM) {
+                    node_list[left].operands.push_back(right);
+                } else {
+                    left = add({ExprNode::Kind::SUM, op, {}, {left, right}});
+                }
+                continue;
+            }
+            ExprNode::Kind kind = op == "&&" ? ExprNode::Kind::AND
+                                : op == "||" ? ExprNode::Kind::OR
+                                             : ExprNode::Kind::BINARY;
+            left = add({kind, op, {}, {left, right}});
+        }
+        return left;
+    }
 
 public:
     explicit Expression(std::string expr) : expr_string(std::move(expr)) {
-        // Basic tokenization of the expression would happen here
-        // This is a simplified example
-        tokens.emplace_back(TokenType::IDENTIFIER, expr_string);
+        tokenize();
+        if (tokens.empty()) {
+            root_node = add({ExprNode::Kind::LITERAL, {}, Value{nullptr}, {}});
+            return;
+        }
+        root_node = parse(0);
+        if (next != tokens.size()) syntax_error("unexpected '" + tokens[next].value + "'");
     }
 
     const std::string& get_string() const { return expr_string; }
     const std::vector<ExprToken>& get_tokens() const { return tokens; }
+    const std::vector<ExprNode>& nodes() const { return node_list; }
+    size_t root() const { return root_node; }
+};
+
+class EvaluationContext;
+
+// An unevaluated function argument, handed to functions registered with
+// register_lazy_function. Calling it evaluates the argument the first time
+// and returns the cached result after that.
+class LazyArg {
+    const Expression* expr;
+    size_t node;
+    const EvaluationContext* context;
+    mutable std::optional<Value> cached;
+
+public:
+    LazyArg(const Expression& e, size_t n, const EvaluationContext& c) : expr(&e), node(n), context(&c) {}
+
+    const Value& operator()() const;
+    bool evaluated() const { return cached.has_value(); }
 };
 
 // Evaluation context that holds variables and functions
@@ -73,6 +360,7 @@ class EvaluationContext {
 private:
     std::unordered_map<std::string, Value> variables;
     std::unordered_map<std::string, std::function<Value(std::vector<Value>)>> functions;
+    std::unordered_map<std::string, std::function<Value(std::span<const LazyArg>)>> lazy_functions;
 
 public:
     // Set a variable value
@@ -80,6 +368,12 @@ public:
         variables[name] = std::move(value);
     }
 
+    // The stored variable, without copying it; nullptr if unset
+    const Value* find_variable(const std::string& name) const {
+        auto it = variables.find(name);
+        return it != variables.end() ? &it->second : nullptr;
+    }
+
     // Get a variable value
     Value get_variable(const std::string& name) const {
         auto it = variables.find(name);
@@ -113,6 +407,15 @@ public:
         functions[name] = std::forward<F>(func);
     }
 
+    // Register a function that receives its arguments unevaluated, as
+    // LazyArgs, and evaluates only the ones it needs
+    template<typename F>
+    void register_lazy_function(const std::string& name, F&& func) {
+        lazy_functions[name] = std::forward<F>(func);
+    }
+
+    bool is_lazy_function(const std::string& name) const { return lazy_functions.contains(name); }
+
     // Call a function
     Value call_function(const std::string& name, std::vector<Value> args) const {
         auto it = functions.find(name);
@@ -121,57 +424,262 @@ public:
         }
         throw std::runtime_error("Function not found: " + name);
     }
+
+    Value call_lazy_function(const std::string& name, std::span<const LazyArg> args) const {
+        auto it = lazy_functions.find(name);
+        if (it != lazy_functions.end()) {
+            return it->second(args);
+        }
+        throw std::runtime_error("Function not found: " + name);
+    }
 };
 
 // Expression evaluator
 class ExpressionEvaluator {
-public:
-    // Evaluate an expression in a context
-    static Value evaluate(const Expression& expr, const EvaluationContext& context) {
-        // This is a simplified implementation
-        // In a real system, you would parse and evaluate the expression tokens
+    using Kind = ExprNode::Kind;
 
-        const auto& tokens = expr.get_tokens();
-        if (tokens.empty()) {
-            return nullptr;
+    static bool is_number(const Value& v) { return v.index() == 2 || v.index() == 3; }
+
+    static double as_double(const Value& v) {
+        return v.index() == 2 ? static_cast<double>(std::get<int>(v)) : std::get<double>(v);
+    }
+
+    static Value from_wide(int64_t v) {
+        if (v >= std::numeric_limits<int>::min() && v <= std::numeric_limits<int>::max()) {
+            return Value{static_cast<int>(v)};
         }
+        return Value{static_cast<double>(v)};
+    }
+
+    static bool equal(const Value& a, const Value& b) {
+        if (is_number(a) && is_number(b)) return as_double(a) == as_double(b);
+        if (a.index() != b.index()) return false;
+        return std::visit([&](const auto& x) -> bool {
+            using T = std::decay_t<decltype(x)>;
+            const T& y = std::get<T>(b);
+            if constexpr (std::is_same_v<T, std::vector<Value>>) {
+                if (x.size() != y.size()) return false;
+                for (size_t i = 0; i < x.size(); ++i) {
+                    if (!equal(x[i], y[i])) return false;
+                }
+                return true;
+            } else {
+                return x == y;
+            }
+        }, a);
+    }
 
-        // If it's just an identifier, look it up in the context
-        if (tokens.size() == 1 && tokens[0].type == TokenType::IDENTIFIER) {
-            return context.get_variable(tokens[0].value);
+    static Value binary(const std::string& op, const Value& a, const Value& b) {
+        if (op == "==") return Value{equal(a, b)};
+        if (op == "!=") return Value{!equal(a, b)};
+        if (op == "<" || op == "<=" || op == ">" || op == ">=") {
+            int order;
+            if (is_number(a) && is_number(b)) {
+                double x = as_double(a), y = as_double(b);
+                order = x < y ? -1 : x > y ? 1 : 0;
+            } else if (a.index() == 4 && b.index() == 4) {
+                int c = std::get<std::string>(a).compare(std::get<std::string>(b));
+                order = c < 0 ? -1 : c > 0 ? 1 : 0;
+            } else {
+                throw std::runtime_error("Cannot compare these values with " + op);
+            }
+            return Value{op == "<" ? order < 0 : op == "<=" ? order <= 0 : op == ">" ? order > 0 : order >= 0};
         }
+        if (!is_number(a) || !is_number(b)) throw std::runtime_error("Operator " + op + " needs numbers");
 
-        // For more complex expressions, you would implement a proper parser and evaluator
-        // This is just a placeholder
-        throw std::runtime_error("Complex expression evaluation not implemented");
+        if (a.index() == 2 && b.index() == 2) {
+            int64_t x = std::get<int>(a), y = std::get<int>(b);
+            if ((op == "/" || op == "%") && y == 0) throw std::runtime_error("Division by zero");
+            switch (op[0]) {
+                case '+': return from_wide(x + y);
+                case '-': return from_wide(x - y);
+                case '*': return from_wide(x * y);
+                case '/': return from_wide(x / y);
+                case '%': return from_wide(x % y);
+            }
+        }
+        double x = as_double(a), y = as_double(b);
+        switch (op[0]) {
+            case '+': return Value{x + y};
+            case '-': return Value{x - y};
+            case '*': return Value{x * y};
+            case '/': return Value{x / y};
+            case '%': return Value{std::fmod(x, y)};
+        }
+        throw std::runtime_error("Unknown operator " + op);
     }
-};
 
-// Convert a Value to a string
-inline std::string value_to_string(const Value& value) {
-    return std::visit([](auto&& arg) -> std::string {
-        using T = std::decay_t<decltype(arg)>;
-        if constexpr (std::is_same_v<T, std::nullptr_t>) {
-            return "null";
-        } else if constexpr (std::is_same_v<T, bool>) {
-            return arg ? "true" : "false";
-        } else if constexpr (std::is_same_v<T, int> || std::is_same_v<T, double>) {
-            return std::to_string(arg);
-        } else if constexpr (std::is_same_v<T, std::string>) {
-            return arg;
-        } else if constexpr (std::is_same_v<T, std::vector<Value>>) {
-            std::ostringstream ss;
-            ss << "[";
-            for (size_t i = 0; i < arg.size(); ++i) {
-                if (i > 0) ss << ", ";
-                ss << value_to_string(arg[i]);
+    // A chain a + b + c ... keeps the meaning of evaluating it pair by pair
+    // from the left: numbers add until the first string, and from there on
+    // everything is concatenated. Rather than building a new string at each
+    // step, which is quadratic in the chain length, all operands are
+    // gathered first and the concatenation is written once into a string
+    // reserved for the whole result.
+    struct SumOperands {
+        std::vector<const Value*> values;
+        std::vector<Value> owned; // Reserved for every operand, so `values` never dangles
+    };
+
+    // Literals and variables are referenced where they live, so string
+    // operands are not copied; only the other operands are evaluated
+    static SumOperands sum_operands(const Expression& expr, const ExprNode& node,
+                                    const EvaluationContext& context) {
+        SumOperands operands;
+        operands.values.reserve(node.operands.size());
+        operands.owned.reserve(node.operands.size());
+        for (size_t operand : node.operands) {
+            const ExprNode& child = expr.nodes()[operand];
+            const Value* value = nullptr;
+            if (child.kind == Kind::LITERAL) value = &child.literal;
+            else if (child.kind == Kind::VARIABLE) value = context.find_variable(child.name);
+            if (!value) value = &operands.owned.emplace_back(evaluate_node(expr, operand, context));
+            operands.values.push_back(value);
+        }
+        return operands;
+    }
+
+    // Index of the first string operand, or operands.size() if none
+    static size_t concat_start(const std::vector<const Value*>& operands) {
+        size_t i = 0;
+        while (i < operands.size() && operands[i]->index() != 4) ++i;
+        return i;
+    }
+
+    // Everything before the first string must be a number, however many
+    // operands that is, just as a pair of them would be checked by binary()
+    static Value add_numbers(const std::vector<const Value*>& operands, size_t end) {
+        for (size_t i = 0; i < end; ++i) {
+            if (!is_number(*operands[i])) throw std::runtime_error("Operator + needs numbers");
+        }
+        Value total = *operands[0];
+        for (size_t i = 1; i < end; ++i) total = binary("+", total, *operands[i]);
+        return total;
+    }
+
+    static void concat(std::string& out, const std::vector<const Value*>& operands, size_t start) {
+        size_t bytes = start ? 16 : 0;
+        for (size_t i = start; i < operands.size(); ++i) {
+            bytes += operands[i]->index() == 4 ? std::get<std::string>(*operands[i]).size() : 16;
+        }
+        out.reserve(out.size() + bytes);
+        if (start) append_value(out, add_numbers(operands, start));
+        for (size_t i = start; i < operands.size(); ++i) append_value(out, *operands[i]);
+    }
+
+    static Value sum(const Expression& expr, const ExprNode& node, const EvaluationContext& context) {
+        SumOperands operands = sum_operands(expr, node, context);
+        size_t start = concat_start(operands.values);
+        if (start == operands.values.size()) return add_numbers(operands.values, start);
+        std::string out;
+        concat(out, operands.values, start);
+        return Value{std::move(out)};
+    }
+
+    static Value call(const Expression& expr, const ExprNode& node, const EvaluationContext& context) {
+        if (context.is_lazy_function(node.name)) {
+            std::vector<LazyArg> args;
+            args.reserve(node.operands.size());
+            for (size_t operand : node.operands) args.emplace_back(expr, operand, context);
+            return context.call_lazy_function(node.name, args);
+        }
+        std::vector<Value> args;
+        args.reserve(node.operands.size());
+        for (size_t operand : node.operands) args.push_back(evaluate_node(expr, operand, context));
+        return context.call_function(node.name, std::move(args));
+    }
+
+public:
+    // Truthiness used by !, &&, || and ?: - null, false, 0, "" and [] are false
+    static bool truthy(const Value& value) {
+        return std::visit([](const auto& v) -> bool {
+            using T = std::decay_t<decltype(v)>;
+            if constexpr (std::is_same_v<T, std::nullptr_t>) return false;
+            else if constexpr (std::is_same_v<T, bool> || std::is_same_v<T, int> || std::is_same_v<T, double>) return v != 0;
+            else return !v.empty();
+        }, value);
+    }
+
+    static Value evaluate_node(const Expression& expr, size_t index, const EvaluationContext& context) {
+        const ExprNode& node = expr.nodes()[index];
+        switch (node.kind) {
+            case Kind::LITERAL:
+                return node.literal;
+            case Kind::VARIABLE:
+                return context.get_variable(node.name);
+            case Kind::UNARY: {
+                Value operand = evaluate_node(expr, node.operands[0], context);
+                if (node.name == "!") return Value{!truthy(operand)};
+                if (operand.index() == 2) return from_wide(-static_cast<int64_t>(std::get<int>(operand)));
+                if (operand.index() == 3) return Value{-std::get<double>(operand)};
+                throw std::runtime_error("Unary - needs a number");
             }
-            ss << "]";
-            return ss.str();
-        } else {
-            return "<unknown>";
+            case Kind::AND:
+                return Value{truthy(evaluate_node(expr, node.operands[0], context)) &&
+                             truthy(evaluate_node(expr, node.operands[1], context))};
+            case Kind::OR:
+                return Value{truthy(evaluate_node(expr, node.operands[0], context)) ||
+                             truthy(evaluate_node(expr, node.operands[1], context))};
+            case Kind::CONDITIONAL:
+                return evaluate_node(expr, node.operands[truthy(evaluate_node(expr, node.operands[0], context)) ? 1 : 2],
+                                     context);
+            case Kind::BINARY:
+                return binary(node.name, evaluate_node(expr, node.operands[0], context),
+                              evaluate_node(expr, node.operands[1], context));
+            case Kind::SUM:
+                return sum(expr, node, context);
+            case Kind::CALL:
+                return call(expr, node, context);
         }
-    }, value);
+        throw std::logic_error("Unknown expression node");
+    }
+
+    // Evaluate an expression in a context
+    static Value evaluate(const Expression& expr, const EvaluationContext& context) {
+        return evaluate_node(expr, expr.root(), context);
+    }
+
+    // Evaluates an expression and appends its text to `out`. Variables are
+    // written from the context without being copied, a conditional writes
+    // only its chosen branch, and a concatenation is written straight into
+    // `out` instead of being joined first.
+    static void append(std::string& out, const Expression& expr, const EvaluationContext& context) {
+        append_node(out, expr, expr.root(), context);
+    }
+
+private:
+    static void append_node(std::string& out, const Expression& expr, size_t index, const EvaluationContext& context) {
+        const ExprNode& node = expr.nodes()[index];
+        switch (node.kind) {
+            case Kind::LITERAL:
+                append_value(out, node.literal);
+                return;
+            case Kind::VARIABLE:
+                if (const Value* value = context.find_variable(node.name)) {
+                    append_value(out, *value);
+                    return;
+                }
+                break;
+            case Kind::CONDITIONAL:
+                append_node(out, expr, node.operands[truthy(evaluate_node(expr, node.operands[0], context)) ? 1 : 2],
+                            context);
+                return;
+            case Kind::SUM: {
+                SumOperands operands = sum_operands(expr, node, context);
+                size_t start = concat_start(operands.values);
+                if (start == operands.values.size()) append_value(out, add_numbers(operands.values, start));
+                else concat(out, operands.values, start);
+                return;
+            }
+            default:
+                break;
+        }
+        append_value(out, evaluate_node(expr, index, context));
+    }
+};
+
+inline const Value& LazyArg::operator()() const {
+    if (!cached) cached = ExpressionEvaluator::evaluate_node(*expr, node, *context);
+    return *cached;
 }
 
 } // namespace nmac::dsl
\ No newline at end of file
@@ -2,15 +2,31 @@
 
 #include "nmac/nmac.hpp"
 #include "nmac/dsl/fmt_core.hpp"
+#include "nmac/dsl/fmt_constant.hpp"
+#include "nmac/dsl/println_sink.hpp"
 #include <iostream>
 
 namespace nmac::dsl::literals {
 
-    // Format string literal
+    // Format string literal. Arguments passed as fmt::constant<V> are
+    // formatted during compilation.
     template<nmac::ct_string Format>
     class FormatLiteral {
         static constexpr auto format_view = Format.view();
 
+        template<typename... Args>
+        using Folded = fmt::FoldedFormat<Format, std::remove_cvref_t<Args>...>;
+
+        template<typename... Args>
+        static std::string format_folded(const Args&... args) {
+            NMAC_TRACE_SCOPE("format");
+            NMAC_ALLOC_SCOPE(format);
+            std::string result;
+            result.reserve(Folded<Args...>::literal_bytes() + 16 * Folded<Args...>::runtime_count);
+            Folded<Args...>::append(result, args...);
+            return result;
+        }
+
     public:
         // Call operator with variadic arguments
         template<typename... Args>
@@ -27,8 +43,16 @@ namespace nmac::dsl::literals {
             // Return a callable that does the actual formatting
             return [... args = std::forward<Args>(args)]() {
                 try {
-                    std::string result = fmt::FormatCore::format(format_view, args...);
-                    std::cout << result << std::endl;
+                    NMAC_TRACE_SCOPE("print");
+                    using Line = Folded<Args...>;
+                    if constexpr (Line::runtime_count == 0) {
+                        // Everything was formatted at compile time
+                        println_sink().write(Line::line());
+                    } else {
+                        std::string result = format_folded(args...);
+                        result += '\n';
+                        println_sink().write(result);
+                    }
                 } catch (const std::exception& e) {
                     std::cerr << "Format error: " << e.what() << std::endl;
                 }
@@ -47,7 +71,7 @@ namespace nmac::dsl::literals {
                              "Number of format placeholders must match number of arguments");
             }
 
-            return fmt::FormatCore::format(format_view, std::forward<Args>(args)...);
+            return format_folded(args...);
         }
     };
 
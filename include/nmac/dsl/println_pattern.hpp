@@ -1,6 +1,7 @@
 #pragma once
 #include "nmac/nmac.hpp"
 #include "nmac/dsl/println_eval.hpp"
+#include "nmac/dsl/println_sink.hpp"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -56,40 +57,37 @@ struct PrintlnGenerator {
             // In a real implementation, you would populate the context
             // with variables and functions from the surrounding scope
 
-            // Evaluate each expression
-            std::vector<std::string> evaluated_args;
-            evaluated_args.reserve(expressions.size());
+            // Evaluate each expression straight into its placeholder
+            std::string result;
+            result.reserve(format.size());
+            size_t pos = 0;
 
             for (const auto& expr : expressions) {
+                size_t placeholder_pos = format.find("{}", pos);
+                if (placeholder_pos == std::string::npos) break;
+                result.append(format, pos, placeholder_pos - pos);
+                pos = placeholder_pos + 2;
+
+                size_t mark = result.size();
                 try {
-                    Value value = ExpressionEvaluator::evaluate(expr, context);
-                    evaluated_args.push_back(value_to_string(value));
+                    ExpressionEvaluator::append(result, expr, context);
                 } catch (const std::exception& e) {
                     std::cerr << "Error evaluating expression '" << expr.get_string()
                               << "': " << e.what() << std::endl;
-                    evaluated_args.emplace_back("<error>");
+                    result.resize(mark);
+                    result += "<error>";
                 }
             }
 
-            // Format the string
-            std::string result = format;
-            size_t pos = 0;
-
-            for (const auto& arg : evaluated_args) {
-                size_t placeholder_pos = result.find("{}", pos);
-                if (placeholder_pos == std::string::npos) break;
-
-                result.replace(placeholder_pos, 2, arg);
-                pos = placeholder_pos + arg.length();
-            }
-
             // Check if any placeholders remain
-            if (result.find("{}", pos) != std::string::npos) {
+            if (format.find("{}", pos) != std::string::npos) {
                 std::cerr << "Warning: Not enough arguments for format string" << std::endl;
             }
+            result.append(format, pos);
 
             // Print the result
-            std::cout << result << std::endl;
+            result += '\n';
+            println_sink().write(result);
         };
     }
 };
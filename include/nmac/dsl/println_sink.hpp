@@ -0,0 +1,75 @@
+#pragma once
+
+#include "nmac/io/mapped_log.hpp"
+#include <atomic>
+#include <iostream>
+#include <ostream>
+#include <string>
+#include <string_view>
+
+namespace nmac::dsl {
+    // Where println output goes. write() receives one complete line, newline
+    // included, and may be called from several threads at once.
+    class PrintlnSink {
+    public:
+        virtual ~PrintlnSink() = default;
+        virtual void write(std::string_view line) = 0;
+        virtual void flush() {}
+    };
+
+    // Writes to a stream and flushes after every line, like std::endl
+    class OstreamSink : public PrintlnSink {
+        std::ostream& out;
+
+    public:
+        explicit OstreamSink(std::ostream& stream) : out(stream) {}
+
+        void write(std::string_view line) override {
+            out.write(line.data(), static_cast<std::streamsize>(line.size()));
+            out.flush();
+        }
+
+        void flush() override { out.flush(); }
+    };
+
+    // Writes into a memory-mapped log (see io::MappedLog). Lines from
+    // concurrent threads never interleave, and writing makes no system calls
+    // except when the log rotates to a new segment.
+    class MappedLogSink : public PrintlnSink {
+        io::MappedLog log;
+
+    public:
+        explicit MappedLogSink(std::string path, size_t segment_size = io::MappedLog::default_segment_bytes,
+                               size_t keep_segments = 0)
+            : log(std::move(path), segment_size, keep_segments) {}
+
+        void write(std::string_view line) override { log.append(line); }
+        void flush() override { log.flush(); }
+
+        io::MappedLog& mapped_log() { return log; }
+    };
+
+    namespace detail {
+        inline OstreamSink stdout_sink{std::cout};
+        inline std::atomic<PrintlnSink*> active_sink{&stdout_sink};
+    }
+
+    inline PrintlnSink& println_sink() { return *detail::active_sink.load(std::memory_order_acquire); }
+
+    // Sends println output to `sink`, or back to stdout for nullptr, and
+    // returns the previous sink. The sink must outlive its installation.
+    inline PrintlnSink* set_println_sink(PrintlnSink* sink) {
+        return detail::active_sink.exchange(sink ? sink : &detail::stdout_sink, std::memory_order_acq_rel);
+    }
+
+    // Installs a sink for the lifetime of the guard
+    class ScopedPrintlnSink {
+        PrintlnSink* previous;
+
+    public:
+        explicit ScopedPrintlnSink(PrintlnSink& sink) : previous(set_println_sink(&sink)) {}
+        ~ScopedPrintlnSink() { set_println_sink(previous); }
+        ScopedPrintlnSink(const ScopedPrintlnSink&) = delete;
+        ScopedPrintlnSink& operator=(const ScopedPrintlnSink&) = delete;
+    };
+}
@@ -2,15 +2,19 @@
 
 #include "nmac/nmac.hpp"
 #include "nmac/dsl/fmt_core.hpp"
+#include "nmac/dsl/fmt_constant.hpp"
+#include "nmac/dsl/println_sink.hpp"
 #include <iostream>
 
 namespace nmac::dsl::templates {
-    // Template-based formatter with compile-time format string
+    // Template-based formatter with compile-time format string. Arguments
+    // passed as fmt::constant<V> are formatted during compilation.
     template<nmac::ct_string Format, typename... Args>
     class FormatTemplate {
         static constexpr auto format_view = Format.view();
         static constexpr size_t arg_count = sizeof...(Args);
         static constexpr size_t placeholder_count = fmt::FormatCore::count_placeholders(format_view);
+        using Folded = fmt::FoldedFormat<Format, std::remove_cvref_t<Args>...>;
 
     public:
         // Validate at compile time that we have the right number of arguments
@@ -20,8 +24,15 @@ namespace nmac::dsl::templates {
         // Print the formatted string
         static void println(Args&&... args) {
             try {
-                std::string result = fmt::FormatCore::format(format_view, std::forward<Args>(args)...);
-                std::cout << result << std::endl;
+                NMAC_TRACE_SCOPE("print");
+                if constexpr (Folded::runtime_count == 0) {
+                    // Everything was formatted at compile time
+                    println_sink().write(Folded::line());
+                } else {
+                    std::string result = format(std::forward<Args>(args)...);
+                    result += '\n';
+                    println_sink().write(result);
+                }
             } catch (const std::exception& e) {
                 std::cerr << "Format error: " << e.what() << std::endl;
             }
@@ -29,7 +40,12 @@ namespace nmac::dsl::templates {
 
         // Format without printing
         static std::string format(Args&&... args) {
-            return fmt::FormatCore::format(format_view, std::forward<Args>(args)...);
+            NMAC_TRACE_SCOPE("format");
+            NMAC_ALLOC_SCOPE(format);
+            std::string result;
+            result.reserve(Folded::literal_bytes() + 16 * Folded::runtime_count);
+            Folded::append(result, args...);
+            return result;
         }
     };
 
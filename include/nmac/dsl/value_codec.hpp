@@ -0,0 +1,500 @@
+#pragma once
+
+#include "nmac/dsl/fmt_append.hpp"
+#include "nmac/dsl/println_eval.hpp"
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// JSON and CBOR (RFC 8949) encodings of dsl::Value. Writers append to a
+// caller's buffer; readers parse one value at a time and can be reused, so
+// their scratch space is allocated once. Unlike value_to_string, both
+// encodings round-trip: strings are quoted and doubles stay doubles.
+namespace nmac::dsl {
+    namespace codec_detail {
+        inline constexpr size_t max_depth = 512;
+
+        constexpr bool needs_escape(unsigned char c) { return c == '"' || c == '\\' || c < 0x20; }
+
+        // Length of the prefix of [p, p + n) that JSON can carry unescaped
+        inline size_t plain_prefix(const char* p, size_t n) {
+            size_t i = 0;
+#if defined(__SSE2__)
+            const __m128i quote = _mm_set1_epi8('"');
+            const __m128i backslash = _mm_set1_epi8('\\');
+            const __m128i control = _mm_set1_epi8(0x1F);
+            for (; i + 16 <= n; i += 16) {
+                __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + i));
+                __m128i special = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+                                               _mm_cmpeq_epi8(_mm_min_epu8(v, control), v)); // v <= 0x1F
+                if (int mask = _mm_movemask_epi8(special)) {
+                    return i + static_cast<size_t>(std::countr_zero(static_cast<unsigned>(mask)));
+                }
+            }
+#endif
+            for (; i < n; ++i) {
+                if (needs_escape(static_cast<unsigned char>(p[i]))) return i;
+            }
+            return n;
+        }
+
+        inline void append_utf8(std::string& out, uint32_t cp) {
+            if (cp < 0x80) {
+                out += static_cast<char>(cp);
+            } else if (cp < 0x800) {
+                out += static_cast<char>(0xC0 | (cp >> 6));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            } else if (cp < 0x10000) {
+                out += static_cast<char>(0xE0 | (cp >> 12));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            } else {
+                out += static_cast<char>(0xF0 | (cp >> 18));
+                out += static_cast<char>(0x80 | ((cp >> 12) & 0x3F));
+                out += static_cast<char>(0x80 | ((cp >> 6) & 0x3F));
+                out += static_cast<char>(0x80 | (cp & 0x3F));
+            }
+        }
+
+        // Builds arrays on one shared stack: elements are pushed as they are
+        // parsed and moved into an exactly sized vector when the array closes,
+        // so nested arrays never grow a vector element by element.
+        class ArrayStack {
+            std::vector<Value> stack;
+
+        public:
+            size_t open() const { return stack.size(); }
+            void push(Value value) { stack.push_back(std::move(value)); }
+
+            Value close(size_t base) {
+                std::vector<Value> items(std::make_move_iterator(stack.begin() + static_cast<ptrdiff_t>(base)),
+                                         std::make_move_iterator(stack.end()));
+                stack.resize(base);
+                return Value{std::move(items)};
+            }
+
+            void clear() { stack.clear(); }
+        };
+    }
+
+    namespace json {
+        inline void write_string(std::string& out, std::string_view text) {
+            static constexpr char hex[] = "0123456789abcdef";
+            out += '"';
+            size_t pos = 0;
+            while (pos < text.size()) {
+                size_t plain = codec_detail::plain_prefix(text.data() + pos, text.size() - pos);
+                out.append(text.data() + pos, plain);
+                pos += plain;
+                if (pos == text.size()) break;
+                auto c = static_cast<unsigned char>(text[pos++]);
+                switch (c) {
+                    case '"': out += "\\\""; break;
+                    case '\\': out += "\\\\"; break;
+                    case '\n': out += "\\n"; break;
+                    case '\r': out += "\\r"; break;
+                    case '\t': out += "\\t"; break;
+                    case '\b': out += "\\b"; break;
+                    case '\f': out += "\\f"; break;
+                    default:
+                        out += "\\u00";
+                        out += hex[c >> 4];
+                        out += hex[c & 0xF];
+                }
+            }
+            out += '"';
+        }
+
+        // Appends `value` as JSON. Doubles always carry a '.' or exponent so
+        // they read back as doubles; NaN and infinity have no JSON form.
+        inline void write(std::string& out, const Value& value, size_t depth = 0) {
+            if (depth > codec_detail::max_depth) throw std::invalid_argument("Value nests too deeply for JSON");
+            std::visit([&](const auto& v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                    out += "null";
+                } else if constexpr (std::is_same_v<T, bool>) {
+                    out += v ? "true" : "false";
+                } else if constexpr (std::is_same_v<T, int>) {
+                    fmt::append_integer(out, v);
+                } else if constexpr (std::is_same_v<T, double>) {
+                    if (!std::isfinite(v)) throw std::invalid_argument("JSON cannot represent NaN or infinity");
+                    char buffer[32];
+                    auto result = std::to_chars(buffer, buffer + sizeof buffer, v);
+                    std::string_view text(buffer, static_cast<size_t>(result.ptr - buffer));
+                    out += text;
+                    if (text.find_first_of(".e") == std::string_view::npos) out += ".0";
+                } else if constexpr (std::is_same_v<T, std::string>) {
+                    write_string(out, v);
+                } else {
+                    out += '[';
+                    for (size_t i = 0; i < v.size(); ++i) {
+                        if (i) out += ',';
+                        write(out, v[i], depth + 1);
+                    }
+                    out += ']';
+                }
+            }, value);
+        }
+
+        inline std::string to_json(const Value& value) {
+            std::string out;
+            write(out, value);
+            return out;
+        }
+
+        // Parses JSON text into Values. Objects are rejected, since Value has
+        // no map type. Integers that do not fit an int are read as doubles.
+        class Reader {
+            codec_detail::ArrayStack arrays;
+            std::string scratch; // Unescaped string contents
+            std::string_view text;
+            size_t pos = 0;
+
+            [[noreturn]] void fail(const char* what) const {
+                throw std::runtime_error(std::string("JSON: ") + what + " at offset " + std::to_string(pos));
+            }
+
+            void skip_space() {
+                while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\n' || text[pos] == '\r' || text[pos] == '\t')) {
+                    ++pos;
+                }
+            }
+
+            void expect_word(std::string_view word) {
+                if (text.substr(pos, word.size()) != word) fail("invalid literal");
+                pos += word.size();
+            }
+
+            unsigned hex4() {
+                if (pos + 4 > text.size()) fail("truncated \\u escape");
+                unsigned cp = 0;
+                auto result = std::from_chars(text.data() + pos, text.data() + pos + 4, cp, 16);
+                if (result.ptr != text.data() + pos + 4) fail("invalid \\u escape");
+                pos += 4;
+                return cp;
+            }
+
+            Value read_string() {
+                ++pos; // Opening quote
+                size_t plain = codec_detail::plain_prefix(text.data() + pos, text.size() - pos);
+                if (pos + plain < text.size() && text[pos + plain] == '"') {
+                    // No escapes: copy straight out of the input
+                    Value out{std::string(text.substr(pos, plain))};
+                    pos += plain + 1;
+                    return out;
+                }
+
+                scratch.clear();
+                for (;;) {
+                    plain = codec_detail::plain_prefix(text.data() + pos, text.size() - pos);
+                    scratch.append(text.data() + pos, plain);
+                    pos += plain;
+                    if (pos == text.size()) fail("unterminated string");
+                    char c = text[pos++];
+                    if (c == '"') break;
+                    if (c != '\\') {
+                        --pos;
+                        fail("control character in string");
+                    }
+                    if (pos == text.size()) fail("unterminated string");
+                    switch (text[pos++]) {
+                        case '"': scratch += '"'; break;
+                        case '\\': scratch += '\\'; break;
+                        case '/': scratch += '/'; break;
+                        case 'b': scratch += '\b'; break;
+                        case 'f': scratch += '\f'; break;
+                        case 'n': scratch += '\n'; break;
+                        case 'r': scratch += '\r'; break;
+                        case 't': scratch += '\t'; break;
+                        case 'u': {
+                            uint32_t cp = hex4();
+                            if (cp >= 0xD800 && cp < 0xDC00 && text.substr(pos, 2) == "\\u") {
+                                pos += 2;
+                                uint32_t low = hex4();
+                                if (low < 0xDC00 || low >= 0xE000) fail("unpaired surrogate");
+                                cp = 0x10000 + ((cp - 0xD800) << 10) + (low - 0xDC00);
+                            }
+                            codec_detail::append_utf8(scratch, cp);
+                            break;
+                        }
+                        default:
+                            fail("invalid escape");
+                    }
+                }
+                return Value{std::string(scratch)};
+            }
+
+            Value read_number() {
+                size_t start = pos;
+                bool is_double = false;
+                while (pos < text.size()) {
+                    char c = text[pos];
+                    if (c == '.' || c == 'e' || c == 'E') is_double = true;
+                    else if (!(c == '-' || c == '+' || (c >= '0' && c <= '9'))) break;
+                    ++pos;
+                }
+                const char* first = text.data() + start;
+                const char* last = text.data() + pos;
+                if (!is_double) {
+                    int i = 0;
+                    auto result = std::from_chars(first, last, i);
+                    if (result.ec == std::errc{} && result.ptr == last) return Value{i};
+                    if (result.ec != std::errc::result_out_of_range) fail("invalid number");
+                }
+                double d = 0;
+                auto result = std::from_chars(first, last, d);
+                if (result.ec != std::errc{} || result.ptr != last) fail("invalid number");
+                return Value{d};
+            }
+
+            Value read_value(size_t depth) {
+                if (depth > codec_detail::max_depth) fail("nesting too deep");
+                skip_space();
+                if (pos == text.size()) fail("unexpected end of input");
+                char c = text[pos];
+                switch (c) {
+                    case 'n': expect_word("null"); return Value{nullptr};
+                    case 't': expect_word("true"); return Value{true};
+                    case 'f': expect_word("false"); return Value{false};
+                    case '"': return read_string();
+                    case '[': {
+                        ++pos;
+                        size_t base = arrays.open();
+                        skip_space();
+                        if (pos < text.size() && text[pos] == ']') {
+                            ++pos;
+                            return arrays.close(base);
+                        }
+                        for (;;) {
+                            arrays.push(read_value(depth + 1));
+                            skip_space();
+                            if (pos == text.size()) fail("unterminated array");
+                            if (text[pos] == ',') {
+                                ++pos;
+                            } else if (text[pos] == ']') {
+                                ++pos;
+                                return arrays.close(base);
+                            } else {
+                                fail("expected ',' or ']'");
+                            }
+                        }
+                    }
+                    case '{': fail("objects are not supported");
+                    default:
+                        if (c == '-' || (c >= '0' && c <= '9')) return read_number();
+                        fail("unexpected character");
+                }
+            }
+
+        public:
+            // Parses the value starting at `offset` and moves `offset` past
+            // it, for input holding several values such as JSON lines
+            Value read_next(std::string_view input, size_t& offset) {
+                text = input;
+                pos = offset;
+                arrays.clear();
+                Value out = read_value(0);
+                skip_space();
+                offset = pos;
+                return out;
+            }
+
+            // Parses `input`, which must hold exactly one value
+            Value read(std::string_view input) {
+                size_t offset = 0;
+                Value out = read_next(input, offset);
+                if (offset != input.size()) fail("trailing characters");
+                return out;
+            }
+        };
+
+        inline Value parse(std::string_view input) {
+            Reader reader;
+            return reader.read(input);
+        }
+    }
+
+    namespace cbor {
+        namespace detail {
+            enum Major : uint8_t { UNSIGNED = 0, NEGATIVE = 1, BYTES = 2, TEXT = 3, ARRAY = 4, MAP = 5, TAG = 6, SIMPLE = 7 };
+
+            inline void write_head(std::string& out, Major major, uint64_t n) {
+                char head[9];
+                size_t size;
+                auto m = static_cast<char>(major << 5);
+                if (n < 24) {
+                    head[0] = static_cast<char>(m | static_cast<char>(n));
+                    size = 1;
+                } else {
+                    unsigned extra = n <= 0xFF ? 0 : n <= 0xFFFF ? 1 : n <= 0xFFFFFFFF ? 2 : 3;
+                    size = size_t{1} << extra;
+                    head[0] = static_cast<char>(m | static_cast<char>(24 + extra));
+                    for (size_t i = 0; i < size; ++i) head[size - i] = static_cast<char>(n >> (8 * i));
+                    ++size;
+                }
+                out.append(head, size);
+            }
+        }
+
+        // Appends `value` as CBOR. Doubles are written as 64-bit floats.
+        inline void write(std::string& out, const Value& value, size_t depth = 0) {
+            if (depth > codec_detail::max_depth) throw std::invalid_argument("Value nests too deeply for CBOR");
+            std::visit([&](const auto& v) {
+                using T = std::decay_t<decltype(v)>;
+                if constexpr (std::is_same_v<T, std::nullptr_t>) {
+                    out += '\xF6';
+                } else if constexpr (std::is_same_v<T, bool>) {
+                    out += v ? '\xF5' : '\xF4';
+                } else if constexpr (std::is_same_v<T, int>) {
+                    if (v >= 0) detail::write_head(out, detail::UNSIGNED, static_cast<uint64_t>(v));
+                    else detail::write_head(out, detail::NEGATIVE, static_cast<uint64_t>(-(static_cast<int64_t>(v) + 1)));
+                } else if constexpr (std::is_same_v<T, double>) {
+                    char bytes[9];
+                    bytes[0] = '\xFB';
+                    auto bits = std::bit_cast<uint64_t>(v);
+                    for (int i = 0; i < 8; ++i) bytes[8 - i] = static_cast<char>(bits >> (8 * i));
+                    out.append(bytes, sizeof bytes);
+                } else if constexpr (std::is_same_v<T, std::string>) {
+                    detail::write_head(out, detail::TEXT, v.size());
+                    out += v;
+                } else {
+                    detail::write_head(out, detail::ARRAY, v.size());
+                    for (const Value& element : v) write(out, element, depth + 1);
+                }
+            }, value);
+        }
+
+        inline std::string to_cbor(const Value& value) {
+            std::string out;
+            write(out, value);
+            return out;
+        }
+
+        // Parses CBOR into Values. Accepts the definite-length integers,
+        // floats (half, single and double), text strings, arrays and the
+        // null/true/false simple values; byte strings, maps and tags have no
+        // Value counterpart and are rejected. Integers that do not fit an int
+        // are read as doubles.
+        class Reader {
+            codec_detail::ArrayStack arrays;
+            std::string_view data;
+            size_t pos = 0;
+
+            [[noreturn]] void fail(const char* what) const {
+                throw std::runtime_error(std::string("CBOR: ") + what + " at offset " + std::to_string(pos));
+            }
+
+            uint64_t read_be(size_t size) {
+                if (data.size() - pos < size) fail("truncated item");
+                uint64_t n = 0;
+                for (size_t i = 0; i < size; ++i) n = (n << 8) | static_cast<unsigned char>(data[pos + i]);
+                pos += size;
+                return n;
+            }
+
+            uint64_t read_argument(uint8_t info) {
+                if (info < 24) return info;
+                if (info <= 27) return read_be(size_t{1} << (info - 24));
+                fail("indefinite or reserved length");
+            }
+
+            static double half_to_double(uint16_t half) {
+                int exponent = (half >> 10) & 0x1F;
+                double mantissa = half & 0x3FF;
+                double magnitude = exponent == 0 ? std::ldexp(mantissa, -24)
+                                 : exponent == 31 ? (mantissa == 0 ? std::numeric_limits<double>::infinity()
+                                                                   : std::numeric_limits<double>::quiet_NaN())
+                                 : std::ldexp(mantissa + 1024, exponent - 25);
+                return half & 0x8000 ? -magnitude : magnitude;
+            }
+
+            static Value integer(uint64_t magnitude, bool negative) {
+                if (!negative && magnitude <= static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+                    return Value{static_cast<int>(magnitude)};
+                }
+                if (negative && magnitude <= static_cast<uint64_t>(std::numeric_limits<int>::max())) {
+                    return Value{-1 - static_cast<int>(magnitude)};
+                }
+                double d = static_cast<double>(magnitude);
+                return Value{negative ? -1.0 - d : d};
+            }
+
+            Value read_value(size_t depth) {
+                if (depth > codec_detail::max_depth) fail("nesting too deep");
+                if (pos == data.size()) fail("unexpected end of input");
+                auto initial = static_cast<uint8_t>(data[pos++]);
+                auto major = static_cast<detail::Major>(initial >> 5);
+                uint8_t info = initial & 0x1F;
+
+                switch (major) {
+                    case detail::UNSIGNED: return integer(read_argument(info), false);
+                    case detail::NEGATIVE: return integer(read_argument(info), true);
+                    case detail::TEXT: {
+                        uint64_t size = read_argument(info);
+                        if (data.size() - pos < size) fail("truncated string");
+                        Value out{std::string(data.substr(pos, size))};
+                        pos += size;
+                        return out;
+                    }
+                    case detail::ARRAY: {
+                        uint64_t count = read_argument(info);
+                        if (count > data.size() - pos) fail("truncated array"); // Every element takes a byte
+                        size_t base = arrays.open();
+                        for (uint64_t i = 0; i < count; ++i) arrays.push(read_value(depth + 1));
+                        return arrays.close(base);
+                    }
+                    case detail::SIMPLE:
+                        switch (info) {
+                            case 20: return Value{false};
+                            case 21: return Value{true};
+                            case 22: return Value{nullptr};
+                            case 25: return Value{half_to_double(static_cast<uint16_t>(read_be(2)))};
+                            case 26: return Value{static_cast<double>(std::bit_cast<float>(static_cast<uint32_t>(read_be(4))))};
+                            case 27: return Value{std::bit_cast<double>(read_be(8))};
+                            default: fail("unsupported simple value");
+                        }
+                    default:
+                        fail("byte strings, maps and tags are not supported");
+                }
+            }
+
+        public:
+            // Parses the item starting at `offset` and moves `offset` past it,
+            // for a stream of concatenated items
+            Value read_next(std::string_view input, size_t& offset) {
+                data = input;
+                pos = offset;
+                arrays.clear();
+                Value out = read_value(0);
+                offset = pos;
+                return out;
+            }
+
+            // Parses `input`, which must hold exactly one item
+            Value read(std::string_view input) {
+                size_t offset = 0;
+                Value out = read_next(input, offset);
+                if (offset != input.size()) fail("trailing bytes");
+                return out;
+            }
+        };
+
+        inline Value parse(std::string_view input) {
+            Reader reader;
+            return reader.read(input);
+        }
+    }
+}
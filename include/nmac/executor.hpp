@@ -0,0 +1,456 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace nmac {
+    namespace detail {
+        // Chase–Lev work-stealing deque (Lê et al., "Correct and Efficient
+        // Work-Stealing for Weak Memory Models"). The owning worker pushes and
+        // pops at the bottom; any other thread may steal from the top.
+        template<typename T>
+        class WorkStealingDeque {
+            struct Array {
+                int64_t capacity;
+                int64_t mask;
+                std::unique_ptr<std::atomic<T>[]> slots;
+
+                explicit Array(int64_t c) : capacity(c), mask(c - 1), slots(new std::atomic<T>[c]) {}
+
+                T get(int64_t i) const { return slots[i & mask].load(std::memory_order_relaxed); }
+                void put(int64_t i, T v) { slots[i & mask].store(v, std::memory_order_relaxed); }
+
+                Array* grow(int64_t top, int64_t bottom) const {
+                    auto* bigger = new Array(capacity * 2);
+                    for (int64_t i = top; i < bottom; ++i) bigger->put(i, get(i));
+                    return bigger;
+                }
+            };
+
+            alignas(64) std::atomic<int64_t> top{0};
+            alignas(64) std::atomic<int64_t> bottom{0};
+            alignas(64) std::atomic<Array*> array;
+            std::vector<std::unique_ptr<Array>> retired; // Thieves may still read old arrays
+
+        public:
+            explicit WorkStealingDeque(int64_t capacity = 256) : array(new Array(capacity)) {}
+            WorkStealingDeque(const WorkStealingDeque&) = delete;
+            WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+            ~WorkStealingDeque() { delete array.load(std::memory_order_relaxed); }
+
+            // Owner only
+            void push(T item) {
+                int64_t b = bottom.load(std::memory_order_relaxed);
+                int64_t t = top.load(std::memory_order_acquire);
+                Array* a = array.load(std::memory_order_relaxed);
+                if (b - t > a->capacity - 1) {
+                    retired.emplace_back(a);
+                    a = a->grow(t, b);
+                    array.store(a, std::memory_order_release);
+                }
+                a->put(b, item);
+                bottom.store(b + 1, std::memory_order_release);
+            }
+
+            // Owner only
+            std::optional<T> pop() {
+                int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+                Array* a = array.load(std::memory_order_relaxed);
+                // seq_cst store/load pair in place of the paper's fence (visible to TSan)
+                bottom.store(b, std::memory_order_seq_cst);
+                int64_t t = top.load(std::memory_order_seq_cst);
+
+                if (t > b) {
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    return std::nullopt;
+                }
+
+                T item = a->get(b);
+                if (t == b) {
+                    // Last element: race against thieves for it
+                    bool won = top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed);
+                    bottom.store(b + 1, std::memory_order_relaxed);
+                    if (!won) return std::nullopt;
+                }
+                return item;
+            }
+
+            // Any thread
+            std::optional<T> steal() {
+                int64_t t = top.load(std::memory_order_seq_cst);
+                int64_t b = bottom.load(std::memory_order_seq_cst);
+                if (t >= b) return std::nullopt;
+
+                Array* a = array.load(std::memory_order_acquire);
+                T item = a->get(t);
+                if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                                 std::memory_order_relaxed)) {
+                    return std::nullopt;
+                }
+                return item;
+            }
+
+            bool empty() const {
+                return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+            }
+        };
+
+        // Type-erased unit of work; invoke() runs and destroys it
+        struct Job {
+            void (*invoke)(Job*);
+        };
+
+        template<typename F>
+        struct JobImpl : Job {
+            F fn;
+
+            explicit JobImpl(F f) : Job{&run}, fn(std::move(f)) {}
+
+            static void run(Job* job) {
+                std::unique_ptr<JobImpl> self(static_cast<JobImpl*>(job));
+                self->fn();
+            }
+        };
+
+        // Parses sysfs CPU lists such as "0-3,8-11"
+        inline std::vector<int> parse_cpu_list(const std::string& list) {
+            std::vector<int> cpus;
+            size_t pos = 0;
+            while (pos < list.size()) {
+                size_t comma = list.find(',', pos);
+                std::string range = list.substr(pos, comma == std::string::npos ? std::string::npos : comma - pos);
+                size_t dash = range.find('-');
+                try {
+                    int first = std::stoi(range.substr(0, dash));
+                    int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+                    for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+                } catch (...) {
+                    // Ignore malformed entries
+                }
+                if (comma == std::string::npos) break;
+                pos = comma + 1;
+            }
+            return cpus;
+        }
+
+        // CPUs of each online NUMA node; empty when the topology is unavailable
+        inline std::vector<std::vector<int>> numa_nodes() {
+            std::vector<std::vector<int>> nodes;
+            std::ifstream online("/sys/devices/system/node/online");
+            std::string list;
+            if (!online || !std::getline(online, list)) return nodes;
+
+            for (int node : parse_cpu_list(list)) {
+                std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+                std::string cpus;
+                if (in && std::getline(in, cpus)) {
+                    auto parsed = parse_cpu_list(cpus);
+                    if (!parsed.empty()) nodes.push_back(std::move(parsed));
+                }
+            }
+            return nodes;
+        }
+    }
+
+    struct ExecutorOptions {
+        unsigned threads = 0;       // 0 = std::thread::hardware_concurrency()
+        bool numa_aware = false;    // Pin workers round-robin across NUMA nodes (Linux only)
+    };
+
+    // Work-stealing thread pool shared by every parallel feature in nmac. Jobs
+    // spawned from a worker go onto that worker's deque; jobs submitted from
+    // other threads go through a shared injection queue. Idle workers steal.
+    class executor {
+        struct Worker {
+            detail::WorkStealingDeque<detail::Job*> deque;
+            std::thread thread;
+        };
+
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        std::mutex inject_mutex;
+        std::deque<detail::Job*> injected;
+        std::atomic<size_t> injected_count{0};
+
+        // Sleep/wake protocol: every push bumps `epoch`; sleepers wait for it to change
+        std::mutex sleep_mutex;
+        std::condition_variable wake;
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<unsigned> sleepers{0};
+        std::atomic<bool> stopping{false};
+
+        static inline thread_local executor* current_executor = nullptr;
+        static inline thread_local size_t current_index = 0;
+
+        static uint32_t next_random() {
+            static thread_local uint32_t state =
+                static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1u;
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        bool on_worker() const { return current_executor == this; }
+
+        void notify_one() {
+            epoch.fetch_add(1);
+            if (sleepers.load() > 0) {
+                std::lock_guard lock(sleep_mutex);
+                wake.notify_one();
+            }
+        }
+
+        void push(detail::Job* job) {
+            if (on_worker()) {
+                workers[current_index]->deque.push(job);
+            } else {
+                std::lock_guard lock(inject_mutex);
+                injected.push_back(job);
+                injected_count.fetch_add(1, std::memory_order_release);
+            }
+            notify_one();
+        }
+
+        detail::Job* take_injected() {
+            if (injected_count.load(std::memory_order_acquire) == 0) return nullptr;
+            std::lock_guard lock(inject_mutex);
+            if (injected.empty()) return nullptr;
+            detail::Job* job = injected.front();
+            injected.pop_front();
+            injected_count.fetch_sub(1, std::memory_order_relaxed);
+            return job;
+        }
+
+        detail::Job* find_job() {
+            if (on_worker()) {
+                if (auto job = workers[current_index]->deque.pop()) return *job;
+            }
+            if (detail::Job* job = take_injected()) return job;
+
+            size_t count = workers.size();
+            size_t start = next_random() % count;
+            for (size_t i = 0; i < count; ++i) {
+                size_t victim = (start + i) % count;
+                if (on_worker() && victim == current_index) continue;
+                if (auto job = workers[victim]->deque.steal()) return *job;
+            }
+            return nullptr;
+        }
+
+        // Sleeps until new work is pushed or `done()` holds
+        template<typename Pred>
+        void sleep_unless(uint64_t seen, Pred done) {
+            sleepers.fetch_add(1);
+            {
+                std::unique_lock lock(sleep_mutex);
+                wake.wait(lock, [&] { return epoch.load() != seen || done(); });
+            }
+            sleepers.fetch_sub(1);
+        }
+
+        void worker_main(size_t index) {
+            current_executor = this;
+            current_index = index;
+
+            for (;;) {
+                uint64_t seen = epoch.load();
+                if (detail::Job* job = find_job()) {
+                    job->invoke(job);
+                    continue;
+                }
+                if (stopping.load()) return;
+                std::this_thread::yield();
+                if (detail::Job* job = find_job()) {
+                    job->invoke(job);
+                    continue;
+                }
+                sleep_unless(seen, [this] { return stopping.load(); });
+            }
+        }
+
+        void pin_workers() {
+#ifdef __linux__
+            auto nodes = detail::numa_nodes();
+            if (nodes.empty()) return;
+
+            for (size_t i = 0; i < workers.size(); ++i) {
+                const auto& cpus = nodes[i % nodes.size()];
+                int cpu = cpus[(i / nodes.size()) % cpus.size()];
+                cpu_set_t set;
+                CPU_ZERO(&set);
+                CPU_SET(cpu, &set);
+                // Best effort: ignore failures (e.g. restricted cpusets)
+                pthread_setaffinity_np(workers[i]->thread.native_handle(), sizeof(set), &set);
+            }
+#endif
+        }
+
+    public:
+        explicit executor(ExecutorOptions options = {}) {
+            unsigned count = options.threads ? options.threads : std::thread::hardware_concurrency();
+            if (count == 0) count = 1;
+
+            workers.reserve(count);
+            for (unsigned i = 0; i < count; ++i) workers.push_back(std::make_unique<Worker>());
+            for (unsigned i = 0; i < count; ++i) {
+                workers[i]->thread = std::thread([this, i] { worker_main(i); });
+            }
+            if (options.numa_aware) pin_workers();
+        }
+
+        executor(const executor&) = delete;
+        executor& operator=(const executor&) = delete;
+
+        // Runs every queued job, then joins the workers
+        ~executor() {
+            stopping.store(true);
+            epoch.fetch_add(1);
+            {
+                std::lock_guard lock(sleep_mutex);
+                wake.notify_all();
+            }
+            for (auto& worker : workers) worker->thread.join();
+        }
+
+        // Process-wide pool; use this rather than creating threads per feature
+        static executor& global() {
+            static executor instance;
+            return instance;
+        }
+
+        size_t concurrency() const { return workers.size(); }
+
+        // Fire-and-forget. An exception escaping `f` terminates, as with std::thread.
+        template<typename F>
+        void submit(F&& f) {
+            push(new detail::JobImpl<std::decay_t<F>>(std::forward<F>(f)));
+        }
+
+        // Satisfies AsyncExecutor: resumes the coroutine on a worker
+        void post(std::coroutine_handle<> handle) {
+            submit([handle] { handle.resume(); });
+        }
+
+        // Runs one pending job on the calling thread; false if none was found
+        bool run_pending_job() {
+            if (detail::Job* job = find_job()) {
+                job->invoke(job);
+                return true;
+            }
+            return false;
+        }
+
+        // Executes pending jobs on the calling thread until `done()` holds.
+        // Anything that signals `done` must call notify_waiters() afterwards.
+        template<typename Pred>
+        void help_until(Pred done) {
+            while (!done()) {
+                uint64_t seen = epoch.load();
+                if (run_pending_job()) continue;
+                if (done()) return;
+                std::this_thread::yield();
+                if (run_pending_job()) continue;
+                sleep_unless(seen, done);
+            }
+        }
+
+        void notify_waiters() {
+            epoch.fetch_add(1);
+            if (sleepers.load() > 0) {
+                std::lock_guard lock(sleep_mutex);
+                wake.notify_all();
+            }
+        }
+
+        // Calls f(i) for every i in [begin, end), splitting the range recursively
+        // into chunks of at most `grain` indices.
+        template<typename F>
+        void parallel_for(size_t begin, size_t end, F&& f, size_t grain = 1);
+    };
+
+    // Fork-join scope: spawn() children onto the pool and sync() to wait for
+    // them. The waiting thread runs pending jobs instead of blocking.
+    class task_group {
+        executor& pool;
+        std::atomic<size_t> outstanding{0};
+        std::mutex error_mutex;
+        std::exception_ptr error;
+
+        void finish() {
+            executor& e = pool; // `this` may be gone once the count reaches zero
+            if (outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1) e.notify_waiters();
+        }
+
+    public:
+        explicit task_group(executor& e = executor::global()) : pool(e) {}
+        task_group(const task_group&) = delete;
+        task_group& operator=(const task_group&) = delete;
+
+        ~task_group() {
+            pool.help_until([this] { return outstanding.load(std::memory_order_acquire) == 0; });
+        }
+
+        template<typename F>
+        void spawn(F&& f) {
+            outstanding.fetch_add(1, std::memory_order_relaxed);
+            pool.submit([this, fn = std::forward<F>(f)]() mutable {
+                try {
+                    fn();
+                } catch (...) {
+                    std::lock_guard lock(error_mutex);
+                    if (!error) error = std::current_exception();
+                }
+                finish();
+            });
+        }
+
+        // Waits for every spawned job; rethrows the first exception any of them raised
+        void sync() {
+            pool.help_until([this] { return outstanding.load(std::memory_order_acquire) == 0; });
+            std::exception_ptr failure;
+            {
+                std::lock_guard lock(error_mutex);
+                failure = std::exchange(error, nullptr);
+            }
+            if (failure) std::rethrow_exception(failure);
+        }
+    };
+
+    template<typename F>
+    void executor::parallel_for(size_t begin, size_t end, F&& f, size_t grain) {
+        if (begin >= end) return;
+        if (grain == 0) grain = 1;
+
+        task_group group(*this);
+        // Spawn the upper half and keep splitting the lower one
+        auto run_range = [&](auto& self, size_t lo, size_t hi) -> void {
+            while (hi - lo > grain) {
+                size_t mid = lo + (hi - lo) / 2;
+                group.spawn([&self, mid, hi] { self(self, mid, hi); });
+                hi = mid;
+            }
+            for (size_t i = lo; i < hi; ++i) f(i);
+        };
+        run_range(run_range, begin, end);
+        group.sync();
+    }
+}
@@ -0,0 +1,494 @@
+#pragma once
+
+#include "nmac/executor.hpp"
+#include "nmac/io/io_uring.hpp"
+#include "nmac/trace.hpp"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+namespace nmac::io {
+    struct BatchOptions {
+        unsigned queue_depth = 64;          // Reads/writes kept in flight at once
+        size_t arena_bytes = 32u << 20;     // Registered read buffer; larger files are read separately
+        bool use_io_uring = true;           // Fall back to pread/pwrite when false or unavailable
+        executor* workers = nullptr;        // Hand completed files to this pool instead of calling back inline
+    };
+
+    struct WriteRequest {
+        std::string path;
+        std::string_view data;
+    };
+
+    // Called once per input as soon as its read completes. `contents` is only
+    // valid for the duration of the call. With BatchOptions::workers set, calls
+    // run concurrently on the pool.
+    using FileCallback = std::function<void(size_t index, std::string_view contents)>;
+
+    namespace detail {
+#ifdef IOV_MAX
+        inline constexpr size_t max_iov = IOV_MAX;
+#else
+        inline constexpr size_t max_iov = 1024; // Linux UIO_MAXIOV
+#endif
+
+        inline int open_or_throw(const std::string& path, int flags, mode_t mode = 0) {
+            int fd;
+            do {
+                fd = ::open(path.c_str(), flags | O_CLOEXEC, mode);
+            } while (fd < 0 && errno == EINTR);
+            if (fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "Cannot open file: " + path);
+            }
+            return fd;
+        }
+
+        inline size_t file_size(int fd, const std::string& path) {
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                int err = errno;
+                ::close(fd);
+                throw std::system_error(err, std::generic_category(), "Cannot stat file: " + path);
+            }
+            return static_cast<size_t>(st.st_size);
+        }
+
+        // Reads up to `size` bytes; returns the number read (short only at EOF).
+        inline size_t pread_all(int fd, char* buf, size_t size, const std::string& path) {
+            size_t done = 0;
+            while (done < size) {
+                ssize_t n = ::pread(fd, buf + done, size - done, static_cast<off_t>(done));
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::generic_category(), "Cannot read file: " + path);
+                }
+                if (n == 0) break;
+                done += static_cast<size_t>(n);
+            }
+            return done;
+        }
+
+        inline void pwrite_all(int fd, std::string_view data, const std::string& path) {
+            size_t done = 0;
+            while (done < data.size()) {
+                ssize_t n = ::pwrite(fd, data.data() + done, data.size() - done, static_cast<off_t>(done));
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::generic_category(), "Cannot write file: " + path);
+                }
+                if (n == 0) throw std::system_error(EIO, std::generic_category(), "Cannot write file: " + path);
+                done += static_cast<size_t>(n);
+            }
+        }
+    }
+
+    // Writes `pieces` back to back at the current file position with as few
+    // writev() calls as possible: one per IOV_MAX pieces, plus retries after
+    // short writes. `what` names the target in error messages.
+    inline void write_vectored(int fd, std::span<const std::string_view> pieces, const std::string& what) {
+        NMAC_TRACE_SCOPE("write");
+        std::vector<iovec> iov;
+        iov.reserve(std::min(pieces.size(), detail::max_iov));
+
+        size_t next = 0;
+        while (next < pieces.size()) {
+            iov.clear();
+            for (; next < pieces.size() && iov.size() < detail::max_iov; ++next) {
+                if (pieces[next].empty()) continue;
+                iov.push_back({const_cast<char*>(pieces[next].data()), pieces[next].size()});
+            }
+
+            size_t first = 0;
+            while (first < iov.size()) {
+                ssize_t n = ::writev(fd, iov.data() + first, static_cast<int>(iov.size() - first));
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    throw std::system_error(errno, std::generic_category(), "Cannot write " + what);
+                }
+                auto written = static_cast<size_t>(n);
+                while (first < iov.size() && written >= iov[first].iov_len) written -= iov[first++].iov_len;
+                if (written > 0) {
+                    iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + written;
+                    iov[first].iov_len -= written;
+                }
+            }
+        }
+    }
+
+    // Batched whole-file reader/writer. Uses io_uring with a registered read
+    // arena when the kernel allows it, and plain pread/pwrite otherwise.
+    class BatchIo {
+        BatchOptions options;
+        std::vector<char> scratch; // Fallback read buffer, reused across files
+
+        // Delivers completed files inline or to the worker pool. Buffers handed
+        // to workers must stay untouched until drain() returns.
+        class Handoff {
+            const FileCallback& on_file;
+            std::exception_ptr& failure;
+            std::optional<task_group> group;
+
+        public:
+            Handoff(const FileCallback& callback, executor* workers, std::exception_ptr& f)
+                : on_file(callback), failure(f) {
+                if (workers) group.emplace(*workers);
+            }
+
+            bool parallel() const { return group.has_value(); }
+
+            void deliver(size_t index, std::string_view contents) {
+                if (failure) return;
+                try {
+                    if (group) group->spawn([callback = &on_file, index, contents] { (*callback)(index, contents); });
+                    else on_file(index, contents);
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+            }
+
+            void deliver(size_t index, std::string contents) {
+                if (failure) return;
+                try {
+                    if (group) {
+                        group->spawn([callback = &on_file, index, data = std::move(contents)] {
+                            (*callback)(index, data);
+                        });
+                    } else {
+                        on_file(index, contents);
+                    }
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+            }
+
+            void drain() {
+                if (!group) return;
+                try {
+                    group->sync();
+                } catch (...) {
+                    if (!failure) failure = std::current_exception();
+                }
+            }
+        };
+
+#if NMAC_HAS_IO_URING
+        IoUring ring;
+        std::unique_ptr<char[]> arena;
+        bool arena_registered = false;
+
+        struct Pending {
+            size_t index = 0;
+            int fd = -1;
+            char* buffer = nullptr;
+            size_t size = 0;
+            size_t done = 0;
+            std::string_view data; // Writes only
+        };
+
+        static constexpr size_t arena_alignment = 64;
+
+        void queue_read(Pending& p, unsigned slot) {
+            io_uring_sqe* sqe = ring.get_sqe();
+            size_t remaining = p.size - p.done;
+            if (arena_registered) {
+                sqe->opcode = IORING_OP_READ_FIXED;
+                sqe->buf_index = 0;
+            } else {
+                sqe->opcode = IORING_OP_READ;
+            }
+            sqe->fd = p.fd;
+            sqe->addr = reinterpret_cast<__u64>(p.buffer + p.done);
+            sqe->len = static_cast<__u32>(std::min<size_t>(remaining, 1u << 30));
+            sqe->off = p.done;
+            sqe->user_data = slot;
+        }
+
+        void queue_write(Pending& p, unsigned slot) {
+            io_uring_sqe* sqe = ring.get_sqe();
+            sqe->opcode = IORING_OP_WRITE;
+            sqe->fd = p.fd;
+            sqe->addr = reinterpret_cast<__u64>(p.data.data() + p.done);
+            sqe->len = static_cast<__u32>(std::min<size_t>(p.data.size() - p.done, 1u << 30));
+            sqe->off = p.done;
+            sqe->user_data = slot;
+        }
+
+        void read_uring(std::span<const std::string> paths, const FileCallback& on_file) {
+            std::vector<Pending> slots(options.queue_depth);
+            std::vector<unsigned> free_slots;
+            for (unsigned i = options.queue_depth; i-- > 0;) free_slots.push_back(i);
+
+            size_t next = 0;
+            size_t arena_used = 0;
+            unsigned in_flight = 0;
+            std::exception_ptr failure; // Drain in-flight reads before rethrowing
+            Handoff handoff(on_file, options.workers, failure);
+
+            while ((next < paths.size() && !failure) || in_flight > 0) {
+                // Fill the queue until we run out of slots or arena space
+                while (next < paths.size() && !failure && !free_slots.empty()) {
+                    const std::string& path = paths[next];
+                    int fd = -1;
+                    size_t size = 0;
+                    try {
+                        fd = detail::open_or_throw(path, O_RDONLY);
+                        size = detail::file_size(fd, path);
+                    } catch (...) {
+                        failure = std::current_exception();
+                        break;
+                    }
+
+                    if (size > options.arena_bytes) {
+                        // Too large for the arena: read it on its own
+                        try {
+                            std::string data(size, '\0');
+                            data.resize(detail::pread_all(fd, data.data(), size, path));
+                            ::close(fd);
+                            fd = -1;
+                            handoff.deliver(next++, std::move(data));
+                        } catch (...) {
+                            if (fd >= 0) ::close(fd);
+                            failure = std::current_exception();
+                        }
+                        continue;
+                    }
+                    if (arena_used + size > options.arena_bytes) {
+                        ::close(fd);
+                        break; // Wait for the arena to drain
+                    }
+                    if (size == 0) {
+                        ::close(fd);
+                        handoff.deliver(next++, std::string_view());
+                        continue;
+                    }
+
+                    unsigned slot = free_slots.back();
+                    free_slots.pop_back();
+                    slots[slot] = Pending{next++, fd, arena.get() + arena_used, size, 0, {}};
+                    arena_used += (size + arena_alignment - 1) & ~(arena_alignment - 1);
+                    queue_read(slots[slot], slot);
+                    in_flight++;
+                }
+
+                if (in_flight == 0) {
+                    handoff.drain();
+                    arena_used = 0;
+                    continue;
+                }
+
+                ring.submit(1);
+                while (io_uring_cqe* cqe = ring.peek_cqe()) {
+                    auto slot = static_cast<unsigned>(cqe->user_data);
+                    int res = cqe->res;
+                    ring.cqe_seen();
+
+                    Pending& p = slots[slot];
+                    if (res > 0 && p.done + res < p.size && !failure) {
+                        p.done += static_cast<size_t>(res);
+                        queue_read(p, slot); // Short read: resubmit the remainder
+                        continue;
+                    }
+
+                    ::close(p.fd);
+                    in_flight--;
+                    free_slots.push_back(slot);
+                    if (failure) continue;
+                    if (res < 0) {
+                        failure = std::make_exception_ptr(std::system_error(
+                            -res, std::generic_category(), "Cannot read file: " + paths[p.index]));
+                        continue;
+                    }
+                    p.done += static_cast<size_t>(res);
+                    handoff.deliver(p.index, std::string_view(p.buffer, p.done));
+                }
+
+                if (in_flight == 0) {
+                    handoff.drain();
+                    arena_used = 0;
+                } else {
+                    ring.submit(0);
+                }
+            }
+            handoff.drain();
+            if (failure) std::rethrow_exception(failure);
+        }
+
+        void write_uring(std::span<const WriteRequest> requests) {
+            std::vector<Pending> slots(options.queue_depth);
+            std::vector<unsigned> free_slots;
+            for (unsigned i = options.queue_depth; i-- > 0;) free_slots.push_back(i);
+
+            size_t next = 0;
+            unsigned in_flight = 0;
+            std::exception_ptr failure;
+
+            while ((next < requests.size() && !failure) || in_flight > 0) {
+                while (next < requests.size() && !failure && !free_slots.empty()) {
+                    const WriteRequest& req = requests[next];
+                    int fd = -1;
+                    try {
+                        fd = detail::open_or_throw(req.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                    } catch (...) {
+                        failure = std::current_exception();
+                        break;
+                    }
+                    if (req.data.empty()) {
+                        ::close(fd);
+                        next++;
+                        continue;
+                    }
+
+                    unsigned slot = free_slots.back();
+                    free_slots.pop_back();
+                    slots[slot] = Pending{next++, fd, nullptr, 0, 0, req.data};
+                    queue_write(slots[slot], slot);
+                    in_flight++;
+                }
+
+                if (in_flight == 0) continue;
+
+                ring.submit(1);
+                while (io_uring_cqe* cqe = ring.peek_cqe()) {
+                    auto slot = static_cast<unsigned>(cqe->user_data);
+                    int res = cqe->res;
+                    ring.cqe_seen();
+
+                    Pending& p = slots[slot];
+                    if (res > 0 && p.done + res < p.data.size() && !failure) {
+                        p.done += static_cast<size_t>(res);
+                        queue_write(p, slot); // Short write: resubmit the remainder
+                        continue;
+                    }
+
+                    ::close(p.fd);
+                    in_flight--;
+                    free_slots.push_back(slot);
+                    if (failure) continue;
+                    // A write that makes no progress would otherwise be resubmitted forever
+                    if (res == 0 && p.done < p.data.size()) res = -EIO;
+                    if (res < 0) {
+                        failure = std::make_exception_ptr(std::system_error(
+                            -res, std::generic_category(), "Cannot write file: " + requests[p.index].path));
+                    }
+                }
+                if (in_flight > 0) ring.submit(0);
+            }
+            if (failure) std::rethrow_exception(failure);
+        }
+#endif
+
+        void read_fallback(std::span<const std::string> paths, const FileCallback& on_file) {
+            std::exception_ptr failure;
+            Handoff handoff(on_file, options.workers, failure);
+
+            for (size_t i = 0; i < paths.size() && !failure; ++i) {
+                try {
+                    int fd = detail::open_or_throw(paths[i], O_RDONLY);
+                    size_t size = detail::file_size(fd, paths[i]);
+                    size_t n = 0;
+                    try {
+                        if (handoff.parallel()) {
+                            std::string data(size, '\0');
+                            data.resize(detail::pread_all(fd, data.data(), size, paths[i]));
+                            ::close(fd);
+                            handoff.deliver(i, std::move(data));
+                            // Bound the number of files held in memory at once
+                            if ((i + 1) % options.queue_depth == 0) handoff.drain();
+                            continue;
+                        }
+                        scratch.resize(size);
+                        n = detail::pread_all(fd, scratch.data(), size, paths[i]);
+                    } catch (...) {
+                        ::close(fd);
+                        throw;
+                    }
+                    ::close(fd);
+                    handoff.deliver(i, std::string_view(scratch.data(), n));
+                } catch (...) {
+                    failure = std::current_exception();
+                }
+            }
+            handoff.drain();
+            if (failure) std::rethrow_exception(failure);
+        }
+
+        void write_fallback(std::span<const WriteRequest> requests) {
+            for (const auto& req : requests) {
+                int fd = detail::open_or_throw(req.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+                try {
+                    detail::pwrite_all(fd, req.data, req.path);
+                } catch (...) {
+                    ::close(fd);
+                    throw;
+                }
+                ::close(fd);
+            }
+        }
+
+    public:
+        explicit BatchIo(BatchOptions opts = {}) : options(opts) {
+            if (options.queue_depth == 0) options.queue_depth = 1;
+#if NMAC_HAS_IO_URING
+            if (options.use_io_uring && ring.init(options.queue_depth)) {
+                // The ring may round the depth up; never keep more in flight than it holds
+                options.queue_depth = std::min(options.queue_depth, ring.capacity());
+                arena = std::make_unique<char[]>(options.arena_bytes);
+                iovec iov{arena.get(), options.arena_bytes};
+                arena_registered = ring.register_buffers(&iov, 1);
+            }
+#endif
+        }
+
+        BatchIo(const BatchIo&) = delete;
+        BatchIo& operator=(const BatchIo&) = delete;
+
+        ~BatchIo() {
+#if NMAC_HAS_IO_URING
+            if (arena_registered) ring.unregister_buffers();
+#endif
+        }
+
+        bool uses_io_uring() const {
+#if NMAC_HAS_IO_URING
+            return ring.valid();
+#else
+            return false;
+#endif
+        }
+
+        // Reads every file, invoking `on_file` in completion order (not input order).
+        void read(std::span<const std::string> paths, const FileCallback& on_file) {
+#if NMAC_HAS_IO_URING
+            if (ring.valid()) {
+                read_uring(paths, on_file);
+                return;
+            }
+#endif
+            read_fallback(paths, on_file);
+        }
+
+        // Creates or truncates each target path and writes its data.
+        void write(std::span<const WriteRequest> requests) {
+#if NMAC_HAS_IO_URING
+            if (ring.valid()) {
+                write_uring(requests);
+                return;
+            }
+#endif
+            write_fallback(requests);
+        }
+    };
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+// Change notification for a fixed set of files, built on inotify. Parent
+// directories are watched rather than the files themselves so that editors
+// which save by writing a temporary file and renaming it over the original
+// are still seen.
+
+#if defined(__linux__) && __has_include(<sys/inotify.h>)
+#define NMAC_HAS_INOTIFY 1
+#else
+#define NMAC_HAS_INOTIFY 0
+#endif
+
+#if NMAC_HAS_INOTIFY
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <filesystem>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+namespace nmac::io {
+    class FileWatcher {
+        int fd = -1;
+        std::unordered_map<int, std::string> directories; // Watch descriptor -> directory
+        std::unordered_map<std::string, std::vector<size_t>> files; // Path -> indices passed to watch()
+
+        static constexpr uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE;
+
+        // Reads every queued event, adding the indices of watched files to `changed`
+        void drain(std::vector<size_t>& changed) {
+            alignas(inotify_event) char buf[16 * 1024];
+            for (;;) {
+                ssize_t n = ::read(fd, buf, sizeof buf);
+                if (n < 0) {
+                    if (errno == EINTR) continue;
+                    if (errno == EAGAIN) return;
+                    throw std::system_error(errno, std::generic_category(), "Cannot read inotify events");
+                }
+                for (ssize_t off = 0; off < n;) {
+                    auto* event = reinterpret_cast<const inotify_event*>(buf + off);
+                    off += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+                    if (event->len == 0) continue;
+
+                    auto dir = directories.find(event->wd);
+                    if (dir == directories.end()) continue;
+                    auto it = files.find((std::filesystem::path(dir->second) / event->name).string());
+                    if (it == files.end()) continue;
+                    changed.insert(changed.end(), it->second.begin(), it->second.end());
+                }
+            }
+        }
+
+        bool readable(int timeout_ms) {
+            pollfd pfd{fd, POLLIN, 0};
+            for (;;) {
+                int r = ::poll(&pfd, 1, timeout_ms);
+                if (r >= 0) return r > 0;
+                if (errno != EINTR) {
+                    throw std::system_error(errno, std::generic_category(), "Cannot poll inotify descriptor");
+                }
+            }
+        }
+
+    public:
+        FileWatcher() {
+            fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (fd < 0) throw std::system_error(errno, std::generic_category(), "Cannot create inotify instance");
+        }
+
+        FileWatcher(const FileWatcher&) = delete;
+        FileWatcher& operator=(const FileWatcher&) = delete;
+
+        ~FileWatcher() {
+            if (fd >= 0) ::close(fd);
+        }
+
+        // Reports changes to `path` as `index` from wait()
+        void watch(const std::string& path, size_t index) {
+            auto absolute = std::filesystem::absolute(path).lexically_normal();
+            std::string dir = absolute.parent_path().string();
+
+            int wd = inotify_add_watch(fd, dir.c_str(), mask);
+            if (wd < 0) throw std::system_error(errno, std::generic_category(), "Cannot watch directory: " + dir);
+            directories[wd] = dir;
+            files[absolute.string()].push_back(index);
+        }
+
+        // Blocks until at least one watched file changes, then keeps collecting
+        // for `settle_ms` so that a burst of writes (one save) is reported once.
+        // Returns the changed indices, sorted and without duplicates.
+        std::vector<size_t> wait(int settle_ms = 20) {
+            std::vector<size_t> changed;
+            while (changed.empty()) {
+                readable(-1);
+                drain(changed);
+            }
+            while (readable(settle_ms)) drain(changed);
+
+            std::ranges::sort(changed);
+            changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+            return changed;
+        }
+    };
+}
+
+#endif // NMAC_HAS_INOTIFY
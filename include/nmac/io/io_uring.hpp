@@ -0,0 +1,186 @@
+#pragma once
+
+// Minimal io_uring wrapper built on the raw syscalls, so the library does not
+// depend on liburing. Only what the batch file I/O layer needs is exposed.
+
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#define NMAC_HAS_IO_URING 1
+#else
+#define NMAC_HAS_IO_URING 0
+#endif
+
+#if NMAC_HAS_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <system_error>
+
+namespace nmac::io {
+    class IoUring {
+        int ring_fd = -1;
+
+        void* sq_ring = nullptr;
+        size_t sq_ring_size = 0;
+        void* cq_ring = nullptr;
+        size_t cq_ring_size = 0;
+        io_uring_sqe* sqes = nullptr;
+        size_t sqes_size = 0;
+
+        unsigned* sq_head = nullptr;
+        unsigned* sq_tail = nullptr;
+        unsigned* sq_array = nullptr;
+        unsigned sq_mask = 0;
+        unsigned sq_entries = 0;
+        unsigned sqe_tail = 0; // Local tail, published on submit()
+
+        unsigned* cq_head = nullptr;
+        unsigned* cq_tail = nullptr;
+        io_uring_cqe* cqes = nullptr;
+        unsigned cq_mask = 0;
+
+        static unsigned load_acquire(unsigned* p) {
+            return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+        }
+
+        static void store_release(unsigned* p, unsigned v) {
+            std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+        }
+
+        void release() {
+            if (sqes) munmap(sqes, sqes_size);
+            if (cq_ring && cq_ring != sq_ring) munmap(cq_ring, cq_ring_size);
+            if (sq_ring) munmap(sq_ring, sq_ring_size);
+            if (ring_fd >= 0) close(ring_fd);
+            sqes = nullptr;
+            sq_ring = cq_ring = nullptr;
+            ring_fd = -1;
+        }
+
+    public:
+        IoUring() = default;
+        IoUring(const IoUring&) = delete;
+        IoUring& operator=(const IoUring&) = delete;
+        ~IoUring() { release(); }
+
+        // Returns false (with errno set) if the kernel refuses to create a ring,
+        // e.g. io_uring is disabled or blocked by a seccomp policy.
+        bool init(unsigned entries) {
+            io_uring_params params;
+            std::memset(&params, 0, sizeof(params));
+
+            int fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+            if (fd < 0) return false;
+            ring_fd = fd;
+
+            sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+            if (single_mmap) {
+                sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+            }
+
+            sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQ_RING);
+            if (sq_ring == MAP_FAILED) {
+                sq_ring = nullptr;
+                release();
+                return false;
+            }
+
+            if (single_mmap) {
+                cq_ring = sq_ring;
+            } else {
+                cq_ring = mmap(nullptr, cq_ring_size, PROT_READ | PROT_WRITE,
+                               MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_CQ_RING);
+                if (cq_ring == MAP_FAILED) {
+                    cq_ring = nullptr;
+                    release();
+                    return false;
+                }
+            }
+
+            sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            void* sqe_map = mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+                                 MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+            if (sqe_map == MAP_FAILED) {
+                release();
+                return false;
+            }
+            sqes = static_cast<io_uring_sqe*>(sqe_map);
+
+            auto* sq_base = static_cast<char*>(sq_ring);
+            sq_head = reinterpret_cast<unsigned*>(sq_base + params.sq_off.head);
+            sq_tail = reinterpret_cast<unsigned*>(sq_base + params.sq_off.tail);
+            sq_array = reinterpret_cast<unsigned*>(sq_base + params.sq_off.array);
+            sq_mask = *reinterpret_cast<unsigned*>(sq_base + params.sq_off.ring_mask);
+            sq_entries = params.sq_entries;
+            sqe_tail = *sq_tail;
+
+            auto* cq_base = static_cast<char*>(cq_ring);
+            cq_head = reinterpret_cast<unsigned*>(cq_base + params.cq_off.head);
+            cq_tail = reinterpret_cast<unsigned*>(cq_base + params.cq_off.tail);
+            cqes = reinterpret_cast<io_uring_cqe*>(cq_base + params.cq_off.cqes);
+            cq_mask = *reinterpret_cast<unsigned*>(cq_base + params.cq_off.ring_mask);
+            return true;
+        }
+
+        bool valid() const { return ring_fd >= 0; }
+        unsigned capacity() const { return sq_entries; }
+
+        // Returns a zeroed submission entry, or nullptr if the queue is full.
+        io_uring_sqe* get_sqe() {
+            unsigned head = load_acquire(sq_head);
+            if (sqe_tail - head >= sq_entries) return nullptr;
+
+            unsigned index = sqe_tail & sq_mask;
+            io_uring_sqe* sqe = &sqes[index];
+            std::memset(sqe, 0, sizeof(*sqe));
+            sq_array[index] = index;
+            sqe_tail++;
+            return sqe;
+        }
+
+        // Publishes queued entries and optionally waits for `wait_nr` completions.
+        int submit(unsigned wait_nr = 0) {
+            unsigned to_submit = sqe_tail - *sq_tail;
+            store_release(sq_tail, sqe_tail);
+
+            unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+            for (;;) {
+                int ret = static_cast<int>(syscall(__NR_io_uring_enter, ring_fd, to_submit,
+                                                   wait_nr, flags, nullptr, 0));
+                if (ret >= 0) return ret;
+                if (errno != EINTR) {
+                    throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+                }
+            }
+        }
+
+        io_uring_cqe* peek_cqe() {
+            unsigned head = *cq_head;
+            if (head == load_acquire(cq_tail)) return nullptr;
+            return &cqes[head & cq_mask];
+        }
+
+        void cqe_seen() {
+            store_release(cq_head, *cq_head + 1);
+        }
+
+        bool register_buffers(const iovec* iovs, unsigned count) {
+            return syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_BUFFERS, iovs, count) == 0;
+        }
+
+        void unregister_buffers() {
+            syscall(__NR_io_uring_register, ring_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+        }
+    };
+}
+
+#endif
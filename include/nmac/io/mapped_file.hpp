@@ -0,0 +1,65 @@
+#pragma once
+
+#include "nmac/io/file_batch.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cerrno>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+
+namespace nmac::io {
+    // Read-only memory map of a whole file. Large inputs can be tokenized and
+    // spliced in place without first copying them into a string.
+    class MappedFile {
+        void* base = nullptr;
+        size_t length = 0;
+
+        void release() {
+            if (base) ::munmap(base, length);
+            base = nullptr;
+            length = 0;
+        }
+
+    public:
+        MappedFile() = default;
+
+        explicit MappedFile(const std::string& path) {
+            int fd = detail::open_or_throw(path, O_RDONLY);
+            size_t size = detail::file_size(fd, path);
+            if (size > 0) {
+                void* p = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    int err = errno;
+                    ::close(fd);
+                    throw std::system_error(err, std::generic_category(), "Cannot map file: " + path);
+                }
+                ::madvise(p, size, MADV_SEQUENTIAL);
+                base = p;
+                length = size;
+            }
+            ::close(fd);
+        }
+
+        MappedFile(MappedFile&& other) noexcept
+            : base(std::exchange(other.base, nullptr)), length(std::exchange(other.length, 0)) {}
+
+        MappedFile& operator=(MappedFile&& other) noexcept {
+            if (this != &other) {
+                release();
+                base = std::exchange(other.base, nullptr);
+                length = std::exchange(other.length, 0);
+            }
+            return *this;
+        }
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        ~MappedFile() { release(); }
+
+        std::string_view view() const { return {static_cast<const char*>(base), length}; }
+        size_t size() const { return length; }
+    };
+}
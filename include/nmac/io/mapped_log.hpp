@@ -0,0 +1,171 @@
+#pragma once
+
+#include "nmac/io/file_batch.hpp"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <thread>
+
+namespace nmac::io {
+    // Append-only log written through shared memory maps. Output goes to
+    // fixed-size segment files <path>.0, <path>.1, ... that are sized up front
+    // and mapped writable. A writer claims its byte range with one fetch_add
+    // on the segment cursor and copies into the map. The kernel writes dirty
+    // pages back, so appending makes no system calls except when a segment
+    // fills. The writer whose record crosses the end of a segment opens the
+    // next segment. Once every write into the old segment has landed, that
+    // writer trims the old file to its used length. With `keep_segments` set,
+    // only that many of the newest segment files are kept; older ones are
+    // removed as the log rotates.
+    class MappedLog {
+        struct Segment {
+            size_t index = 0;
+            int fd = -1;
+            char* base = nullptr;
+            size_t size = 0;
+            std::atomic<size_t> cursor{0};    // Bytes claimed, may run past size
+            std::atomic<size_t> committed{0}; // Bytes copied in
+        };
+
+        std::string path;
+        size_t segment_bytes;
+        size_t keep_segments;
+
+        // Retired segments stay allocated (but unmapped) until the log is
+        // destroyed, since a writer may still be looking at one it loaded
+        // just before rotation; it finds the cursor past the end and retries.
+        std::deque<std::unique_ptr<Segment>> segments;
+        std::mutex segments_mutex;
+        std::atomic<Segment*> current{nullptr};
+        std::atomic<bool> broken{false}; // A rotation failed; appends can no longer proceed
+
+        Segment* open_segment(size_t index) {
+            auto segment = std::make_unique<Segment>();
+            segment->index = index;
+            segment->size = segment_bytes;
+            std::string file = segment_path(index);
+            segment->fd = detail::open_or_throw(file, O_RDWR | O_CREAT | O_TRUNC, 0644);
+            if (::ftruncate(segment->fd, static_cast<off_t>(segment_bytes)) != 0) {
+                int err = errno;
+                ::close(segment->fd);
+                throw std::system_error(err, std::generic_category(), "Cannot size log segment: " + file);
+            }
+            // Reserve the blocks now so a full disk fails here rather than as
+            // SIGBUS on a later store; not every filesystem supports it
+            ::posix_fallocate(segment->fd, 0, static_cast<off_t>(segment_bytes));
+
+            void* p = ::mmap(nullptr, segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+            if (p == MAP_FAILED) {
+                int err = errno;
+                ::close(segment->fd);
+                throw std::system_error(err, std::generic_category(), "Cannot map log segment: " + file);
+            }
+            segment->base = static_cast<char*>(p);
+
+            std::lock_guard lock(segments_mutex);
+            segments.push_back(std::move(segment));
+            return segments.back().get();
+        }
+
+        // Waits for in-flight writes below `used`, then unmaps the segment and
+        // cuts its file down to the bytes actually written
+        void retire(Segment* segment, size_t used) {
+            while (segment->committed.load(std::memory_order_acquire) < used) std::this_thread::yield();
+            {
+                std::lock_guard lock(segments_mutex);
+                ::munmap(segment->base, segment->size);
+                segment->base = nullptr;
+            }
+            [[maybe_unused]] int ignored = ::ftruncate(segment->fd, static_cast<off_t>(used));
+            ::close(segment->fd);
+            segment->fd = -1;
+        }
+
+        void rotate(Segment* full, size_t used) {
+            Segment* next;
+            try {
+                next = open_segment(full->index + 1);
+            } catch (...) {
+                broken.store(true, std::memory_order_release);
+                throw;
+            }
+            current.store(next, std::memory_order_release);
+            retire(full, used);
+            if (keep_segments && next->index >= keep_segments) {
+                ::unlink(segment_path(next->index - keep_segments).c_str());
+            }
+        }
+
+    public:
+        static constexpr size_t default_segment_bytes = 64 << 20;
+
+        explicit MappedLog(std::string base_path, size_t segment_size = default_segment_bytes, size_t keep = 0)
+            : path(std::move(base_path)), segment_bytes(segment_size), keep_segments(keep) {
+            if (segment_bytes == 0) throw std::invalid_argument("MappedLog segment size must be positive");
+            current.store(open_segment(0), std::memory_order_release);
+        }
+
+        MappedLog(const MappedLog&) = delete;
+        MappedLog& operator=(const MappedLog&) = delete;
+
+        // Not safe against concurrent appends
+        ~MappedLog() {
+            Segment* last = current.load(std::memory_order_acquire);
+            retire(last, std::min(last->cursor.load(std::memory_order_relaxed), last->size));
+        }
+
+        std::string segment_path(size_t index) const { return path + "." + std::to_string(index); }
+
+        size_t segment_size() const { return segment_bytes; }
+
+        // Index of the segment being written
+        size_t segment_index() const { return current.load(std::memory_order_acquire)->index; }
+
+        // Safe to call from any number of threads. A record is never split
+        // across segments; records larger than a segment are rejected.
+        void append(std::string_view record) {
+            if (record.size() > segment_bytes) {
+                throw std::length_error("Log record is larger than a MappedLog segment");
+            }
+            for (;;) {
+                Segment* segment = current.load(std::memory_order_acquire);
+                size_t at = segment->cursor.fetch_add(record.size(), std::memory_order_relaxed);
+                if (at + record.size() <= segment->size) {
+                    std::memcpy(segment->base + at, record.data(), record.size());
+                    segment->committed.fetch_add(record.size(), std::memory_order_release);
+                    return;
+                }
+                if (at <= segment->size) {
+                    // This record crossed the end, so exactly this writer rotates
+                    rotate(segment, at);
+                } else {
+                    while (current.load(std::memory_order_acquire) == segment) {
+                        if (broken.load(std::memory_order_acquire)) {
+                            throw std::runtime_error("Cannot append to MappedLog: opening the next segment failed");
+                        }
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        }
+
+        // Asks the kernel to start writeback of what has been written so far
+        void flush() {
+            Segment* segment = current.load(std::memory_order_acquire);
+            std::lock_guard lock(segments_mutex);
+            size_t used = std::min(segment->cursor.load(std::memory_order_relaxed), segment->size);
+            if (segment->base && used) ::msync(segment->base, used, MS_ASYNC);
+        }
+    };
+}
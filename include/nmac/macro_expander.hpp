@@ -1,8 +1,18 @@
 #pragma once
 
 #include "nmac.hpp"
+#include "nmac/ct_pattern.hpp"
+#include "nmac/rule_stats.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
 #include <optional>
 #include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace nmac {
     namespace macro{
@@ -10,39 +20,225 @@ namespace nmac {
        class Expander {
             static constexpr size_t rule_count = sizeof...(Rules);
 
-            template <size_t I, typename Input>
-            static auto try_match_rule(const Input& input) {
-                if constexpr (I >= rule_count) {
-                    throw std::runtime_error("No matching macro rule found");
+            // All rules must produce the same type; the first rule's generator defines it
+            template <typename Input>
+            using result_type = decltype(std::tuple_element_t<0, std::tuple<Rules...>>::generator::expand(
+                std::declval<const Input&>(),
+                std::declval<PatternMatcher<Input>&>().get_captures()));
+
+            static RuleStats& stats() {
+                static RuleStats registry(std::vector<std::string>{std::string(Rules::pattern.view())...});
+                return registry;
+            }
+
+            static auto timer(size_t rule) {
+                if constexpr (rule_stats_enabled) {
+                    thread_local auto shard = stats().attach();
+                    return detail::RuleTimer<>((*shard)[rule]);
+                } else {
+                    return detail::RuleTimer<>();
                 }
-                else {
-                    using Rule = std::tuple_element_t<I, std::tuple<Rules...>>;
+            }
 
-                    auto pattern = Rule::parse_pattern();
+            static constexpr size_t no_node = static_cast<size_t>(-1);
 
-                    PatternMatcher matcher(pattern, input);
-                    if (matcher.match()) {
-                        return Rule::generator::expand(input, matcher.get_captures());
-                    } else {
-                        return try_match_rule<I + 1>(input);
+            // All rules as one prefix tree over the literals their patterns
+            // start with. Rules with the same leading literals share the path
+            // for them, so dispatch matches those tokens once and branches at
+            // the first literal where the rules differ. Each rule is listed at
+            // the node where its literals end, and its match resumes there.
+            struct PrefixTree {
+                struct Edge {
+                    std::string text;
+                    uint32_t symbol; // Of a `name!` literal, to compare MACRO_BANG tokens by
+                    size_t node;
+                };
+
+                struct Node {
+                    std::vector<Edge> edges;
+                    std::vector<size_t> rules;
+                };
+
+                std::vector<Node> nodes = std::vector<Node>(1);
+                std::array<size_t, rule_count> depth{};
+            };
+
+            // The leading literals of rule I, exactly as attempt() skips them
+            template<size_t I>
+            static std::vector<std::string> literal_prefix() {
+                using Rule = std::tuple_element_t<I, std::tuple<Rules...>>;
+                if constexpr (ct::compiles<Rule::pattern>) {
+                    const auto& texts = ct::literal_prefix<Rule::pattern>;
+                    return std::vector<std::string>(texts.begin(), texts.end());
+                } else {
+                    std::vector<std::string> texts;
+                    PatternNode pattern = Rule::parse_pattern();
+                    if (pattern.type == PatternNode::SEQUENCE) {
+                        for (const auto& child : pattern.children) {
+                            if (child.type != PatternNode::LITERAL && child.type != PatternNode::OPERATOR) break;
+                            texts.push_back(child.content);
+                        }
+                    }
+                    return texts;
+                }
+            }
+
+            static const PrefixTree& prefix_tree() {
+                static const PrefixTree tree = [] {
+                    PrefixTree t;
+                    auto add = [&](size_t rule, std::vector<std::string> texts) {
+                        size_t node = 0;
+                        for (auto& text : texts) {
+                            auto& edges = t.nodes[node].edges;
+                            auto it = std::ranges::find(edges, text, &PrefixTree::Edge::text);
+                            if (it != edges.end()) {
+                                node = it->node;
+                                continue;
+                            }
+                            std::string_view view = text;
+                            uint32_t symbol = view.size() > 1 && view.ends_with('!')
+                                                  ? intern_symbol(view.substr(0, view.size() - 1))
+                                                  : no_symbol;
+                            size_t child = t.nodes.size();
+                            edges.push_back({text, symbol, child});
+                            t.nodes.emplace_back();
+                            node = child;
+                        }
+                        t.nodes[node].rules.push_back(rule);
+                        t.depth[rule] = texts.size();
+                    };
+                    [&]<size_t... I>(std::index_sequence<I...>) {
+                        (add(I, literal_prefix<I>()), ...);
+                    }(std::make_index_sequence<rule_count>{});
+                    return t;
+                }();
+                return tree;
+            }
+
+            template<typename Token>
+            static bool edge_matches(const typename PrefixTree::Edge& edge, const Token& token) {
+                if constexpr (requires { token.symbol; }) {
+                    if (token.symbol != no_symbol) return token.symbol == edge.symbol;
+                }
+                return ct::detail::token_text(token) == edge.text;
+            }
+
+            // Walks `input` down the prefix tree, marking every rule whose
+            // leading literals all match; no other rule can match the input
+            template<typename Input>
+            static std::array<bool, rule_count> candidates(const Input& input) {
+                const PrefixTree& tree = prefix_tree();
+                std::array<bool, rule_count> marked{};
+                size_t node = 0;
+                for (size_t pos = 0;; ++pos) {
+                    for (size_t rule : tree.nodes[node].rules) marked[rule] = true;
+                    if (pos >= input.size()) break;
+                    const auto& token = input[pos];
+                    size_t next = no_node;
+                    for (const auto& edge : tree.nodes[node].edges) {
+                        if (edge_matches(edge, token)) {
+                            next = edge.node;
+                            break;
+                        }
                     }
+                    if (next == no_node) break;
+                    node = next;
+                }
+                return marked;
+            }
+
+            // Matches and expands rule I; `result` is left empty on no match.
+            // With Resume the rule's leading literals are taken as matched.
+            template<size_t I, bool Resume, typename Input, typename Result>
+            static bool attempt(const Input& input, std::optional<Result>& result) {
+                using Rule = std::tuple_element_t<I, std::tuple<Rules...>>;
+
+                auto timer = Expander::timer(I);
+                // Patterns that parse cleanly run as compiled matchers; the
+                // rest keep the interpreter and its error recovery
+                if constexpr (ct::compiles<Rule::pattern>) {
+                    constexpr size_t skip = Resume ? ct::literal_prefix<Rule::pattern>.size() : 0;
+                    typename Rule::template compiled_matcher<Input> matcher(input);
+                    bool matched = matcher.template match_after<skip>(skip);
+                    return finish<Rule>(input, matcher, matched, timer, result);
+                } else {
+                    size_t skip = Resume ? prefix_tree().depth[I] : 0;
+                    auto pattern = Rule::parse_pattern();
+                    PatternMatcher matcher(pattern, input);
+                    bool matched = matcher.match_after(skip, skip);
+                    return finish<Rule>(input, matcher, matched, timer, result);
+                }
+            }
+
+            template<typename Rule, typename Input, typename Matcher, typename Timer, typename Result>
+            static bool finish(const Input& input, Matcher& matcher, bool matched, Timer& timer,
+                               std::optional<Result>& result) {
+                timer.matched();
+                if (!matched) return false;
+
+                NMAC_TRACE_SCOPE("generate");
+                result.emplace(Rule::generator::expand(input, matcher.get_captures()));
+                timer.expanded();
+                return true;
+            }
+
+            template<typename Input>
+            static result_type<Input> dispatch(const Input& input) {
+                using Result = result_type<Input>;
+                using Attempt = bool (*)(const Input&, std::optional<Result>&);
+                static constexpr auto attempts = []<size_t... I>(std::index_sequence<I...>) {
+                    return std::array<Attempt, sizeof...(I)>{&attempt<I, true, Input, Result>...};
+                }(std::make_index_sequence<rule_count>{});
+
+                auto marked = candidates(input);
+                std::optional<Result> result;
+                for (size_t rule = 0; rule < rule_count; ++rule) {
+                    if (marked[rule] && attempts[rule](input, result)) return std::move(*result);
                 }
+                throw std::runtime_error("No matching macro rule found");
             }
         public:
+            static constexpr size_t size() { return rule_count; }
+
+            // Match and expansion latency of each rule across all threads so far.
+            // Counts stay zero unless NMAC_RULE_STATS is defined to 1.
+            static RuleStatsSnapshot rule_stats() { return stats().snapshot(); }
+            static void reset_rule_stats() { stats().reset(); }
+
+            // Indices of the rules whose leading literals match the start of
+            // `input`, in rule order. Only these are attempted.
             template<typename Input>
-            static auto expand(const Input& input) {
-                try {
-                    return try_match_rule<0>(input);
-                } catch (const std::exception& e) {
-                    // TODO: Handle errors more gracefully
-                    throw;
+            static std::vector<size_t> candidate_rules(const Input& input) {
+                auto marked = candidates(input);
+                std::vector<size_t> rules;
+                for (size_t rule = 0; rule < rule_count; ++rule) {
+                    if (marked[rule]) rules.push_back(rule);
                 }
+                return rules;
+            }
+
+            // Attempts rule I on its own, leaving `result` empty if it does not match.
+            // Lets callers interleave rule attempts with other work (see async_expand).
+            template<size_t I, typename Input, typename Result>
+            static bool try_rule(const Input& input, std::optional<Result>& result) {
+                NMAC_TRACE_SCOPE("rule dispatch");
+                NMAC_ALLOC_SCOPE(expand);
+                return attempt<I, false>(input, result);
+            }
+
+            template<typename Input>
+            static auto expand(const Input& input) {
+                NMAC_TRACE_SCOPE("rule dispatch");
+                NMAC_ALLOC_SCOPE(expand);
+                return dispatch(input);
             }
 
             template<typename Input>
-            static auto try_expand(const Input& input) -> std::optional<decltype(try_match_rule<0>(std::declval<Input>()))> {
+            static auto try_expand(const Input& input) -> std::optional<result_type<Input>> {
+                NMAC_TRACE_SCOPE("rule dispatch");
+                NMAC_ALLOC_SCOPE(expand);
                 try {
-                    return try_match_rule<0>(input);
+                    return dispatch(input);
                 } catch (const std::exception& e) {
                     return std::nullopt;
                 }
@@ -1,5 +1,8 @@
 #ifndef NMAC_LIBRARY_H
 #define NMAC_LIBRARY_H
+#include "nmac/alloc_stats.hpp"
+#include "nmac/symbols.hpp"
+#include "nmac/trace.hpp"
 #include <algorithm>
 #include <type_traits>
 #include <string_view>
@@ -7,6 +10,7 @@
 #include <utility>
 #include <vector>
 #include <functional>
+#include <iterator>
 #include <concepts>
 #include <any>
 #include <iostream>
@@ -49,23 +53,29 @@ namespace nmac {
         t.match();
     };
 
-    enum TokenType { IDENT, LITERAL, PUNCT, KEYWORD, LPAREN, RPAREN, LBRACE, RBRACE, COMMA, SEMICOLON };
+    // MACRO_BANG is a `name!` invocation head scanned as one token; its
+    // symbol is the interned `name`
+    enum TokenType { IDENT, LITERAL, PUNCT, KEYWORD, LPAREN, RPAREN, LBRACE, RBRACE, COMMA, SEMICOLON, MACRO_BANG };
     struct Token {
         TokenType type;
+        uint32_t symbol; // no_symbol unless type is MACRO_BANG
         size_t position;
         std::string_view content;
 
-        constexpr Token(TokenType t, std::string_view c, size_t pos = 0)
-            : type(t), position(pos), content(c) {}
+        constexpr Token(TokenType t, std::string_view c, size_t pos = 0, uint32_t sym = no_symbol)
+            : type(t), symbol(sym), position(pos), content(c) {}
     };
 
     // Pattern AST nodes
     struct PatternNode {
-        enum Type { LITERAL, VARIABLE, SEQUENCE, OPTIONAL, REPETITION, OPERATOR };
+        // ALTERNATION tries its children (all SEQUENCEs) in order and takes
+        // the first that matches
+        enum Type { LITERAL, VARIABLE, SEQUENCE, OPTIONAL, REPETITION, OPERATOR, ALTERNATION };
         Type type;
         std::string content; // For literals and variables
-        std::vector<PatternNode> children; // For sequences, optional, and repetitions
+        std::vector<PatternNode> children; // For sequences, optional, repetitions and alternations
         size_t source_position; // For error reporting
+        uint32_t symbol = no_symbol; // Interned name of a `name!` literal
 
         PatternNode(Type t, std::string_view c = "", size_t pos = 0)
             : type(t), content(std::move(c)), source_position(pos) {}
@@ -110,8 +120,9 @@ namespace nmac {
         constexpr PatternParser(std::string_view p) : pattern(p) {}
 
         PatternNode parse() {
+            NMAC_ALLOC_SCOPE(parse);
             skip_whitespace();
-            auto result = parse_sequence();
+            auto result = parse_alternation();
 
             skip_whitespace();
             if (pos < pattern.size()) {
@@ -125,10 +136,77 @@ namespace nmac {
         size_t get_error_position() const { return error_position; }
 
     private:
+        // `a | b | c`. Adjacent alternatives that start with the same literal
+        // are merged into a trie, so `x y | x z` parses as `x ( y | z )` and the
+        // shared prefix is matched once. A lone alternative is just its sequence.
+        PatternNode parse_alternation() {
+            size_t start = pos;
+            std::vector<PatternNode> branches;
+            branches.push_back(parse_sequence());
+            while (peek() == '|') {
+                advance();
+                branches.push_back(parse_sequence());
+            }
+            if (branches.size() > 1) branches = factor_prefixes(std::move(branches));
+            if (branches.size() == 1) return std::move(branches[0]);
+
+            PatternNode alternation(PatternNode::ALTERNATION, "", start);
+            alternation.children = std::move(branches);
+            return alternation;
+        }
+
+        static bool same_literal(const PatternNode& a, const PatternNode& b) {
+            return (a.type == PatternNode::LITERAL || a.type == PatternNode::OPERATOR) &&
+                   a.type == b.type && a.content == b.content;
+        }
+
+        // Only neighbours are merged: alternatives are tried in order, and
+        // pulling a later one forward past a different one would change which
+        // of them wins.
+        static std::vector<PatternNode> factor_prefixes(std::vector<PatternNode> branches) {
+            std::vector<PatternNode> out;
+            for (size_t i = 0; i < branches.size();) {
+                size_t j = i + 1;
+                if (!branches[i].children.empty()) {
+                    while (j < branches.size() && !branches[j].children.empty() &&
+                           same_literal(branches[j].children[0], branches[i].children[0])) {
+                        j++;
+                    }
+                }
+                if (j - i == 1) {
+                    out.push_back(std::move(branches[i++]));
+                    continue;
+                }
+
+                PatternNode merged(PatternNode::SEQUENCE, "", branches[i].source_position);
+                merged.children.push_back(std::move(branches[i].children[0]));
+                std::vector<PatternNode> tails;
+                for (size_t k = i; k < j; ++k) {
+                    auto& children = branches[k].children;
+                    PatternNode tail(PatternNode::SEQUENCE, "", branches[k].source_position);
+                    tail.children.assign(std::make_move_iterator(children.begin() + 1),
+                                         std::make_move_iterator(children.end()));
+                    tails.push_back(std::move(tail));
+                }
+
+                auto rest = factor_prefixes(std::move(tails));
+                if (rest.size() == 1) {
+                    for (auto& child : rest[0].children) merged.children.push_back(std::move(child));
+                } else {
+                    PatternNode alternation(PatternNode::ALTERNATION, "", rest[0].source_position);
+                    alternation.children = std::move(rest);
+                    merged.children.push_back(std::move(alternation));
+                }
+                out.push_back(std::move(merged));
+                i = j;
+            }
+            return out;
+        }
+
         PatternNode parse_sequence() {
             PatternNode seq(PatternNode::SEQUENCE, "", pos);
 
-            while (pos < pattern.size() && peek() != ')' && peek() != '}' && peek() != ']') {
+            while (pos < pattern.size() && peek() != ')' && peek() != '}' && peek() != ']' && peek() != '|') {
                 skip_whitespace();
                 if (pos >= pattern.size()) break;
 
@@ -170,7 +248,7 @@ namespace nmac {
                     // Group
                     size_t group_pos = pos;
                     advance();
-                    PatternNode group = parse_sequence();
+                    PatternNode group = parse_alternation();
                     group.source_position = group_pos;
                     if (peek() == ')') advance();
                     else set_error("Unclosed group: missing ')'");
@@ -180,7 +258,7 @@ namespace nmac {
                     size_t opt_pos = pos;
                     advance();
                     PatternNode opt(PatternNode::OPTIONAL, "", opt_pos);
-                    opt.children.push_back(parse_sequence());
+                    opt.children.push_back(parse_alternation());
                     if (peek() == ']') advance();
                     else set_error("Unclosed optional group: missing ']'");
                     seq.children.push_back(std::move(opt));
@@ -231,20 +309,30 @@ namespace nmac {
             while (pos < pattern.size() && !std::isspace(peek()) &&
                    peek() != '$' && peek() != '(' && peek() != ')' &&
                    peek() != '[' && peek() != ']' && peek() != '\\' &&
-                   !is_operator(peek()) && peek() != '?' && peek() != ',') {
+                   !is_operator(peek()) && peek() != '?' && peek() != ',' && peek() != '|') {
                 advance();
                    }
 
-            return PatternNode(PatternNode::LITERAL, std::string(pattern.substr(start, pos - start)), start);
+            std::string_view text = pattern.substr(start, pos - start);
+            PatternNode lit(PatternNode::LITERAL, std::string(text), start);
+            if (text.size() > 1 && text.ends_with('!')) lit.symbol = intern_symbol(text.substr(0, text.size() - 1));
+            return lit;
         }
     };
 
 
     template<typename Input>
     class PatternMatcher {
+        using Capture = std::pair<std::string_view, typename Input::value_type>;
+
         const PatternNode& pattern;
         const Input& input;
-        std::vector<std::pair<std::string_view, typename Input::value_type>> captures;
+        // Captures recorded so far, in match order. Only the first `log_size`
+        // entries are live: a failed branch rolls back to its savepoint by
+        // lowering log_size, and later captures reuse the slots past it.
+        std::vector<Capture> log;
+        size_t log_size = 0;
+        std::vector<Capture> captures; // Taken from the log once a match succeeds
         std::string error_message;
         size_t error_position = 0;
 
@@ -252,10 +340,37 @@ namespace nmac {
         PatternMatcher(const PatternNode& p, const Input& i) : pattern(p), input(i) {}
 
         bool match() {
+            NMAC_TRACE_SCOPE("match");
+            NMAC_ALLOC_SCOPE(match);
             size_t input_pos = 0;
-            return match_node(pattern, input_pos);
+            log_size = 0;
+            captures.clear();
+            if (!match_node(pattern, input_pos)) return false;
+            materialize_captures();
+            return true;
+        }
+
+        // match() for when the first `skip` children of the root sequence,
+        // all literals, are already known to match tokens [0, input_pos).
+        // Lets a caller match a prefix shared by several patterns only once.
+        bool match_after(size_t skip, size_t input_pos) {
+            NMAC_TRACE_SCOPE("match");
+            NMAC_ALLOC_SCOPE(match);
+            log_size = 0;
+            captures.clear();
+            if (pattern.type != PatternNode::SEQUENCE) {
+                if (skip != 0 || !match_node(pattern, input_pos)) return false;
+            } else {
+                for (size_t i = skip; i < pattern.children.size(); ++i) {
+                    if (!match_node(pattern.children[i], input_pos)) return false;
+                }
+            }
+            materialize_captures();
+            return true;
         }
 
+        // Captures of the last successful match(), excluding any recorded by
+        // branches that were backtracked over
         const auto& get_captures() const {
             return captures;
         }
@@ -270,6 +385,21 @@ namespace nmac {
             error_position = pos;
         }
 
+        size_t savepoint() const { return log_size; }
+        void rollback(size_t mark) { log_size = mark; }
+
+        void record(std::string_view name, const typename Input::value_type& value) {
+            if (log_size < log.size()) log[log_size] = Capture(name, value);
+            else log.emplace_back(name, value);
+            log_size++;
+        }
+
+        void materialize_captures() {
+            log.erase(log.begin() + static_cast<std::ptrdiff_t>(log_size), log.end());
+            captures = std::move(log);
+            log.clear();
+        }
+
         bool match_node(const PatternNode& node, size_t& input_pos) {
             switch (node.type) {
             case PatternNode::LITERAL:
@@ -284,6 +414,8 @@ namespace nmac {
                 return match_repetition(node, input_pos);
             case PatternNode::OPERATOR:
                 return match_operator(node, input_pos);
+            case PatternNode::ALTERNATION:
+                return match_alternation(node, input_pos);
             default:
                 set_error("Unknown node type", node.source_position);
                 return false;
@@ -299,6 +431,15 @@ namespace nmac {
                 return false;
             }
 
+            // A macro-bang token matches a `name!` literal by symbol alone
+            if constexpr (requires { input[input_pos].symbol; }) {
+                uint32_t symbol = input[input_pos].symbol;
+                if (symbol != no_symbol && symbol == node.symbol) {
+                    input_pos++;
+                    return true;
+                }
+            }
+
             auto token_content = get_token_content(input[input_pos]);
             if (token_content == node.content) {
                 input_pos++;
@@ -317,16 +458,18 @@ namespace nmac {
                 return false;
             }
 
-            captures.emplace_back(node.content, input[input_pos]);
+            record(node.content, input[input_pos]);
             input_pos++;
             return true;
         }
 
         bool match_sequence(const PatternNode& node, size_t& input_pos) {
             size_t saved_pos = input_pos;
+            size_t mark = savepoint();
             for (const auto& child : node.children) {
                 if (!match_node(child, input_pos)) {
                     input_pos = saved_pos;
+                    rollback(mark);
                     // Error is already set by the child match
                     return false;
                 }
@@ -336,9 +479,11 @@ namespace nmac {
 
         bool match_optional(const PatternNode& node, size_t& input_pos) {
             size_t saved_pos = input_pos;
+            size_t mark = savepoint();
             for (const auto& child : node.children) {
                 if (!match_node(child, input_pos)) {
                     input_pos = saved_pos;
+                    rollback(mark);
                     error_message.clear(); // Clear error since optional matching is allowed to fail
                     break;
                 }
@@ -360,10 +505,12 @@ namespace nmac {
 
             while (input_pos < input.size()) {
                 size_t before_match = input_pos;
+                size_t mark = savepoint();
                 std::string saved_error = error_message;
 
                 if (!match_node(child, input_pos)) {
                     input_pos = before_match;
+                    rollback(mark);
                     error_message = saved_error; // Restore error state
                     break;
                 }
@@ -391,6 +538,15 @@ namespace nmac {
             }
         }
 
+        bool match_alternation(const PatternNode& node, size_t& input_pos) {
+            for (const auto& child : node.children) {
+                // A failed alternative restores the position and captures itself
+                if (match_node(child, input_pos)) return true;
+            }
+            set_error("No alternative matched", node.source_position);
+            return false;
+        }
+
         bool match_operator(const PatternNode& node, size_t& input_pos) {
             if (input_pos >= input.size()) {
                 set_error("Unexpected end of input while matching operator", node.source_position);
@@ -434,11 +590,14 @@ namespace nmac {
         MatchResult match_with_diagnostics() {
             size_t input_pos = 0;
             MatchResult result;
+            log_size = 0;
+            captures.clear();
             result.success = match_node(pattern, input_pos);
             if (!result.success) {
                 result.error_position = input_pos;
                 result.error_message = "Failed to match pattern at position " + std::to_string(input_pos);
             } else {
+                materialize_captures();
                 result.captures = captures;
             }
             return result;
@@ -478,6 +637,11 @@ namespace nmac {
 
 
 
+    namespace ct {
+        template<ct_string Pattern, typename Input>
+        class Matcher;
+    }
+
     template<ct_string Pattern, typename Generator>
     requires MacroGeneratorType<Generator>
     struct MacroRule {
@@ -488,6 +652,10 @@ namespace nmac {
             PatternParser parser(pattern.view());
             return parser.parse();
         }
+
+        // The pattern compiled into matcher code (see nmac/ct_pattern.hpp)
+        template<typename Input>
+        using compiled_matcher = ct::Matcher<Pattern, Input>;
     };
 
     // Safe macro expansion context
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "nmac/executor.hpp"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace nmac {
+    // Restores sequence order for results produced out of order. Results are
+    // held only until their predecessors arrive, then handed to the sink in
+    // order, one at a time. Producers that call wait_for_slot() first are held
+    // back while they are `window` or more sequence numbers ahead of the sink,
+    // which bounds memory.
+    template<typename T>
+    class ReorderBuffer {
+        std::mutex mutex;
+        std::condition_variable space;
+        std::deque<std::optional<T>> pending; // pending[i] holds sequence number next + i
+        std::function<void(T&&)> sink;
+        size_t window;
+        size_t next = 0;     // Sequence number of pending.front()
+        size_t finished = 0; // Results the sink has returned from
+        bool emitting = false;
+        bool aborted = false;
+
+    public:
+        ReorderBuffer(size_t window_size, std::function<void(T&&)> consumer)
+            : sink(std::move(consumer)), window(std::max<size_t>(window_size, 1)) {}
+
+        // Blocks until `seq` is inside the window; false if the buffer was aborted
+        bool wait_for_slot(size_t seq) {
+            std::unique_lock lock(mutex);
+            space.wait(lock, [&] { return aborted || seq < finished + window; });
+            return !aborted;
+        }
+
+        // Stores a result. Whichever thread completes the head of the sequence
+        // emits it and every consecutive successor that is already available.
+        void push(size_t seq, T value) {
+            std::unique_lock lock(mutex);
+            if (aborted) return;
+
+            // A sequence number is pushed once; anything at or behind the
+            // sink, or already pending, is a caller bug
+            if (seq < next) throw std::logic_error("ReorderBuffer: sequence number already emitted");
+            size_t offset = seq - next;
+            if (pending.size() <= offset) pending.resize(offset + 1);
+            if (pending[offset]) throw std::logic_error("ReorderBuffer: sequence number pushed twice");
+            pending[offset].emplace(std::move(value));
+
+            if (emitting) return; // The active emitter will pick it up
+            emitting = true;
+
+            try {
+                while (!pending.empty() && pending.front().has_value()) {
+                    T item = std::move(*pending.front());
+                    pending.pop_front();
+                    next++;
+                    lock.unlock();
+                    sink(std::move(item));
+                    lock.lock();
+                    finished++;
+                    space.notify_all();
+                }
+            } catch (...) {
+                if (!lock.owns_lock()) lock.lock();
+                emitting = false;
+                aborted = true;
+                space.notify_all();
+                throw;
+            }
+            emitting = false;
+        }
+
+        // Releases blocked producers; later results are dropped
+        void abort() {
+            std::lock_guard lock(mutex);
+            aborted = true;
+            space.notify_all();
+        }
+
+        // Number of results handed to the sink so far
+        size_t emitted() {
+            std::lock_guard lock(mutex);
+            return finished;
+        }
+    };
+
+    // Produces `count` results on the pool and consumes them strictly in index
+    // order, keeping at most `window` results buffered. Indices are claimed in
+    // increasing order, so the head of the sequence is always being produced
+    // and a producer held back by the window cannot deadlock the others.
+    template<typename Produce, typename Consume>
+    void ordered_parallel(executor& pool, size_t count, size_t window, Produce&& produce, Consume&& consume) {
+        using Result = std::decay_t<decltype(produce(size_t{}))>;
+
+        ReorderBuffer<Result> buffer(window, [&](Result&& r) { consume(std::move(r)); });
+        std::atomic<size_t> next_index{0};
+
+        auto drain = [&] {
+            try {
+                for (;;) {
+                    size_t i = next_index.fetch_add(1);
+                    if (i >= count || !buffer.wait_for_slot(i)) return;
+                    buffer.push(i, produce(i));
+                }
+            } catch (...) {
+                buffer.abort();
+                throw;
+            }
+        };
+
+        task_group group(pool);
+        size_t helpers = std::min(pool.concurrency(), count);
+        for (size_t w = 1; w < helpers; ++w) group.spawn(drain);
+
+        std::exception_ptr failure;
+        try {
+            drain();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        try {
+            group.sync();
+        } catch (...) {
+            if (!failure) failure = std::current_exception();
+        }
+        if (failure) std::rethrow_exception(failure);
+    }
+}
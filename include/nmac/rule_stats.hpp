@@ -0,0 +1,273 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Per-rule latency histograms for macro::Expander. Recording is compiled in
+// only when NMAC_RULE_STATS is defined to 1; otherwise the timers are empty
+// and snapshots come back with zero counts.
+#ifndef NMAC_RULE_STATS
+#define NMAC_RULE_STATS 0
+#endif
+
+namespace nmac {
+    inline constexpr bool rule_stats_enabled = NMAC_RULE_STATS;
+
+    // Log-linear buckets in the style of HdrHistogram: values below 2^sub_bits
+    // nanoseconds get a bucket each, and every further power of two is split
+    // into 2^sub_bits buckets, so any recorded value is known to within ~3%.
+    namespace histogram_layout {
+        inline constexpr unsigned sub_bits = 5;
+        inline constexpr uint64_t sub_count = uint64_t{1} << sub_bits;
+        inline constexpr unsigned max_exponent = 40;  // About 18 minutes in ns; larger values clamp
+        inline constexpr size_t bucket_count = (max_exponent - sub_bits + 1) * sub_count;
+
+        constexpr size_t bucket_of(uint64_t ns) {
+            if (ns < sub_count) return static_cast<size_t>(ns);
+            unsigned exponent = std::min<unsigned>(static_cast<unsigned>(std::bit_width(ns)) - 1, max_exponent);
+            if (exponent == max_exponent) return bucket_count - 1;
+            unsigned shift = exponent - sub_bits;
+            return (shift + 1) * sub_count + ((ns >> shift) - sub_count);
+        }
+
+        // Smallest and largest values that land in `bucket`
+        constexpr uint64_t lowest(size_t bucket) {
+            if (bucket < sub_count) return bucket;
+            uint64_t shift = bucket / sub_count - 1;
+            return (sub_count + bucket % sub_count) << shift;
+        }
+
+        constexpr uint64_t highest(size_t bucket) {
+            if (bucket < sub_count) return bucket;
+            uint64_t shift = bucket / sub_count - 1;
+            return lowest(bucket) + (uint64_t{1} << shift) - 1;
+        }
+    }
+
+    // A merged, read-only latency distribution
+    class LatencyHistogram {
+        std::vector<uint64_t> buckets = std::vector<uint64_t>(histogram_layout::bucket_count);
+        uint64_t samples = 0;
+        uint64_t total = 0;
+        uint64_t largest = 0;
+
+    public:
+        void add(size_t bucket, uint64_t count) {
+            buckets[bucket] += count;
+            samples += count;
+        }
+
+        void add_totals(uint64_t sum, uint64_t max) {
+            total += sum;
+            largest = std::max(largest, max);
+        }
+
+        uint64_t count() const { return samples; }
+        uint64_t max() const { return largest; }
+        double mean() const { return samples ? static_cast<double>(total) / static_cast<double>(samples) : 0.0; }
+
+        // Upper bound of the bucket holding the `p`-th percentile (0-100), in ns
+        uint64_t percentile(double p) const {
+            if (samples == 0) return 0;
+            auto rank = static_cast<uint64_t>(p / 100.0 * static_cast<double>(samples) + 0.5);
+            rank = std::clamp<uint64_t>(rank, 1, samples);
+            uint64_t seen = 0;
+            for (size_t b = 0; b < buckets.size(); ++b) {
+                seen += buckets[b];
+                if (seen >= rank) return std::min(histogram_layout::highest(b), largest);
+            }
+            return largest;
+        }
+    };
+
+    namespace detail {
+        // One thread's histogram. Only the owning thread writes, so counters are
+        // bumped with a relaxed load and store rather than a locked add; readers
+        // merging a snapshot may see a slightly stale count.
+        class ShardHistogram {
+            std::array<std::atomic<uint64_t>, histogram_layout::bucket_count> buckets{};
+            std::atomic<uint64_t> total{0};
+            std::atomic<uint64_t> largest{0};
+
+            static void bump(std::atomic<uint64_t>& counter, uint64_t by) {
+                counter.store(counter.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+            }
+
+        public:
+            void record(uint64_t ns) {
+                bump(buckets[histogram_layout::bucket_of(ns)], 1);
+                bump(total, ns);
+                if (ns > largest.load(std::memory_order_relaxed)) largest.store(ns, std::memory_order_relaxed);
+            }
+
+            void merge_into(LatencyHistogram& out) const {
+                for (size_t b = 0; b < buckets.size(); ++b) {
+                    uint64_t n = buckets[b].load(std::memory_order_relaxed);
+                    if (n) out.add(b, n);
+                }
+                out.add_totals(total.load(std::memory_order_relaxed), largest.load(std::memory_order_relaxed));
+            }
+
+            void clear() {
+                for (auto& bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+                total.store(0, std::memory_order_relaxed);
+                largest.store(0, std::memory_order_relaxed);
+            }
+        };
+
+        struct RuleShard {
+            ShardHistogram match;
+            ShardHistogram expand;
+        };
+    }
+
+    struct RuleLatency {
+        std::string pattern;
+        LatencyHistogram match;   // Every attempt, successful or not
+        LatencyHistogram expand;  // Generator time for attempts that matched
+    };
+
+    // Merged view of every thread's histograms at one point in time
+    struct RuleStatsSnapshot {
+        std::vector<RuleLatency> rules;
+
+        void write_text(std::ostream& out) const {
+            char line[160];
+            std::snprintf(line, sizeof line, "%-7s %10s %10s %10s %10s %10s %10s %10s  %s\n",
+                          "phase", "count", "mean ns", "p50", "p90", "p99", "p99.9", "max", "rule");
+            out << line;
+            for (const auto& rule : rules) {
+                for (auto [phase, h] : {std::pair{"match", &rule.match}, std::pair{"expand", &rule.expand}}) {
+                    std::snprintf(line, sizeof line, "%-7s %10llu %10.0f %10llu %10llu %10llu %10llu %10llu  ",
+                                  phase, static_cast<unsigned long long>(h->count()), h->mean(),
+                                  static_cast<unsigned long long>(h->percentile(50)),
+                                  static_cast<unsigned long long>(h->percentile(90)),
+                                  static_cast<unsigned long long>(h->percentile(99)),
+                                  static_cast<unsigned long long>(h->percentile(99.9)),
+                                  static_cast<unsigned long long>(h->max()));
+                    out << line << rule.pattern << '\n';
+                }
+            }
+        }
+
+        void write_json(std::ostream& out) const {
+            auto quoted = [&](std::string_view s) {
+                out << '"';
+                for (char c : s) {
+                    if (c == '"' || c == '\\') {
+                        out << '\\' << c;
+                    } else if (static_cast<unsigned char>(c) < 0x20) {
+                        char escape[8];
+                        std::snprintf(escape, sizeof escape, "\\u%04x", c);
+                        out << escape;
+                    } else {
+                        out << c;
+                    }
+                }
+                out << '"';
+            };
+            auto histogram = [&](const LatencyHistogram& h) {
+                out << "{\"count\":" << h.count() << ",\"mean_ns\":" << h.mean()
+                    << ",\"p50_ns\":" << h.percentile(50) << ",\"p90_ns\":" << h.percentile(90)
+                    << ",\"p99_ns\":" << h.percentile(99) << ",\"p999_ns\":" << h.percentile(99.9)
+                    << ",\"max_ns\":" << h.max() << '}';
+            };
+
+            out << "{\"rules\":[";
+            for (size_t i = 0; i < rules.size(); ++i) {
+                if (i) out << ',';
+                out << "{\"pattern\":";
+                quoted(rules[i].pattern);
+                out << ",\"match\":";
+                histogram(rules[i].match);
+                out << ",\"expand\":";
+                histogram(rules[i].expand);
+                out << '}';
+            }
+            out << "]}\n";
+        }
+    };
+
+    // Histograms for one expander's rules. Each recording thread gets its own
+    // shard on first use; shards outlive their threads so counts are kept.
+    class RuleStats {
+        std::vector<std::string> patterns;
+        std::mutex mutex;
+        std::vector<std::shared_ptr<std::vector<detail::RuleShard>>> shards;
+
+    public:
+        explicit RuleStats(std::vector<std::string> rule_patterns) : patterns(std::move(rule_patterns)) {}
+
+        std::shared_ptr<std::vector<detail::RuleShard>> attach() {
+            auto shard = std::make_shared<std::vector<detail::RuleShard>>(patterns.size());
+            std::lock_guard lock(mutex);
+            shards.push_back(shard);
+            return shard;
+        }
+
+        RuleStatsSnapshot snapshot() {
+            RuleStatsSnapshot out;
+            out.rules.resize(patterns.size());
+            for (size_t r = 0; r < patterns.size(); ++r) out.rules[r].pattern = patterns[r];
+            std::lock_guard lock(mutex);
+            for (const auto& shard : shards) {
+                for (size_t r = 0; r < patterns.size(); ++r) {
+                    (*shard)[r].match.merge_into(out.rules[r].match);
+                    (*shard)[r].expand.merge_into(out.rules[r].expand);
+                }
+            }
+            return out;
+        }
+
+        // Counts recorded concurrently with a reset may survive it
+        void reset() {
+            std::lock_guard lock(mutex);
+            for (const auto& shard : shards) {
+                for (auto& rule : *shard) {
+                    rule.match.clear();
+                    rule.expand.clear();
+                }
+            }
+        }
+    };
+
+    namespace detail {
+        // Times the phases of one rule attempt; empty when stats are compiled out
+        template<bool Enabled = rule_stats_enabled>
+        class RuleTimer {
+            using clock = std::chrono::steady_clock;
+            RuleShard& shard;
+            clock::time_point start = clock::now();
+
+            uint64_t lap() {
+                auto now = clock::now();
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count();
+                start = now;
+                return static_cast<uint64_t>(ns);
+            }
+
+        public:
+            explicit RuleTimer(RuleShard& s) : shard(s) {}
+            void matched() { shard.match.record(lap()); }
+            void expanded() { shard.expand.record(lap()); }
+        };
+
+        template<>
+        class RuleTimer<false> {
+        public:
+            void matched() {}
+            void expanded() {}
+        };
+    }
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include "nmac/alloc_stats.hpp"
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace nmac {
+    // Id of a token or pattern literal that carries no interned name
+    inline constexpr uint32_t no_symbol = std::numeric_limits<uint32_t>::max();
+
+    namespace detail {
+        // Process-wide interned names. Ids are dense, start at zero and stay
+        // valid for the life of the process, so rule tables can be indexed by
+        // them directly.
+        class SymbolTable {
+            mutable std::shared_mutex mutex;
+            std::deque<std::string> names; // Stable addresses for the keys below
+            std::unordered_map<std::string_view, uint32_t> ids;
+
+        public:
+            uint32_t find(std::string_view name) const {
+                std::shared_lock lock(mutex);
+                auto it = ids.find(name);
+                return it != ids.end() ? it->second : no_symbol;
+            }
+
+            // The stored copy of the name is returned too, for caching
+            std::pair<uint32_t, std::string_view> intern(std::string_view name) {
+                {
+                    std::shared_lock lock(mutex);
+                    auto it = ids.find(name);
+                    if (it != ids.end()) return {it->second, it->first};
+                }
+                std::unique_lock lock(mutex);
+                auto it = ids.find(name);
+                if (it != ids.end()) return {it->second, it->first};
+                std::string_view stored = names.emplace_back(name);
+                ids.emplace(stored, static_cast<uint32_t>(names.size() - 1));
+                return {static_cast<uint32_t>(names.size() - 1), stored};
+            }
+
+            std::string_view name(uint32_t id) const {
+                std::shared_lock lock(mutex);
+                return names.at(id);
+            }
+
+            size_t size() const {
+                std::shared_lock lock(mutex);
+                return names.size();
+            }
+        };
+
+        inline SymbolTable& symbol_table() {
+            static SymbolTable table;
+            return table;
+        }
+    }
+
+    // Id of `name`, adding it on first use. Each thread remembers the names
+    // it has seen, so repeated lookups take no lock.
+    inline uint32_t intern_symbol(std::string_view name) {
+        thread_local std::unordered_map<std::string_view, uint32_t> seen;
+        auto it = seen.find(name);
+        if (it != seen.end()) return it->second;
+        // The table outlives any one file, so its growth is not charged to
+        // whichever stage happened to see a name first
+        NMAC_ALLOC_SCOPE(other);
+        auto [id, stored] = detail::symbol_table().intern(name);
+        seen.emplace(stored, id);
+        return id;
+    }
+
+    // Id of `name` if it was ever interned, else no_symbol
+    inline uint32_t find_symbol(std::string_view name) { return detail::symbol_table().find(name); }
+
+    inline std::string_view symbol_name(uint32_t id) { return detail::symbol_table().name(id); }
+
+    // Upper bound on the ids handed out so far
+    inline size_t symbol_count() { return detail::symbol_table().size(); }
+}
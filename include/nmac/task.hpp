@@ -0,0 +1,254 @@
+#pragma once
+
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace nmac {
+    // Anything that can resume a coroutine later: an event loop, a thread pool, ...
+    template<typename E>
+    concept AsyncExecutor = requires(E& executor, std::coroutine_handle<> handle) {
+        executor.post(handle);
+    };
+
+    template<typename T = void>
+    class task;
+
+    namespace detail {
+        struct promise_base {
+            std::coroutine_handle<> continuation = std::noop_coroutine();
+            std::exception_ptr exception;
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            // Resume whoever awaited us (symmetric transfer, no stack growth)
+            struct final_awaiter {
+                bool await_ready() noexcept { return false; }
+
+                template<typename Promise>
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> handle) noexcept {
+                    return handle.promise().continuation;
+                }
+
+                void await_resume() noexcept {}
+            };
+
+            final_awaiter final_suspend() noexcept { return {}; }
+
+            void unhandled_exception() { exception = std::current_exception(); }
+
+            void rethrow_if_failed() const {
+                if (exception) std::rethrow_exception(exception);
+            }
+        };
+
+        template<typename T>
+        struct task_promise : promise_base {
+            std::optional<T> value;
+
+            task<T> get_return_object();
+
+            template<typename U>
+            void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+            T take() {
+                rethrow_if_failed();
+                return std::move(*value);
+            }
+        };
+
+        template<>
+        struct task_promise<void> : promise_base {
+            task<void> get_return_object();
+
+            void return_void() {}
+
+            void take() { rethrow_if_failed(); }
+        };
+    }
+
+    // Lazily started coroutine producing a T. Awaiting it starts it and resumes
+    // the awaiter when it finishes; exceptions propagate to the awaiter.
+    template<typename T>
+    class task {
+    public:
+        using promise_type = detail::task_promise<T>;
+        using handle_type = std::coroutine_handle<promise_type>;
+
+        task() = default;
+        explicit task(handle_type h) : handle(h) {}
+        task(task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+        task& operator=(task&& other) noexcept {
+            if (this != &other) {
+                if (handle) handle.destroy();
+                handle = std::exchange(other.handle, {});
+            }
+            return *this;
+        }
+        task(const task&) = delete;
+        task& operator=(const task&) = delete;
+        ~task() { if (handle) handle.destroy(); }
+
+        // Starts the coroutine without an awaiter, e.g. from an event loop.
+        // Poll done() and collect the value with result().
+        void start() { handle.resume(); }
+        bool done() const { return !handle || handle.done(); }
+
+        T result() { return handle.promise().take(); }
+
+        auto operator co_await() && noexcept { return awaiter<true>{handle}; }
+        auto operator co_await() & noexcept { return awaiter<true>{handle}; }
+
+        // Awaits completion without fetching the result (or rethrowing).
+        auto when_ready() noexcept { return awaiter<false>{handle}; }
+
+    private:
+        handle_type handle;
+
+        template<bool Fetch>
+        struct awaiter {
+            handle_type handle;
+
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+
+            decltype(auto) await_resume() {
+                if constexpr (Fetch) return handle.promise().take();
+            }
+        };
+    };
+
+    namespace detail {
+        template<typename T>
+        task<T> task_promise<T>::get_return_object() {
+            return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+        }
+
+        inline task<void> task_promise<void>::get_return_object() {
+            return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+        }
+
+        struct sync_wait_state {
+            std::mutex mutex;
+            std::condition_variable cv;
+            bool done = false;
+        };
+
+        // Detached driver used by sync_wait(); signals once it has fully suspended
+        struct sync_wait_driver {
+            struct promise_type {
+                sync_wait_state* state = nullptr;
+
+                sync_wait_driver get_return_object() {
+                    return {std::coroutine_handle<promise_type>::from_promise(*this)};
+                }
+                std::suspend_always initial_suspend() noexcept { return {}; }
+
+                struct notifier {
+                    bool await_ready() noexcept { return false; }
+                    void await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                        sync_wait_state* s = h.promise().state;
+                        std::lock_guard lock(s->mutex);
+                        s->done = true;
+                        s->cv.notify_all();
+                    }
+                    void await_resume() noexcept {}
+                };
+
+                notifier final_suspend() noexcept { return {}; }
+                void return_void() {}
+                void unhandled_exception() { std::terminate(); }
+            };
+
+            std::coroutine_handle<promise_type> handle;
+        };
+
+        template<typename T>
+        sync_wait_driver make_sync_wait_driver(task<T>& t) {
+            co_await t.when_ready();
+        }
+    }
+
+    // Blocks the calling thread until `t` completes on whatever executor it uses.
+    template<typename T>
+    T sync_wait(task<T> t) {
+        detail::sync_wait_state state;
+        auto driver = detail::make_sync_wait_driver(t);
+        driver.handle.promise().state = &state;
+        driver.handle.resume();
+        {
+            std::unique_lock lock(state.mutex);
+            state.cv.wait(lock, [&] { return state.done; });
+        }
+        driver.handle.destroy();
+        return t.result();
+    }
+
+    namespace detail {
+        // Executors that would resume a posted coroutine right away on the
+        // posting thread say so with `static constexpr bool resumes_inline`
+        template<typename E>
+        inline constexpr bool resumes_inline = requires { requires E::resumes_inline; };
+    }
+
+    // Awaitable that suspends the current coroutine and resumes it through
+    // `executor`. For inline executors it does not suspend at all: resuming
+    // from inside await_suspend would nest a stack frame per yield.
+    template<AsyncExecutor E>
+    auto schedule_on(E& executor) {
+        struct awaiter {
+            E& executor;
+            bool await_ready() const noexcept { return detail::resumes_inline<E>; }
+            void await_suspend(std::coroutine_handle<> handle) { executor.post(handle); }
+            void await_resume() const noexcept {}
+        };
+        return awaiter{executor};
+    }
+
+    // Resumes posted coroutines immediately on the posting thread
+    struct inline_executor {
+        static constexpr bool resumes_inline = true;
+
+        void post(std::coroutine_handle<> handle) { handle.resume(); }
+    };
+
+    // Run queue for single-threaded event loops: post() from anywhere, and drain
+    // it with run_one()/run() between I/O polls.
+    class manual_executor {
+        std::mutex mutex;
+        std::deque<std::coroutine_handle<>> queue;
+
+    public:
+        void post(std::coroutine_handle<> handle) {
+            std::lock_guard lock(mutex);
+            queue.push_back(handle);
+        }
+
+        bool run_one() {
+            std::coroutine_handle<> handle;
+            {
+                std::lock_guard lock(mutex);
+                if (queue.empty()) return false;
+                handle = queue.front();
+                queue.pop_front();
+            }
+            handle.resume();
+            return true;
+        }
+
+        // Runs until the queue is empty; returns the number of resumptions
+        size_t run() {
+            size_t count = 0;
+            while (run_one()) count++;
+            return count;
+        }
+    };
+}
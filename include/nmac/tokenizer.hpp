@@ -4,17 +4,35 @@
 #include <string>
 #include <string_view>
 #include <vector>
+#include <algorithm>
 #include <cctype>
 #include <stdexcept>
 #include <unordered_set>
 #include <unordered_map>
 
 namespace nmac {
+    // Byte range [begin, end) of the tokenized source
+    struct SourceRange {
+        size_t begin = 0;
+        size_t end = 0;
+    };
+
+    // Whitespace and comments around a token. Trailing trivia runs up to (not
+    // including) the next newline outside a comment; the rest of the gap before
+    // the following token is that token's leading trivia. Together with the
+    // tokens themselves the ranges cover the source exactly once.
+    struct TokenTrivia {
+        SourceRange leading;
+        SourceRange trailing;
+    };
+
     class Tokenizer {
         std::string_view source;
         size_t pos = 0;
         size_t line = 1;
         size_t column = 0;
+        std::vector<TokenTrivia>* trivia = nullptr; // Trivia mode when set
+        bool trivia_finished = false;
 
         static inline const std::unordered_set<std::string_view> keywords = {
             "vec", "println", "match", "if", "else", "for", "while", "return",
@@ -42,7 +60,14 @@ namespace nmac {
             {'^', PUNCT},
             {'~', PUNCT},
             {'?', PUNCT},
-            {':', PUNCT}
+            {':', PUNCT},
+            {'{', PUNCT},
+            {'}', PUNCT},
+            {'#', PUNCT},
+            {'.', PUNCT},
+            {'@', PUNCT},
+            {'$', PUNCT},
+            {'\\', PUNCT}
         };
 
         char peek() const {
@@ -84,6 +109,35 @@ namespace nmac {
             }
         }
 
+        // End of the trailing part of the trivia gap [begin, end)
+        size_t trailing_end(size_t begin, size_t end) const {
+            size_t i = begin;
+            while (i < end) {
+                if (source[i] == '\n') return i;
+                if (source[i] == '/' && i + 1 < end && source[i + 1] == '/') {
+                    return std::min(source.find('\n', i), end);
+                }
+                if (source[i] == '/' && i + 1 < end && source[i + 1] == '*') {
+                    size_t close = source.find("*/", i + 2);
+                    i = close == std::string_view::npos ? end : close + 2;
+                    continue;
+                }
+                i++;
+            }
+            return end;
+        }
+
+        // Splits the gap [gap, start) between the previous token and the one at
+        // [start, end); start == end == size() records the trivia at end of file.
+        void record_trivia(size_t gap, size_t start, size_t end) {
+            size_t split = gap;
+            if (!trivia->empty()) {
+                split = trailing_end(gap, start);
+                trivia->back().trailing = {gap, split};
+            }
+            trivia->push_back({{split, start}, {end, end}});
+        }
+
         Token scan_identifier() {
             size_t start = pos;
             size_t start_column = column;
@@ -95,6 +149,12 @@ namespace nmac {
 
             std::string_view text = source.substr(start, pos - start);
 
+            // `name!` directly followed by anything but '=' opens a macro invocation
+            if (peek() == '!' && (pos + 1 >= source.size() || source[pos + 1] != '=')) {
+                advance();
+                return Token(MACRO_BANG, source.substr(start, pos - start), start_column, intern_symbol(text));
+            }
+
             // Check if this is a keyword
             if (keywords.find(text) != keywords.end()) {
                 return Token(KEYWORD, text, start_column);
@@ -167,56 +227,120 @@ namespace nmac {
             return Token(LITERAL, text, start_column);
         }
 
+        Token scan_char() {
+            size_t start = pos;
+            size_t start_column = column;
+
+            advance(); // Skip opening quote
+
+            while (pos < source.size() && peek() != '\'' && peek() != '\n') {
+                if (peek() == '\\' && pos + 1 < source.size()) {
+                    advance(); // Skip escape character
+                }
+                advance();
+            }
+
+            if (peek() != '\'') {
+                throw std::runtime_error("Unterminated character literal");
+            }
+
+            advance(); // Skip closing quote
+
+            std::string_view text = source.substr(start, pos - start);
+            return Token(LITERAL, text, start_column);
+        }
+
     public:
         explicit Tokenizer(std::string_view src) : source(src) {}
 
+        // Resumes scanning at byte `start`, which must be the end of a token of a
+        // previous scan of the same text (or 0). Line and column stay relative to
+        // the whole source.
+        Tokenizer(std::string_view src, size_t start) : source(src), pos(start) {
+            std::string_view before = src.substr(0, start);
+            size_t newline = before.rfind('\n');
+            for (char c : before) line += c == '\n';
+            column = newline == std::string_view::npos ? start : start - newline;
+        }
 
-        std::vector<Token> tokenize() {
-        std::vector<Token> tokens;
-
-        while (pos < source.size()) {
-            skip_whitespace();
 
-            if (pos >= source.size()) break;
+        std::vector<Token> tokenize() {
+            NMAC_TRACE_SCOPE("tokenize");
+            NMAC_ALLOC_SCOPE(tokenize);
+            std::vector<Token> tokens;
+            while (next(tokens)) {}
+            return tokens;
+        }
 
-            char c = peek();
+        // Trivia mode: trivia[i] describes tokens[i], and one extra final entry
+        // holds the trivia at end of file as its leading range. Nothing is
+        // copied; slice the source with the ranges to reproduce it byte for byte.
+        std::vector<Token> tokenize(std::vector<TokenTrivia>& out) {
+            NMAC_TRACE_SCOPE("tokenize");
+            NMAC_ALLOC_SCOPE(tokenize);
+            out.clear();
+            trivia = &out;
+            std::vector<Token> tokens;
+            while (next(tokens)) {}
+            trivia = nullptr;
+            return tokens;
+        }
 
-            // Handle comments
-            if (c == '/' && pos + 1 < source.size()) {
-                if (source[pos + 1] == '/') {
-                    advance(); // Skip '/'
-                    advance(); // Skip '/'
-                    skip_line_comment();
-                    continue;
-                } else if (source[pos + 1] == '*') {
-                    advance(); // Skip '/'
-                    advance(); // Skip '*'
-                    skip_block_comment();
-                    continue;
+        // Scans one token onto `tokens`; returns false once the source is exhausted.
+        // Lets callers tokenize incrementally (see async_tokenize).
+        bool next(std::vector<Token>& tokens) {
+            size_t gap = pos;
+            while (pos < source.size()) {
+                skip_whitespace();
+
+                if (pos >= source.size()) break;
+
+                char c = peek();
+
+                // Handle comments
+                if (c == '/' && pos + 1 < source.size()) {
+                    if (source[pos + 1] == '/') {
+                        advance(); // Skip '/'
+                        advance(); // Skip '/'
+                        skip_line_comment();
+                        continue;
+                    } else if (source[pos + 1] == '*') {
+                        advance(); // Skip '/'
+                        advance(); // Skip '*'
+                        skip_block_comment();
+                        continue;
+                    }
                 }
-            }
 
-            if (std::isalpha(c) || c == '_') {
-                tokens.push_back(scan_identifier());
-            } else if (std::isdigit(c)) {
-                tokens.push_back(scan_number());
-            } else if (c == '"') {
-                tokens.push_back(scan_string());
-            } else {
-                // Check for punctuation tokens
-                auto it = punct_tokens.find(c);
-                if (it != punct_tokens.end()) {
-                    tokens.push_back(Token(it->second, source.substr(pos, 1), column));
-                    advance();
+                size_t start = pos;
+                if (std::isalpha(c) || c == '_') {
+                    tokens.push_back(scan_identifier());
+                } else if (std::isdigit(c)) {
+                    tokens.push_back(scan_number());
+                } else if (c == '"') {
+                    tokens.push_back(scan_string());
+                } else if (c == '\'') {
+                    tokens.push_back(scan_char());
                 } else {
-                    // Unknown character
-                    throw std::runtime_error(std::string("Unexpected character: ") + c);
+                    // Check for punctuation tokens
+                    auto it = punct_tokens.find(c);
+                    if (it != punct_tokens.end()) {
+                        tokens.push_back(Token(it->second, source.substr(pos, 1), column));
+                        advance();
+                    } else {
+                        // Unknown character
+                        throw std::runtime_error(std::string("Unexpected character: ") + c);
+                    }
                 }
+                if (trivia) record_trivia(gap, start, pos);
+                return true;
+            }
+            if (trivia && !trivia_finished) {
+                record_trivia(gap, source.size(), source.size());
+                trivia_finished = true;
             }
+            return false;
         }
 
-        return tokens;
-    }
-
     };
 }
\ No newline at end of file
@@ -0,0 +1,171 @@
+#pragma once
+
+// Span tracer that dumps Chrome trace-event JSON (chrome://tracing, Perfetto).
+// Tracepoints are written as NMAC_TRACE_SCOPE("name") and expand to nothing
+// unless NMAC_TRACE is defined to 1; even then nothing is recorded until
+// trace::start() is called.
+#ifndef NMAC_TRACE
+#define NMAC_TRACE 0
+#endif
+
+#if NMAC_TRACE
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace nmac::trace {
+    struct Event {
+        const char* name;  // Must be a string literal
+        uint64_t start_ns;
+        uint64_t duration_ns;
+    };
+
+    namespace detail {
+        using clock = std::chrono::steady_clock;
+
+        inline uint64_t now_ns() {
+            return static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now().time_since_epoch()).count());
+        }
+
+        // Fixed-size block of events. Only the owning thread appends; it
+        // publishes each event by a release store of `size`.
+        struct Block {
+            static constexpr size_t capacity = 4096;
+            Event events[capacity];
+            std::atomic<size_t> size{0};
+            std::atomic<Block*> next{nullptr};
+        };
+
+        // One thread's events as a singly linked list of blocks, so readers can
+        // walk it without a lock while the thread keeps appending.
+        struct ThreadBuffer {
+            uint32_t tid;
+            Block head;
+            Block* tail = &head;
+
+            explicit ThreadBuffer(uint32_t id) : tid(id) {}
+
+            ~ThreadBuffer() {
+                for (Block* b = head.next.load(std::memory_order_relaxed); b;) {
+                    Block* next = b->next.load(std::memory_order_relaxed);
+                    delete b;
+                    b = next;
+                }
+            }
+
+            void push(const Event& event) {
+                size_t n = tail->size.load(std::memory_order_relaxed);
+                if (n == Block::capacity) {
+                    Block* block = new Block;
+                    tail->next.store(block, std::memory_order_release);
+                    tail = block;
+                    n = 0;
+                }
+                tail->events[n] = event;
+                tail->size.store(n + 1, std::memory_order_release);
+            }
+        };
+
+        struct Registry {
+            std::atomic<bool> enabled{false};
+            std::atomic<uint64_t> origin_ns{now_ns()};
+            std::mutex mutex;
+            std::vector<std::shared_ptr<ThreadBuffer>> buffers; // Outlive their threads
+
+            std::shared_ptr<ThreadBuffer> attach() {
+                std::lock_guard lock(mutex);
+                auto buffer = std::make_shared<ThreadBuffer>(static_cast<uint32_t>(buffers.size() + 1));
+                buffers.push_back(buffer);
+                return buffer;
+            }
+        };
+
+        inline Registry& registry() {
+            static Registry instance;
+            return instance;
+        }
+
+        inline ThreadBuffer& local_buffer() {
+            thread_local std::shared_ptr<ThreadBuffer> buffer = registry().attach();
+            return *buffer;
+        }
+    }
+
+    inline void start() {
+        auto& r = detail::registry();
+        r.origin_ns.store(detail::now_ns(), std::memory_order_relaxed);
+        r.enabled.store(true, std::memory_order_release);
+    }
+
+    inline void stop() { detail::registry().enabled.store(false, std::memory_order_release); }
+
+    inline bool enabled() { return detail::registry().enabled.load(std::memory_order_relaxed); }
+
+    // Records the span from construction to destruction on the calling thread
+    class Scope {
+        const char* name;
+        uint64_t start_ns = 0;
+
+    public:
+        explicit Scope(const char* n) : name(enabled() ? n : nullptr) {
+            if (name) start_ns = detail::now_ns();
+        }
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        ~Scope() {
+            if (name) detail::local_buffer().push(Event{name, start_ns, detail::now_ns() - start_ns});
+        }
+    };
+
+    // Writes every event recorded so far as complete ("X") events. Safe to call
+    // while other threads are still tracing; their newer events are left out.
+    inline void write_json(std::ostream& out) {
+        auto& r = detail::registry();
+        std::vector<std::shared_ptr<detail::ThreadBuffer>> buffers;
+        {
+            std::lock_guard lock(r.mutex);
+            buffers = r.buffers;
+        }
+
+        uint64_t origin = r.origin_ns.load(std::memory_order_relaxed);
+        auto micros = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+        out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        bool first = true;
+        for (const auto& buffer : buffers) {
+            if (!first) out << ',';
+            first = false;
+            out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":\"thread " << buffer->tid << "\"}}";
+
+            for (const detail::Block* b = &buffer->head; b; b = b->next.load(std::memory_order_acquire)) {
+                size_t n = b->size.load(std::memory_order_acquire);
+                for (size_t i = 0; i < n; ++i) {
+                    const Event& e = b->events[i];
+                    if (e.start_ns < origin) continue; // From before the last start()
+                    out << ",{\"name\":\"" << e.name << "\",\"cat\":\"nmac\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+                        << buffer->tid << ",\"ts\":" << micros(e.start_ns - origin)
+                        << ",\"dur\":" << micros(e.duration_ns) << '}';
+                }
+            }
+        }
+        out << "]}\n";
+    }
+}
+
+#define NMAC_TRACE_CONCAT_(a, b) a##b
+#define NMAC_TRACE_CONCAT(a, b) NMAC_TRACE_CONCAT_(a, b)
+#define NMAC_TRACE_SCOPE(name) ::nmac::trace::Scope NMAC_TRACE_CONCAT(nmac_trace_scope_, __LINE__)(name)
+
+#else
+
+#define NMAC_TRACE_SCOPE(name) static_cast<void>(0)
+
+#endif
@@ -1,17 +1,19 @@
 #pragma once
 
 #include "nmac/nmac.hpp"
+#include "nmac/macro_expander.hpp"
 #include <vector>
 #include <string>
+#include <tuple>
 #include <type_traits>
 #include <iostream>
 #include <sstream>
 
 namespace nmac::dsl {
     /// Common type for inference
-    template<typename First, typename... Rest>
+    template<typename... Args>
     struct CommonType {
-        using type = std::common_type_t<First, Rest...>;
+        using type = std::common_type_t<Args...>;
     };
 
     /// Specialization for empty list
@@ -118,20 +120,25 @@ namespace nmac::dsl {
         // Version for MacroGeneratorType concept
         template<typename Tuple>
         static auto expand(const Tuple& tuple) {
-            // Assume tuple has exactly two elements: value and count
-            return std::apply([]<typename Value>(Value value, auto count) {
-                return std::vector<std::decay_t<Value>>(count, value);
-            }, tuple);
+            // Two elements are a value and a count; anything else is no repeat
+            if constexpr (std::tuple_size_v<Tuple> == 2) {
+                return std::apply([]<typename Value>(Value value, auto count) {
+                    return std::vector<std::decay_t<Value>>(count, value);
+                }, tuple);
+            } else {
+                return std::vector<int>{};
+            }
         }
     };
 
     // Macro rules
-    using VecEmptyRule = nmac::MacroRule<"vec! [ ]", VecEmptyGenerator>;
-    using VecListRule = nmac::MacroRule<"vec! [ $expr+ ]", VecListGenerator>;
-    using VecRepeatRule = nmac::MacroRule<"vec! [ $expr ; $count ]", VecRepeatGenerator>;
+    using VecEmptyRule = nmac::MacroRule<"vec! \\[ \\]", VecEmptyGenerator>;
+    using VecListRule = nmac::MacroRule<"vec! \\[ $expr ( \\, $expr )* \\]", VecListGenerator>;
+    using VecRepeatRule = nmac::MacroRule<"vec! \\[ $expr ; $count \\]", VecRepeatGenerator>;
 
-    // Macro expander combining all rules
-    using VecExpander = nmac::MacroExpander<VecEmptyRule, VecListRule, VecRepeatRule>;
+    // Macro expander combining all rules. The three share `vec! [`, which
+    // dispatch matches once before branching on the next token.
+    using VecExpander = nmac::macro::Expander<VecEmptyRule, VecListRule, VecRepeatRule>;
 
     // =====================================================
     // User-friendly function API
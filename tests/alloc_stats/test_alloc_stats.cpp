@@ -0,0 +1,103 @@
+#include "nmac/alloc_stats.hpp"
+#include "nmac/driver/builtin_rewriters.hpp"
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/dsl/format_string.hpp"
+#include "nmac/dsl/println_eval.hpp"
+#include "nmac/nmac.hpp"
+#include "nmac/tokenizer.hpp"
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+NMAC_INSTALL_ALLOCATION_TRACKER()
+
+using nmac::alloc::Stage;
+
+void test_scopes() {
+    assert(nmac::alloc::tracking());
+
+    auto before = nmac::alloc::snapshot();
+    {
+        NMAC_ALLOC_SCOPE(match);
+        auto outer = std::make_unique<char[]>(1000);
+        {
+            NMAC_ALLOC_SCOPE(format);
+            auto inner = std::make_unique<char[]>(24);
+        }
+        auto again = std::make_unique<char[]>(1000);
+    }
+    auto delta = nmac::alloc::snapshot() - before;
+    assert(delta[Stage::match].allocations == 2 && delta[Stage::match].bytes == 2000);
+    assert(delta[Stage::match].live_bytes == 0 && delta[Stage::match].peak_bytes >= 2000);
+    assert(delta[Stage::format].allocations == 1 && delta[Stage::format].deallocations == 1);
+
+    // Over-aligned allocations are counted and keep their alignment
+    struct alignas(128) Wide { char bytes[256]; };
+    before = nmac::alloc::snapshot();
+    auto wide = std::make_unique<Wide>();
+    assert(reinterpret_cast<uintptr_t>(wide.get()) % 128 == 0);
+    wide.reset();
+    delta = nmac::alloc::snapshot() - before;
+    assert(delta[Stage::other].allocations == 1 && delta[Stage::other].bytes == sizeof(Wide));
+}
+
+void test_pipeline_budgets() {
+    std::string source;
+    for (int i = 0; i < 200; ++i) source += "auto v = vec![1, 2, 3];\nprintln!(\"{}\", v);\n";
+
+    // Tokenizing only grows the token vector
+    auto before = nmac::alloc::snapshot();
+    nmac::Tokenizer tokenizer(source);
+    auto tokens = tokenizer.tokenize();
+    auto delta = nmac::alloc::snapshot() - before;
+    assert(delta[Stage::tokenize].allocations > 0 && delta[Stage::tokenize].allocations <= 16);
+
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    std::string out;
+    before = nmac::alloc::snapshot();
+    size_t invocations = expander.expand(source, tokens, out);
+    delta = nmac::alloc::snapshot() - before;
+    assert(invocations == 400);
+    assert(delta[Stage::expand].allocations <= 4 * invocations);
+    assert(delta[Stage::tokenize].allocations == 0 && delta[Stage::parse].allocations == 0);
+
+    before = nmac::alloc::snapshot();
+    std::string text = nmac::dsl::FormatString::format("{} plus {} makes {}", 1, 2, 3);
+    delta = nmac::alloc::snapshot() - before;
+    assert(text == "1 plus 2 makes 3");
+    assert(delta[Stage::format].allocations > 0);
+
+    // A + chain over string variables appends them in place: the operand
+    // table and the output, but no copy per operand
+    nmac::dsl::EvaluationContext context;
+    std::string chain;
+    for (int i = 0; i < 8; ++i) {
+        std::string name = "s" + std::to_string(i);
+        context.set_variable(name, nmac::dsl::Value{std::string(100, static_cast<char>('a' + i))});
+        chain += (i ? " + " : "") + name;
+    }
+    chain += " + \"literal text that is too long for small string storage\"";
+    nmac::dsl::Expression expression(chain);
+    std::string appended;
+    before = nmac::alloc::snapshot();
+    {
+        NMAC_ALLOC_SCOPE(format);
+        nmac::dsl::ExpressionEvaluator::append(appended, expression, context);
+    }
+    delta = nmac::alloc::snapshot() - before;
+    assert(appended.size() == 800 + 54 && appended.substr(700, 100) == std::string(100, 'h'));
+    assert(delta[Stage::format].allocations <= 3);
+
+    std::cout << "Allocations by stage:\n";
+    nmac::alloc::snapshot().write_text(std::cout);
+}
+
+int main() {
+    test_scopes();
+    test_pipeline_budgets();
+    return 0;
+}
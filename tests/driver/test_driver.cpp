@@ -0,0 +1,298 @@
+#include "nmac/driver/builtin_rewriters.hpp"
+#include "nmac/driver/compile_commands.hpp"
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/driver/incremental.hpp"
+#include "nmac/driver/output_rope.hpp"
+#include "nmac/driver/project.hpp"
+#include "nmac/driver/token_cache.hpp"
+#include "nmac/executor.hpp"
+#include "nmac/io/file_batch.hpp"
+#include "nmac/tokenizer.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+void test_token_buffer() {
+    std::cout << "\nTesting matching over a cached TokenBuffer\n";
+
+    std::string source = "sum(a + [b * c]) + vec![x]";
+    nmac::Tokenizer tokenizer(source);
+    auto tokens = tokenizer.tokenize();
+
+    auto dir = std::filesystem::temp_directory_path() / "nmac_token_cache_test";
+    std::filesystem::remove_all(dir);
+    nmac::driver::TokenCache cache(dir);
+    assert(!cache.load(source));
+    cache.store(nmac::driver::TokenBuffer::build(source, tokens));
+    auto mapped = cache.load(source);
+    assert(mapped && mapped->size() == tokens.size());
+    assert(!cache.load(source + " "));
+
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        assert((*mapped)[i].type == tokens[i].type && (*mapped)[i].content == tokens[i].content);
+    }
+    assert(mapped->matching(1) == 9 && mapped->matching(9) == 1);
+    assert(mapped->matching(4) == 8 && mapped->matching(0) == nmac::driver::TokenBuffer::none);
+    assert(mapped->symbol(2) != mapped->symbol(5));
+    assert(mapped->symbol_name(mapped->symbol(0)) == "sum");
+
+    nmac::PatternParser parser("sum \\( $first + \\[ $second * $third \\] \\)");
+    auto pattern = parser.parse();
+    nmac::PatternMatcher<nmac::driver::TokenBuffer> matcher(pattern, *mapped);
+    assert(matcher.match());
+    const auto& captures = matcher.get_captures();
+    assert(captures.size() == 3);
+    assert(captures[0].second.content == "a" && captures[2].second.content == "c");
+
+    // A damaged image that still passes the header check is a miss, not trusted
+    std::filesystem::path file = std::filesystem::directory_iterator(dir)->path();
+    std::string image(mapped->bytes());
+    const auto& header = *reinterpret_cast<const nmac::driver::detail::TokenImageHeader*>(image.data());
+    auto layout = nmac::driver::detail::TokenImageLayout::of(header.token_count, header.symbol_count, header.symbol_bytes);
+    size_t bang = tokens.size() - 4;
+    assert(tokens[bang].type == nmac::MACRO_BANG);
+    auto corrupt = [&](size_t at, uint32_t value, size_t width = 4) {
+        std::string damaged = image;
+        std::memcpy(damaged.data() + at, &value, width);
+        std::ofstream(file, std::ios::binary | std::ios::trunc).write(damaged.data(), static_cast<std::streamsize>(damaged.size()));
+        assert(!cache.load(source));
+        assert(cache.tokens(source).size() == tokens.size());
+        assert(cache.load(source));
+    };
+    corrupt(layout.symbols + 4 * bang, 1u << 30);
+    corrupt(layout.symbols + 4 * bang, nmac::driver::TokenBuffer::none);
+    corrupt(layout.offsets + 4 * 2, static_cast<uint32_t>(source.size()));
+    corrupt(layout.lengths + 4 * 2, 1u << 31);
+    corrupt(layout.jumps + 4 * 1, static_cast<uint32_t>(tokens.size()));
+    corrupt(layout.types + 3, 200, 1);
+    corrupt(layout.symbol_offsets + 4 * header.symbol_count, header.symbol_bytes + 1);
+    corrupt(layout.symbol_offsets + 4, header.symbol_bytes + 1);
+
+    std::filesystem::remove_all(dir);
+}
+
+void test_incremental_edits() {
+    std::cout << "Testing incremental re-expansion after edits\n";
+
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    nmac::driver::IncrementalExpander incremental(expander, 1);
+
+    std::string source = "auto a = vec![1, 2];\nint b = 0;\nprintln!(\"{}\", a);\nauto c = vec![3; 4];\n";
+    auto stats = incremental.update(0, source);
+    assert(stats.invocations == 3 && incremental.output(0) == expander.expand(source));
+
+    // Tokens kept from the previous version on either side of the edit must
+    // still be recognised as invocations
+    std::string edits[] = {
+        "auto a = vec![1, 2];\nint b = 42;\nprintln!(\"{}\", a);\nauto c = vec![3; 4];\n",
+        "auto a = vec![1, 2];\nint b = 42;\nprintln!(\"{} {}\", a, b);\nauto c = vec![3; 4];\n",
+        "// header\nauto a = vec![1, 2];\nint b = 42;\nprintln!(\"{} {}\", a, b);\nauto c = vec![3; 4];\n",
+        "// header\nauto a = vec![1, 2];\nauto c = vec![3; 4];\n",
+    };
+    for (const auto& edit : edits) {
+        stats = incremental.update(0, edit);
+        assert(incremental.output(0) == expander.expand(edit));
+        assert(stats.invocations == (edit.find("println!") != std::string::npos ? 3u : 2u));
+        assert(stats.reused > 0);
+    }
+}
+
+// Rebuilds the source from trivia mode's ranges, checking that each range
+// starts where the previous piece ended
+std::string rebuild_from_trivia(const std::string& source) {
+    std::vector<nmac::TokenTrivia> trivia;
+    nmac::Tokenizer tokenizer(source);
+    auto tokens = tokenizer.tokenize(trivia);
+    assert(trivia.size() == tokens.size() + 1);
+
+    std::string out;
+    auto take = [&](nmac::SourceRange range) {
+        assert(range.begin == out.size() && range.begin <= range.end);
+        out.append(source, range.begin, range.end - range.begin);
+    };
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        take(trivia[i].leading);
+        assert(nmac::driver::begin_offset(source, tokens[i]) == out.size());
+        out += tokens[i].content;
+        take(trivia[i].trailing);
+    }
+    take(trivia.back().leading);
+    assert(trivia.back().trailing.begin == source.size() && trivia.back().trailing.end == source.size());
+    return out;
+}
+
+void test_trivia_round_trip() {
+    std::cout << "\nTesting trivia mode round trips\n";
+
+    for (std::string source : {
+             "",
+             "   \n\t\n",
+             "// only a comment",
+             "/* one */ // two\n/* three\n spans */\n",
+             "a // trailing comment",
+             "a /* x\ny */ b\n\n  // own line\nc",
+             "auto v = vec![1, 2]; // note\n    println!(\"{}\", v);\n",
+         }) {
+        assert(rebuild_from_trivia(source) == source);
+    }
+
+    // Trailing trivia stops at the first newline outside a comment
+    std::vector<nmac::TokenTrivia> trivia;
+    std::string source = "a /* x\ny */ // z\n  b";
+    nmac::Tokenizer(source).tokenize(trivia);
+    assert(source.substr(trivia[0].trailing.begin, trivia[0].trailing.end - trivia[0].trailing.begin) ==
+           " /* x\ny */ // z");
+    assert(source.substr(trivia[1].leading.begin, trivia[1].leading.end - trivia[1].leading.begin) == "\n  ");
+}
+
+std::string read_file(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::ostringstream text;
+    text << in.rdbuf();
+    return text.str();
+}
+
+void test_output_rope() {
+    std::cout << "\nTesting OutputRope edits and output\n";
+
+    struct Edit {
+        size_t begin;
+        size_t end;
+        std::string text;
+    };
+
+    std::mt19937 rng(7);
+    auto path = std::filesystem::temp_directory_path() / "nmac_output_rope_test";
+    for (int round = 0; round < 200; ++round) {
+        std::string source(rng() % 64, 'a');
+        for (auto& c : source) c = static_cast<char>('a' + rng() % 26);
+
+        // Cut the source into segments, each kept, replaced, erased or
+        // preceded by an insertion; the expected output is built in order
+        std::vector<Edit> edits;
+        std::string expected;
+        size_t at = 0;
+        while (at < source.size()) {
+            size_t end = std::min(source.size(), at + 1 + rng() % 8);
+            std::string text(rng() % 5, static_cast<char>('0' + rng() % 10));
+            switch (rng() % 4) {
+            case 0: expected += source.substr(at, end - at); break;
+            case 1: edits.push_back({at, end, text}); expected += text; break;
+            case 2: edits.push_back({at, at, text}); expected += text + source.substr(at, end - at); break;
+            default: edits.push_back({at, end, {}}); break;
+            }
+            at = end;
+        }
+        if (rng() % 2) {
+            edits.push_back({source.size(), source.size(), "!"});
+            expected += "!";
+        }
+
+        // Out of order, as parallel jobs would apply them
+        std::vector<Edit> shuffled = edits;
+        std::shuffle(shuffled.begin(), shuffled.end(), rng);
+        nmac::driver::OutputRope rope(source);
+        for (auto& edit : shuffled) rope.replace(edit.begin, edit.end, edit.text);
+        assert(rope.str() == expected && rope.size() == expected.size());
+        assert(rope.edit_count() <= edits.size());
+
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        rope.write_to(fd, path.string());
+        ::close(fd);
+        assert(read_file(path) == expected);
+
+        // Streaming: seal and flush after each edit, in source order
+        nmac::driver::OutputRope stream(source);
+        fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        for (auto& edit : edits) {
+            stream.replace(edit.begin, edit.end, edit.text);
+            stream.seal(edit.end);
+            stream.flush(fd, path.string());
+        }
+        stream.finish(fd, path.string());
+        ::close(fd);
+        assert(read_file(path) == expected && stream.size() == expected.size());
+        assert(stream.edit_count() == 0 && stream.str().empty());
+    }
+    std::filesystem::remove(path);
+
+    nmac::driver::OutputRope rope("abcdef");
+    rope.replace(1, 3, "X");
+    bool threw = false;
+    try {
+        rope.replace(2, 4, "Y");
+    } catch (const std::invalid_argument&) {
+        threw = true;
+    }
+    assert(threw);
+}
+
+void test_project_expansion() {
+    std::cout << "\nTesting project scan and expansion\n";
+
+    auto dir = std::filesystem::temp_directory_path() / "nmac_project_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir / "inc");
+    auto write = [&](const std::string& name, const std::string& text) { std::ofstream(dir / name) << text; };
+
+    // Both units include the shared header, once directly and once through
+    // another header; the guarded headers also include each other
+    write("inc/shared.hpp", "#pragma once\n#include \"other.hpp\"\nauto s = vec![1, 2];\n");
+    write("inc/other.hpp", "#pragma once\n#include \"shared.hpp\"\nauto o = vec![0; 3];\n");
+    write("a.cpp", "#include \"shared.hpp\"\nint main() { println!(\"{}\", s); }\n");
+    write("b.cpp", "#include \"other.hpp\"\n// no macros here\nint b;\n");
+    std::string d = dir.string();
+    write("compile_commands.json",
+          "[{\"directory\":\"" + d + "\",\"command\":\"c++ -Iinc -c a.cpp\",\"file\":\"a.cpp\"},"
+          "{\"directory\":\"" + d + "\",\"command\":\"c++ -Iinc -c b.cpp\",\"file\":\"b.cpp\"}]");
+
+    nmac::io::BatchIo io;
+    auto project = nmac::driver::Project::scan(
+        nmac::driver::load_compile_commands((dir / "compile_commands.json").string()), io);
+    const auto& files = project.contents();
+    assert(files.size() == 4);
+
+    auto find = [&](const std::string& name) -> const nmac::driver::ProjectFile& {
+        for (const auto& file : files) {
+            if (std::filesystem::path(file.path).filename() == name) return file;
+        }
+        assert(false && "file missing from project");
+        return files.front();
+    };
+    assert(find("a.cpp").translation_unit && !find("shared.hpp").translation_unit);
+    assert(find("shared.hpp").includers.size() == 2 && find("other.hpp").includers.size() == 2);
+
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    nmac::executor pool(nmac::ExecutorOptions{2});
+    project.expand(expander, pool);
+    size_t invocations = 0;
+    for (const auto& file : files) {
+        assert(file.output.str() == expander.expand(file.source));
+        assert(file.tokens.empty());
+        invocations += file.invocations;
+    }
+    assert(invocations == 3);
+
+    std::filesystem::remove_all(dir);
+}
+
+int main() {
+    test_token_buffer();
+    test_incremental_edits();
+    test_trivia_round_trip();
+    test_output_rope();
+    test_project_expansion();
+    std::cout << "\nDriver tests completed\n";
+    return 0;
+}
@@ -0,0 +1,219 @@
+#include "nmac/dsl/fmt_core.hpp"
+#include "nmac/dsl/format_string.hpp"
+#include "nmac/dsl/println.hpp"
+#include "nmac/dsl/println_eval.hpp"
+#include "nmac/dsl/println_sink.hpp"
+#include "nmac/dsl/println_template.hpp"
+#include "nmac/dsl/value_codec.hpp"
+#include <cassert>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+void test_container_formatting() {
+    std::cout << "\nTesting container formatting\n";
+    using nmac::dsl::Value;
+    namespace fmt = nmac::dsl::fmt;
+
+    std::vector<long> numbers = {0, -7, 42, INT64_MIN};
+    std::map<std::string, std::vector<int>> groups = {{"a", {1, 2}}, {"b", {}}};
+    assert(fmt::FormatCore::format("{} {}", numbers, groups) ==
+           "[0, -7, 42, -9223372036854775808] {a: [1, 2], b: []}");
+    assert(fmt::FormatCore::format("{}|{}", fmt::join(numbers, " "), std::make_tuple(1.5, 'c', "s")) ==
+           "0 -7 42 -9223372036854775808|(1.5, c, s)");
+    assert(nmac::dsl::FormatString::format("<{}>", fmt::styled(groups.at("a"), {"(", "; ", ")"})) == "<(1; 2)>");
+
+    Value nested{std::vector<Value>{Value{1}, Value{2.5}, Value{std::vector<Value>{Value{true}, Value{nullptr}}}}};
+    assert(nmac::dsl::value_to_string(nested) == "[1, 2.500000, [true, null]]");
+    assert(nmac::dsl::FormatString::format("v={}", nested) == "v=[1, 2.500000, [true, null]]");
+}
+
+// Formats itself with a format string that shares a FormatCache slot with
+// the caller's, so the nested call replaces the entry the caller is using
+struct SlotThief {
+    std::string inner;
+};
+
+std::ostream& operator<<(std::ostream& os, const SlotThief& thief) {
+    return os << nmac::dsl::FormatString::format(thief.inner, 1);
+}
+
+void test_nested_format_collision() {
+    std::cout << "\nTesting format() nested in an argument's operator<<\n";
+    using nmac::dsl::FormatCache;
+
+    std::string outer = "outer {} then a long literal tail {}!";
+    auto slot = [](std::string_view fmt) { return std::hash<std::string_view>{}(fmt) % FormatCache::slot_count; };
+    std::string inner;
+    for (int i = 0; inner.empty() || inner == outer || slot(inner) != slot(outer); ++i) {
+        inner = "inner " + std::to_string(i) + " {}";
+    }
+
+    SlotThief thief{inner};
+    std::string expected = "outer " + nmac::dsl::FormatString::format(inner, 1) + " then a long literal tail 2!";
+    for (int round = 0; round < 3; ++round) {
+        assert(nmac::dsl::FormatString::format(outer, thief, 2) == expected);
+    }
+}
+
+void test_constant_folding() {
+    std::cout << "\nTesting compile-time folding of constant format arguments\n";
+    namespace fmt = nmac::dsl::fmt;
+
+    using Mixed = fmt::FoldedFormat<"a {} b {} c {}", fmt::Constant<-42>, int, fmt::Constant<nmac::ct_string("xy")>>;
+    static_assert(Mixed::runtime_count == 1);
+    static_assert(Mixed::segment(0) == "a -42 b " && Mixed::segment(1) == " c xy");
+    using Constant = fmt::FoldedFormat<"{}{}", fmt::Constant<UINT64_MAX>, fmt::Constant<'!'>>;
+    static_assert(Constant::runtime_count == 0 && Constant::line() == "18446744073709551615!\n");
+
+    int x = 7;
+    assert(nmac::dsl::templates::format<"x={} k={}">(x, fmt::constant<100>) == "x=7 k=100");
+    assert(nmac::dsl::templates::format<"{}">(fmt::constant<2.5>) == "2.5");
+}
+
+void test_mapped_log_sink() {
+    std::cout << "\nTesting the memory-mapped println sink\n";
+
+    auto dir = std::filesystem::temp_directory_path() / "nmac_mapped_log_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    std::string base = (dir / "out.log").string();
+
+    size_t segments;
+    {
+        nmac::dsl::MappedLogSink sink(base, 4096);
+        nmac::dsl::ScopedPrintlnSink scoped(sink);
+        std::vector<std::thread> writers;
+        for (int t = 0; t < 4; ++t) {
+            writers.emplace_back([t] {
+                for (int i = 0; i < 2000; ++i) nmac::dsl::println("thread {} line {}", t, i);
+            });
+        }
+        for (auto& w : writers) w.join();
+        segments = sink.mapped_log().segment_index() + 1;
+    }
+    assert(segments > 1);
+
+    // Every line appears once and whole, and no segment runs past its size
+    std::set<std::string> lines;
+    for (size_t i = 0; i < segments; ++i) {
+        std::string file = base + "." + std::to_string(i);
+        assert(std::filesystem::file_size(file) <= 4096);
+        std::ifstream in(file);
+        for (std::string line; std::getline(in, line);) assert(lines.insert(line).second);
+    }
+    assert(lines.size() == 8000 && lines.count("thread 3 line 1999"));
+    std::filesystem::remove_all(dir);
+}
+
+void test_value_codecs() {
+    std::cout << "\nTesting JSON and CBOR encodings of Value\n";
+    using nmac::dsl::Value;
+    namespace json = nmac::dsl::json;
+    namespace cbor = nmac::dsl::cbor;
+
+    Value value{std::vector<Value>{Value{nullptr}, Value{true}, Value{-1000}, Value{2.0},
+                                   Value{std::string("a \"quoted\"\tline that is longer than sixteen bytes\n")},
+                                   Value{std::vector<Value>{}}}};
+    std::string text = json::to_json(value);
+    assert(text == "[null,true,-1000,2.0,\"a \\\"quoted\\\"\\tline that is longer than sixteen bytes\\n\",[]]");
+    assert(json::to_json(json::parse(text)) == text);
+
+    std::string bytes = cbor::to_cbor(value);
+    assert(bytes.substr(0, 4) == "\x86\xF6\xF5\x39" && cbor::to_cbor(cbor::parse(bytes)) == bytes);
+
+    // One reader handles a stream of values, reusing its scratch space
+    json::Reader reader;
+    std::string lines = "1\n[\"\\u00e9\", 2.5]\n";
+    size_t offset = 0;
+    assert(std::get<int>(reader.read_next(lines, offset)) == 1);
+    Value second = reader.read_next(lines, offset);
+    assert(offset == lines.size() && nmac::dsl::value_to_string(second) == "[\xC3\xA9, 2.500000]");
+
+    bool rejected = false;
+    try {
+        json::parse("[1, {}]");
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    assert(rejected);
+}
+
+void test_expression_evaluation() {
+    std::cout << "\nTesting println expression evaluation\n";
+    using namespace nmac::dsl;
+
+    EvaluationContext context;
+    int evaluated = 0;
+    context.set_variable("x", Value{5});
+    context.register_function("fail", [&](std::vector<Value>) -> Value {
+        ++evaluated;
+        throw std::runtime_error("evaluated");
+    });
+    context.register_lazy_function("first", [](std::span<const LazyArg> args) -> Value { return args[0](); });
+
+    auto text = [&](const char* source) {
+        std::string out;
+        ExpressionEvaluator::append(out, Expression(source), context);
+        return out;
+    };
+    assert(text("1 + 2 * 3") == "7" && text("(1 + 2) * 3") == "9");
+    assert(text("\"x=\" + x") == "x=5" && text("x / 2.0") == "2.500000");
+
+    // A + chain is one node; numbers add until the first string, as if it were evaluated pair by pair
+    Expression chain("1 + 2 + \"x\" + 3 + x");
+    assert(chain.nodes()[chain.root()].kind == ExprNode::Kind::SUM && chain.nodes()[chain.root()].operands.size() == 5);
+    assert(std::get<std::string>(ExpressionEvaluator::evaluate(chain, context)) == "3x35");
+    assert(text("1 + (2 + \"x\")") == "12x" && text("x + 1 + 2") == "8");
+
+    // Operands that are not needed are never evaluated
+    assert(text("false && fail()") == "false" && text("x > 1 || fail()") == "true");
+    assert(text("x > 10 ? fail() : \"small\"") == "small" && text("first(x, fail())") == "5");
+    assert(evaluated == 0);
+
+    // String operands, whether variables, literals or computed, keep their order
+    context.set_variable("s", Value{std::string("str")});
+    assert(text("s + \"-\" + s + (x > 1 ? \"!\" : \"?\") + 1 + 2") == "str-str!12");
+    assert(std::get<std::string>(ExpressionEvaluator::evaluate(Expression("1 + s + missing"), context)) ==
+           "1strnull");
+
+    // Everything before the first string must be a number, however many operands that is
+    for (const char* source : {"true + \"x\"", "true + 1 + \"x\"", "1 + true + s"}) {
+        bool threw = false;
+        try {
+            text(source);
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    bool rejected = false;
+    try {
+        Expression("x +");
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    assert(rejected);
+}
+
+int main() {
+    test_container_formatting();
+    test_nested_format_collision();
+    test_constant_folding();
+    test_mapped_log_sink();
+    test_value_codecs();
+    test_expression_evaluation();
+    std::cout << "\nDSL tests completed\n";
+    return 0;
+}
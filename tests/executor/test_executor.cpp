@@ -0,0 +1,233 @@
+#include "nmac/async_expand.hpp"
+#include "nmac/driver/builtin_rewriters.hpp"
+#include "nmac/driver/parallel_expand.hpp"
+#include "nmac/executor.hpp"
+#include "nmac/reorder_buffer.hpp"
+#include "nmac/task.hpp"
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <string>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+void test_deque() {
+    std::cout << "Testing work-stealing deque push/pop/steal\n";
+
+    nmac::detail::WorkStealingDeque<int*> deque(2); // Small capacity to force growth
+    std::vector<int> values(10000);
+    std::iota(values.begin(), values.end(), 0);
+
+    std::atomic<size_t> stolen{0};
+    std::atomic<bool> done{false};
+    std::thread thief([&] {
+        while (!done.load() || !deque.empty()) {
+            if (deque.steal()) stolen++;
+        }
+    });
+
+    size_t popped = 0;
+    for (auto& v : values) {
+        deque.push(&v);
+        if (v % 3 == 0 && deque.pop()) popped++;
+    }
+    while (deque.pop()) popped++;
+    done = true;
+    thief.join();
+
+    std::cout << "Popped " << popped << ", stolen " << stolen << std::endl;
+    assert(popped + stolen == values.size());
+}
+
+void test_parallel_for() {
+    std::cout << "\nTesting parallel_for\n";
+
+    nmac::executor pool(nmac::ExecutorOptions{4});
+    std::vector<int> hits(100000, 0);
+    pool.parallel_for(0, hits.size(), [&](size_t i) { hits[i]++; }, 64);
+
+    for (int h : hits) assert(h == 1);
+
+    // Empty range is a no-op
+    pool.parallel_for(5, 5, [](size_t) { assert(false); });
+}
+
+size_t fib(nmac::executor& pool, size_t n) {
+    if (n < 2) return n;
+    size_t a = 0;
+    nmac::task_group group(pool);
+    group.spawn([&] { a = fib(pool, n - 1); });
+    size_t b = fib(pool, n - 2);
+    group.sync();
+    return a + b;
+}
+
+void test_spawn_sync() {
+    std::cout << "\nTesting nested spawn/sync\n";
+
+    nmac::executor pool(nmac::ExecutorOptions{3});
+    size_t result = fib(pool, 20);
+    std::cout << "fib(20) = " << result << std::endl;
+    assert(result == 6765);
+
+    // Exceptions propagate out of sync()
+    nmac::task_group group(pool);
+    group.spawn([] { throw std::runtime_error("boom"); });
+    group.spawn([] {});
+    bool caught = false;
+    try {
+        group.sync();
+    } catch (const std::runtime_error& e) {
+        caught = true;
+    }
+    assert(caught);
+}
+
+nmac::task<int> add_on(nmac::executor& pool, int a, int b) {
+    co_await nmac::schedule_on(pool);
+    co_return a + b;
+}
+
+void test_coroutines() {
+    std::cout << "\nTesting coroutines on the pool\n";
+
+    nmac::executor pool(nmac::ExecutorOptions{2});
+    int sum = nmac::sync_wait(add_on(pool, 40, 2));
+    assert(sum == 42);
+
+    // Yielding to an inline executor continues in place; a million yields
+    // must not nest a million frames
+    nmac::inline_executor now;
+    std::string source;
+    for (int i = 0; i < 1000000; ++i) source += "a ";
+    auto tokens = nmac::sync_wait(nmac::async_tokenize(now, source, 1));
+    assert(tokens.size() == 1000000);
+}
+
+void test_numa_pinning() {
+    std::cout << "\nTesting NUMA-aware placement\n";
+
+    // Pinning is best effort; the pool must work whether or not it succeeds
+    nmac::executor pool(nmac::ExecutorOptions{2, true});
+    std::atomic<int> count{0};
+    pool.parallel_for(0, 1000, [&](size_t) { count++; });
+    assert(count == 1000);
+
+    auto cpus = nmac::detail::parse_cpu_list("0-3,8,10-11");
+    assert((cpus == std::vector<int>{0, 1, 2, 3, 8, 10, 11}));
+}
+
+void test_ordered_output() {
+    std::cout << "Testing ordered output..." << std::endl;
+
+    nmac::executor pool(nmac::ExecutorOptions{4});
+
+    // Later indices finish first; the consumer must still see them in order
+    // and never more than `window` ahead of it
+    std::vector<size_t> seen;
+    std::atomic<size_t> produced{0};
+    std::atomic<size_t> consumed{0};
+    nmac::ordered_parallel(pool, 200, 8,
+        [&](size_t i) {
+            assert(i < consumed + 8);
+            if (i % 7 == 0) std::this_thread::sleep_for(std::chrono::microseconds(200));
+            produced++;
+            return i;
+        },
+        [&](size_t i) {
+            seen.push_back(i);
+            consumed++;
+        });
+    assert(produced == 200 && seen.size() == 200);
+    for (size_t i = 0; i < seen.size(); ++i) assert(seen[i] == i);
+
+    bool threw = false;
+    try {
+        nmac::ordered_parallel(pool, 100, 4,
+            [](size_t i) {
+                if (i == 10) throw std::runtime_error("boom");
+                return i;
+            },
+            [](size_t) {});
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    assert(threw);
+
+    // Stale and duplicate sequence numbers are rejected, not buffered
+    std::vector<int> emitted;
+    nmac::ReorderBuffer<int> buffer(4, [&](int&& v) { emitted.push_back(v); });
+    buffer.push(1, 1);
+    buffer.push(0, 0);
+    auto rejects = [&](size_t seq) {
+        try {
+            buffer.push(seq, -1);
+        } catch (const std::logic_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(rejects(0) && rejects(1));
+    buffer.push(3, 3);
+    assert(rejects(3));
+    buffer.push(2, 2);
+    assert((emitted == std::vector<int>{0, 1, 2, 3}));
+
+    // Parallel in-file expansion is byte-identical to the sequential expansion
+    std::string source;
+    for (int i = 0; i < 500; ++i) {
+        source += "auto v" + std::to_string(i) + " = vec![" + std::to_string(i) + ", vec![1; 2]];\n";
+        if (i % 3 == 0) source += "println!(\"{}\", v" + std::to_string(i) + ");\n";
+    }
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    nmac::Tokenizer tokenizer(source);
+    auto tokens = tokenizer.tokenize();
+
+    std::string sequential;
+    size_t expected = expander.expand(source, tokens, sequential);
+    for (size_t grain : {1, 3, 64}) {
+        std::string parallel;
+        size_t count = nmac::driver::parallel_expand(pool, expander, source, tokens,
+            [&](std::string_view text) { parallel += text; }, {grain, 2});
+        assert(parallel == sequential);
+        assert(count == expected);
+    }
+}
+
+void test_tokenless_sources() {
+    std::cout << "\nTesting parallel expansion of sources without tokens\n";
+
+    nmac::executor pool(nmac::ExecutorOptions{2});
+    auto table = nmac::driver::builtin_rewriters();
+    nmac::driver::FileExpander expander(table);
+    for (std::string source : {"", "   \n\t", "// only a comment\n", "/* block */\n// and line"}) {
+        nmac::Tokenizer tokenizer(source);
+        auto tokens = tokenizer.tokenize();
+        assert(tokens.empty());
+
+        std::string parallel;
+        size_t count = nmac::driver::parallel_expand(pool, expander, source, tokens,
+            [&](std::string_view text) { parallel += text; });
+        assert(count == 0 && parallel == expander.expand(source) && parallel == source);
+
+        nmac::driver::OutputRope rope(source);
+        nmac::driver::parallel_splice(pool, expander, source, tokens, rope, [] {});
+        assert(rope.str() == source);
+    }
+}
+
+int main() {
+    test_deque();
+    test_parallel_for();
+    test_spawn_sync();
+    test_coroutines();
+    test_numa_pinning();
+    test_ordered_output();
+    test_tokenless_sources();
+    std::cout << "\nExecutor tests completed\n";
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "nmac/executor.hpp"
+#include "nmac/io/file_batch.hpp"
+#include <cassert>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+void test_batch_round_trip() {
+    std::cout << "Testing batched file round trips\n";
+
+    auto dir = std::filesystem::temp_directory_path() / "nmac_io_test";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+
+    // Sizes around the arena and queue limits below, including empty files
+    std::vector<std::string> paths;
+    std::vector<std::string> contents;
+    for (size_t i = 0; i < 40; ++i) {
+        size_t size = i % 5 == 0 ? 0 : (i * 7919) % 20000;
+        if (i % 13 == 1) size = 3 << 20;
+        std::string data(size, '\0');
+        for (size_t b = 0; b < size; ++b) data[b] = static_cast<char>('a' + (b * 31 + i) % 26);
+        paths.push_back((dir / ("f" + std::to_string(i))).string());
+        contents.push_back(std::move(data));
+    }
+    std::vector<nmac::io::WriteRequest> requests;
+    for (size_t i = 0; i < paths.size(); ++i) requests.push_back({paths[i], contents[i]});
+
+    nmac::executor pool(nmac::ExecutorOptions{2});
+    for (bool uring : {true, false}) {
+        for (nmac::executor* workers : {static_cast<nmac::executor*>(nullptr), &pool}) {
+            nmac::io::BatchOptions options;
+            options.queue_depth = 4;
+            options.arena_bytes = 64 << 10;
+            options.use_io_uring = uring;
+            options.workers = workers;
+            nmac::io::BatchIo io(options);
+            if (!uring) assert(!io.uses_io_uring());
+            std::cout << "  io_uring " << (io.uses_io_uring() ? "on" : "off")
+                      << (workers ? ", on the pool\n" : ", inline\n");
+
+            for (auto& path : paths) std::filesystem::remove(path);
+            io.write(requests);
+
+            std::mutex mutex;
+            std::vector<int> seen(paths.size(), 0);
+            io.read(paths, [&](size_t i, std::string_view data) {
+                assert(data == contents[i]);
+                std::lock_guard lock(mutex);
+                seen[i]++;
+            });
+            for (int count : seen) assert(count == 1);
+        }
+    }
+
+    // Failures surface as exceptions on both paths
+    for (bool uring : {true, false}) {
+        nmac::io::BatchOptions options;
+        options.use_io_uring = uring;
+        nmac::io::BatchIo io(options);
+        bool threw = false;
+        try {
+            io.read(std::vector<std::string>{(dir / "missing").string()}, [](size_t, std::string_view) {});
+        } catch (const std::system_error&) {
+            threw = true;
+        }
+        assert(threw);
+    }
+
+    std::filesystem::remove_all(dir);
+}
+
+int main() {
+    test_batch_round_trip();
+    std::cout << "\nI/O tests completed\n";
+    return 0;
+}
@@ -1,4 +1,12 @@
 #include "nmac/nmac.hpp"
+#include "nmac/macro_expander.hpp"
+#include "nmac/ct_pattern.hpp"
+#include "nmac/driver/token_cache.hpp"
+#include "nmac/vec.hpp"
+#include <cstdint>
+#include <random>
+#include <tuple>
+#include <sstream>
 #include <cassert>
 #include <iostream>
 #include <vector>
@@ -182,6 +190,262 @@ void test_repetition_matching() {
     assert(matcher.get_captures().size() == 3);
 }
 
+void test_capture_rollback() {
+    std::cout << "\nTesting capture rollback on backtracking\n";
+
+    // The optional branch captures $a before failing on 'x'
+    nmac::PatternParser optional_parser("[ $a x ] $b");
+    auto optional_pattern = optional_parser.parse();
+    std::vector<std::string> input = {"1", "2"};
+    nmac::PatternMatcher optional_matcher(optional_pattern, input);
+    assert(optional_matcher.match());
+    const auto& kept = optional_matcher.get_captures();
+    assert(kept.size() == 1 && kept[0].first == "b" && kept[0].second == "1");
+
+    // The last repetition captures $x before running out of commas
+    nmac::PatternParser repeat_parser("( $x \\, )* $y");
+    auto repeat_pattern = repeat_parser.parse();
+    std::vector<std::string> list = {"1", ",", "2"};
+    nmac::PatternMatcher repeat_matcher(repeat_pattern, list);
+    assert(repeat_matcher.match());
+    const auto& items = repeat_matcher.get_captures();
+    assert(items.size() == 2 && items[0].first == "x" && items[0].second == "1");
+    assert(items[1].first == "y" && items[1].second == "2");
+
+    // Nothing survives a failed match, and matching again starts afresh
+    std::vector<std::string> short_input = {"1"};
+    nmac::PatternParser pair_parser("$a $b");
+    auto pair_pattern = pair_parser.parse();
+    nmac::PatternMatcher failing(pair_pattern, short_input);
+    assert(!failing.match() && failing.get_captures().empty());
+    assert(repeat_matcher.match() && repeat_matcher.get_captures().size() == 2);
+}
+
+void test_alternation() {
+    std::cout << "\nTesting alternation and prefix factoring\n";
+    using Node = nmac::PatternNode;
+
+    // Neighbours sharing `a b` become one trie branch
+    nmac::PatternParser parser("( a b c | a b d | e ) $x");
+    auto pattern = parser.parse();
+    assert(!parser.has_error());
+    const auto& alternation = pattern.children[0];
+    assert(alternation.type == Node::ALTERNATION && alternation.children.size() == 2);
+    const auto& shared = alternation.children[0];
+    assert(shared.children.size() == 3 && shared.children[0].content == "a" && shared.children[1].content == "b");
+    assert(shared.children[2].type == Node::ALTERNATION && shared.children[2].children.size() == 2);
+    assert(shared.children[2].children[1].children[0].content == "d");
+    assert(alternation.children[1].children[0].content == "e");
+
+    std::vector<std::string> input = {"a", "b", "d", "z"};
+    nmac::PatternMatcher matcher(pattern, input);
+    assert(matcher.match() && matcher.get_captures().size() == 1 && matcher.get_captures()[0].second == "z");
+    std::vector<std::string> other = {"a", "b", "e"};
+    nmac::PatternMatcher miss(pattern, other);
+    assert(!miss.match());
+
+    // Alternatives further apart keep their order, so `a y` still loses to `b`
+    nmac::PatternParser apart_parser("a x | b | a y");
+    auto apart = apart_parser.parse();
+    assert(apart.type == Node::ALTERNATION && apart.children.size() == 3);
+
+    // A prefix of another alternative is tried first, as written
+    nmac::PatternParser prefix_parser("( a | a b ) $rest");
+    auto prefix = prefix_parser.parse();
+    std::vector<std::string> ab = {"a", "b"};
+    nmac::PatternMatcher prefix_matcher(prefix, ab);
+    assert(prefix_matcher.match() && prefix_matcher.get_captures()[0].second == "b");
+
+    // An escaped bar is a literal
+    nmac::PatternParser bar_parser("$a \\| $b");
+    auto bar = bar_parser.parse();
+    assert(bar.children.size() == 3 && bar.children[1].type == Node::LITERAL && bar.children[1].content == "|");
+}
+
+template<nmac::ct_string Pattern>
+void check_compiled_pattern(const std::vector<std::vector<std::string>>& inputs) {
+    nmac::PatternParser parser(Pattern.view());
+    auto pattern = parser.parse();
+    assert(!parser.has_error());
+    for (const auto& input : inputs) {
+        nmac::PatternMatcher interpreted(pattern, input);
+        nmac::ct::Matcher<Pattern, std::vector<std::string>> compiled(input);
+        bool matched = interpreted.match();
+        assert(compiled.match() == matched);
+        assert(compiled.get_captures() == interpreted.get_captures());
+    }
+}
+
+void test_compiled_patterns() {
+    std::cout << "\nTesting compile-time generated matchers\n";
+
+    using namespace nmac::ct;
+    static_assert(std::is_same_v<compiled_t<"a [ $x ]">,
+                                 Sequence<Literal<"a [ $x ]", 0, 1>, Optional<Sequence<Variable<"a [ $x ]", 5, 1>>>>>);
+    static_assert(std::is_same_v<compiled_t<"$x+">, Sequence<Repeat<'+', Variable<"$x+", 1, 1>>>>);
+    static_assert(std::is_same_v<compiled_t<"a x | a y">,
+                                 Sequence<Literal<"a x | a y", 0, 1>,
+                                          Alternation<Sequence<Literal<"a x | a y", 2, 1>>,
+                                                      Sequence<Literal<"a x | a y", 8, 1>>>>>);
+    static_assert(compiles<"vec! \\[ $x \\]"> && !compiles<"( a"> && !compiles<"$"> && !compiles<"$a , $b">);
+
+    std::vector<std::string> words = {"a", "b", "c", "=", ",", "+", "-", "(", ")", "[", "]", "vec!", "f"};
+    std::mt19937 rng(123);
+    std::vector<std::vector<std::string>> inputs;
+    for (int i = 0; i < 4000; ++i) {
+        std::vector<std::string> input(rng() % 9);
+        for (auto& word : input) word = words[rng() % words.size()];
+        inputs.push_back(std::move(input));
+    }
+    inputs.push_back({"a", "(", "b", ")", "+", "c"});
+    inputs.push_back({"vec!", "[", "a", "]"});
+    inputs.push_back({"b", "=", "c", ",", "a", "=", "b", ",", "f"});
+
+    check_compiled_pattern<"a $x">(inputs);
+    check_compiled_pattern<"$x* b">(inputs);
+    check_compiled_pattern<"( a $x )* $y">(inputs);
+    check_compiled_pattern<"[ a ] $x+ b">(inputs);
+    check_compiled_pattern<"( $k = $v \\, )* $last">(inputs);
+    check_compiled_pattern<"f \\( [ $a [ \\, $b ] ] \\)">(inputs);
+    check_compiled_pattern<"vec! \\[ $x \\]">(inputs);
+    check_compiled_pattern<"$a + $b">(inputs);
+    check_compiled_pattern<"$a - ( b [ c ] )+ $d">(inputs);
+    check_compiled_pattern<"">(inputs);
+    check_compiled_pattern<"( a $x | a b | $y = $z )* c">(inputs);
+    check_compiled_pattern<"[ f \\( | f ] $x">(inputs);
+    check_compiled_pattern<"vec! \\[ ( $x \\, | $y )* \\]">(inputs);
+    check_compiled_pattern<"( a | a b ) $z">(inputs);
+    check_compiled_pattern<"a | b c | b = | b = $x | c">(inputs);
+    check_compiled_pattern<"( + a | + b | - | + ) $x">(inputs);
+}
+
+struct NameGenerator {
+    template<typename... Args>
+    static std::string expand(const Args&...) { return "name"; }
+};
+
+struct SumGenerator {
+    template<typename... Args>
+    static std::string expand(const Args&...) { return "sum"; }
+};
+
+struct VecCallGenerator {
+    template<typename... Args>
+    static std::string expand(const Args&...) { return "vec"; }
+};
+
+struct PrintlnCallGenerator {
+    template<typename... Args>
+    static std::string expand(const Args&...) { return "println"; }
+};
+
+void test_macro_bang_dispatch() {
+    std::cout << "\nTesting macro-bang tokens and per-symbol rule lookup\n";
+
+    std::string source = "vec![x] println!(y) a != b c!=d";
+    auto tokens = nmac::Tokenizer(source).tokenize();
+    assert(tokens.size() == 16);
+    assert(tokens[0].type == nmac::MACRO_BANG && tokens[0].content == "vec!");
+    assert(tokens[0].symbol == nmac::find_symbol("vec") && nmac::symbol_name(tokens[0].symbol) == "vec");
+    assert(tokens[4].type == nmac::MACRO_BANG && tokens[4].symbol != tokens[0].symbol);
+    assert(tokens[9].content == "!" && tokens[13].content == "!" && tokens[12].type == nmac::IDENT);
+    assert(tokens[12].symbol == nmac::no_symbol);
+
+    nmac::PatternParser parser("vec! \\[ $x \\]");
+    auto pattern = parser.parse();
+    assert(pattern.children[0].symbol == tokens[0].symbol);
+    std::vector<nmac::Token> vec_call(tokens.begin(), tokens.begin() + 4);
+    nmac::PatternMatcher matcher(pattern, vec_call);
+    assert(matcher.match() && matcher.get_captures()[0].second.content == "x");
+
+    using Expander = nmac::macro::Expander<nmac::MacroRule<"vec! \\[ $x \\]", VecCallGenerator>,
+                                           nmac::MacroRule<"println! \\( $x \\)", PrintlnCallGenerator>,
+                                           nmac::MacroRule<"$name", NameGenerator>>;
+    std::vector<nmac::Token> println_call(tokens.begin() + 4, tokens.begin() + 8);
+    assert((Expander::candidate_rules(vec_call) == std::vector<size_t>{0, 2}));
+    assert((Expander::candidate_rules(println_call) == std::vector<size_t>{1, 2}));
+    assert(Expander::expand(vec_call) == "vec" && Expander::expand(println_call) == "println");
+
+    // Strings are keyed by their text
+    std::vector<std::string> words = {"println!", "(", "z", ")"};
+    assert((Expander::candidate_rules(words) == std::vector<size_t>{1, 2}));
+    assert(Expander::expand(words) == "println");
+    assert((Expander::candidate_rules(std::vector<std::string>{"other!"}) == std::vector<size_t>{2}));
+    assert(Expander::expand(std::vector<std::string>{"vec"}) == "name");
+
+    auto buffer = nmac::driver::TokenBuffer::build(source, tokens);
+    assert(buffer[0].symbol == tokens[0].symbol && buffer.tokens()[4].symbol == tokens[4].symbol);
+    assert(buffer.symbol_name(buffer.symbol(0)) == "vec" && buffer[1].symbol == nmac::no_symbol);
+
+    nmac::driver::RewriteTable table;
+    table.add("vec", [](const nmac::driver::MacroCall& call) { return "V(" + std::string(call.body) + ")"; });
+    nmac::driver::RewriteTable copy = table;
+    assert(copy.find(tokens[0].symbol) && copy.find(tokens[0].symbol) != table.find(tokens[0].symbol));
+    assert(!copy.find(tokens[4].symbol));
+    assert(nmac::driver::FileExpander(copy).expand(source) == "V(x) println!(y) a != b c!=d");
+}
+
+void test_shared_prefix_dispatch() {
+    std::cout << "\nTesting shared-prefix dispatch across rules\n";
+
+    using nmac::dsl::VecExpander;
+    auto list = nmac::Tokenizer("vec![1, 2, 3]").tokenize();
+    auto repeat = nmac::Tokenizer("vec![7; 3]").tokenize();
+    auto empty = nmac::Tokenizer("vec![]").tokenize();
+
+    // All three rules share `vec! [`; the token after it picks the branch
+    assert((VecExpander::candidate_rules(list) == std::vector<size_t>{1, 2}));
+    assert((VecExpander::candidate_rules(repeat) == std::vector<size_t>{1, 2}));
+    assert((VecExpander::candidate_rules(empty) == std::vector<size_t>{0, 1, 2}));
+    assert(VecExpander::candidate_rules(nmac::Tokenizer("println!(x)").tokenize()).empty());
+
+    assert((VecExpander::expand(list) == std::vector<int>{1, 2, 3}));
+    assert((VecExpander::expand(repeat) == std::vector<int>{7, 7, 7}));
+    assert(VecExpander::expand(empty).empty());
+
+    // Resuming after the shared prefix still sees the whole rule
+    using Mixed = nmac::macro::Expander<nmac::MacroRule<"f \\( $a \\)", VecCallGenerator>,
+                                        nmac::MacroRule<"f \\( $a \\, $b \\)", PrintlnCallGenerator>,
+                                        nmac::MacroRule<"f", NameGenerator>>;
+    std::vector<std::string> two = {"f", "(", "x", ",", "y", ")"};
+    assert((Mixed::candidate_rules(two) == std::vector<size_t>{0, 1, 2}));
+    assert(Mixed::expand(two) == "println");
+    assert(Mixed::expand(std::vector<std::string>{"f", "(", "x", ")"}) == "vec");
+    assert(Mixed::expand(std::vector<std::string>{"f"}) == "name");
+    assert((Mixed::candidate_rules(std::vector<std::string>{"g"}).empty()));
+}
+
+void test_rule_stats() {
+    std::cout << "\nTesting per-rule latency histograms\n";
+
+    using Expander = nmac::macro::Expander<nmac::MacroRule<"$a + $b", SumGenerator>,
+                                           nmac::MacroRule<"$name", NameGenerator>>;
+    Expander::reset_rule_stats();
+    std::vector<std::string> sum = {"1", "+", "2"};
+    std::vector<std::string> name = {"x", "y"};
+    for (int i = 0; i < 100; ++i) {
+        assert(Expander::expand(sum) == "sum");
+        assert(Expander::expand(name) == "name");
+    }
+
+    auto snapshot = Expander::rule_stats();
+    assert(snapshot.rules.size() == 2 && snapshot.rules[0].pattern == "$a + $b");
+    assert(snapshot.rules[0].match.count() == 200 && snapshot.rules[0].expand.count() == 100);
+    assert(snapshot.rules[1].match.count() == 100 && snapshot.rules[1].expand.count() == 100);
+    const auto& match = snapshot.rules[0].match;
+    assert(match.percentile(50) <= match.percentile(99) && match.percentile(99) <= match.max());
+
+    std::ostringstream json;
+    snapshot.write_json(json);
+    assert(json.str().find("\"pattern\":\"$a + $b\",\"match\":{\"count\":200") != std::string::npos);
+    snapshot.write_text(std::cout);
+
+    for (uint64_t ns : {0ull, 31ull, 32ull, 1000ull, 123456789ull}) {
+        size_t bucket = nmac::histogram_layout::bucket_of(ns);
+        assert(nmac::histogram_layout::lowest(bucket) <= ns && ns <= nmac::histogram_layout::highest(bucket));
+    }
+}
+
 int main() {
     std::cout << "Starting enhanced pattern parser test\n";
     test_pattern_parser();
@@ -195,5 +459,12 @@ int main() {
     test_repetition_matching();
     std::cout << "Repetition matching test completed\n";
 
+    test_capture_rollback();
+    test_alternation();
+    test_compiled_patterns();
+    test_macro_bang_dispatch();
+    test_shared_prefix_dispatch();
+    test_rule_stats();
+
     return 0;
 }
@@ -0,0 +1,340 @@
+#include "nmac/driver/builtin_rewriters.hpp"
+#include "nmac/driver/compile_commands.hpp"
+#include "nmac/driver/file_expander.hpp"
+#include "nmac/driver/incremental.hpp"
+#include "nmac/driver/output_rope.hpp"
+#include "nmac/driver/parallel_expand.hpp"
+#include "nmac/driver/project.hpp"
+#include "nmac/driver/token_cache.hpp"
+#include "nmac/executor.hpp"
+#include "nmac/io/file_batch.hpp"
+#include "nmac/io/file_watcher.hpp"
+#include "nmac/io/mapped_file.hpp"
+#include "nmac/reorder_buffer.hpp"
+#include "nmac/tokenizer.hpp"
+#include "nmac/trace.hpp"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace {
+    // Files at least this large are mapped and spliced in place rather than
+    // read into memory, with their invocations expanded in parallel
+    constexpr size_t splice_file_bytes = size_t{1} << 20;
+
+    // Writes each output to DIR/<input path>, mirroring the input tree
+    void write_tree(nmac::io::BatchIo& io, const std::string& out_dir,
+                    const std::vector<std::string_view>& paths, const std::vector<std::string_view>& outputs) {
+        std::vector<nmac::io::WriteRequest> writes;
+        writes.reserve(paths.size());
+        for (size_t i = 0; i < paths.size(); ++i) {
+            auto target = std::filesystem::path(out_dir) / std::filesystem::path(paths[i]).relative_path();
+            std::filesystem::create_directories(target.parent_path());
+            writes.push_back({target.string(), outputs[i]});
+        }
+        io.write(writes);
+    }
+
+    // Creates or truncates DIR/<path> and passes its descriptor to `write`
+    template<typename F>
+    void write_under(const std::string& out_dir, const std::string& path, F&& write) {
+        auto target = (std::filesystem::path(out_dir) / std::filesystem::path(path).relative_path()).string();
+        std::filesystem::create_directories(std::filesystem::path(target).parent_path());
+        int fd = nmac::io::detail::open_or_throw(target, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        try {
+            write(fd, target);
+        } catch (...) {
+            ::close(fd);
+            throw;
+        }
+        ::close(fd);
+    }
+
+    // Records a trace for the rest of the run and writes it out on scope exit
+    class TraceDump {
+        std::string path;
+
+    public:
+        explicit TraceDump(std::string trace_path) : path(std::move(trace_path)) {
+#if NMAC_TRACE
+            if (!path.empty()) nmac::trace::start();
+#endif
+        }
+
+        ~TraceDump() {
+#if NMAC_TRACE
+            if (path.empty()) return;
+            nmac::trace::stop();
+            std::ofstream out(path);
+            nmac::trace::write_json(out);
+            if (!out) std::cerr << "nmac-expand: cannot write trace to " << path << "\n";
+#endif
+        }
+    };
+
+    // Expands `inputs`, then re-expands whichever of them change until killed.
+    // Only changed files are written again.
+    int watch_files(const std::vector<std::string>& inputs, const std::string& out_dir,
+                    const nmac::driver::FileExpander& expander, nmac::io::BatchIo& io) {
+#if NMAC_HAS_INOTIFY
+        nmac::driver::IncrementalExpander incremental(expander, inputs.size());
+        nmac::io::FileWatcher watcher;
+        for (size_t i = 0; i < inputs.size(); ++i) watcher.watch(inputs[i], i);
+
+        auto refresh = [&](const std::vector<size_t>& changed) {
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::string> paths;
+            for (size_t i : changed) paths.push_back(inputs[i]);
+            std::vector<nmac::driver::IncrementalExpander::Stats> stats(changed.size());
+            io.read(paths, [&](size_t k, std::string_view contents) {
+                stats[k] = incremental.update(changed[k], contents);
+            });
+
+            std::vector<std::string_view> written, outputs;
+            size_t invocations = 0, reused = 0;
+            for (size_t k = 0; k < changed.size(); ++k) {
+                if (stats[k].unchanged) continue;
+                written.push_back(inputs[changed[k]]);
+                outputs.push_back(incremental.output(changed[k]));
+                invocations += stats[k].invocations;
+                reused += stats[k].reused;
+            }
+            if (out_dir.empty()) {
+                for (auto output : outputs) std::cout.write(output.data(), static_cast<std::streamsize>(output.size()));
+                std::cout.flush();
+            } else {
+                write_tree(io, out_dir, written, outputs);
+            }
+
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cerr << "nmac-expand: " << written.size() << " file(s), " << invocations << " invocations ("
+                      << reused << " cached) in " << ms << " ms\n";
+        };
+
+        std::vector<size_t> all(inputs.size());
+        for (size_t i = 0; i < all.size(); ++i) all[i] = i;
+        refresh(all);
+
+        for (;;) {
+            auto changed = watcher.wait();
+            try {
+                refresh(changed);
+            } catch (const std::exception& e) {
+                // Keep watching: the next save may fix it
+                std::cerr << "nmac-expand: " << e.what() << "\n";
+            }
+        }
+#else
+        (void)inputs, (void)out_dir, (void)expander, (void)io;
+        std::cerr << "nmac-expand: --watch needs inotify, which this platform lacks\n";
+        return 2;
+#endif
+    }
+
+    void print_usage() {
+        std::cerr << "usage: nmac-expand [-o DIR] [-j N] [--no-io-uring] [--token-cache DIR] [--watch] FILE...\n"
+                  << "       nmac-expand -p compile_commands.json [-o DIR] [-j N] [--report]\n"
+                  << "  -p FILE         expand every translation unit in FILE and the headers they include\n"
+                  << "  --report        print per-file timings to stderr (with -p)\n"
+                  << "  -o DIR          write expanded files under DIR instead of stdout\n"
+                  << "  -j N            expand with N worker threads (default: all cores)\n"
+                  << "  --no-io-uring   use pread/pwrite even when io_uring is available\n"
+                  << "  --token-cache DIR  reuse tokens of unchanged files from DIR\n"
+                  << "  --trace FILE    write a Chrome trace of the run to FILE (needs NMAC_TRACE)\n"
+                  << "  --watch         keep running and re-expand files as they are saved\n";
+    }
+}
+
+int main(int argc, char** argv) {
+    std::vector<std::string> inputs;
+    std::string out_dir;
+    std::string database;
+    std::string token_cache;
+    std::string trace_path;
+    bool report = false;
+    bool watch = false;
+    nmac::io::BatchOptions io_options;
+    unsigned jobs = 0;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "-o" && i + 1 < argc) {
+            out_dir = argv[++i];
+        } else if (arg == "-p" && i + 1 < argc) {
+            database = argv[++i];
+        } else if (arg == "--report") {
+            report = true;
+        } else if (arg == "--watch") {
+            watch = true;
+        } else if (arg == "-j" && i + 1 < argc) {
+            jobs = static_cast<unsigned>(std::stoul(argv[++i]));
+        } else if (arg == "--token-cache" && i + 1 < argc) {
+            token_cache = argv[++i];
+        } else if (arg == "--trace" && i + 1 < argc) {
+            trace_path = argv[++i];
+        } else if (arg == "--no-io-uring") {
+            io_options.use_io_uring = false;
+        } else if (arg == "-h" || arg == "--help") {
+            print_usage();
+            return 0;
+        } else if (!arg.empty() && arg[0] == '-') {
+            std::cerr << "Unknown option: " << arg << "\n";
+            print_usage();
+            return 2;
+        } else {
+            inputs.push_back(std::move(arg));
+        }
+    }
+
+    if (inputs.empty() == database.empty() || (watch && !database.empty())) {
+        print_usage();
+        return 2;
+    }
+
+    if (!trace_path.empty() && !NMAC_TRACE) {
+        std::cerr << "nmac-expand: --trace needs a build with NMAC_TRACE enabled\n";
+        return 2;
+    }
+    TraceDump trace(trace_path);
+
+    try {
+        auto table = nmac::driver::builtin_rewriters();
+        nmac::driver::FileExpander expander(table);
+        std::optional<nmac::executor> own_pool;
+        nmac::executor& pool = jobs ? own_pool.emplace(nmac::ExecutorOptions{jobs}) : nmac::executor::global();
+        io_options.workers = &pool;
+        nmac::io::BatchIo io(io_options);
+
+        if (!database.empty()) {
+            auto project = nmac::driver::Project::scan(nmac::driver::load_compile_commands(database), io);
+            project.expand(expander, pool);
+            if (report) project.write_report(std::cerr);
+
+            // Unchanged regions go out straight from the retained sources
+            const auto& files = project.contents();
+            if (out_dir.empty()) {
+                std::vector<std::string_view> slices;
+                for (const auto& file : files) {
+                    auto pieces = file.output.slices();
+                    slices.insert(slices.end(), pieces.begin(), pieces.end());
+                }
+                nmac::io::write_vectored(STDOUT_FILENO, slices, "standard output");
+                return 0;
+            }
+            for (const auto& file : files) {
+                write_under(out_dir, file.path, [&](int fd, const std::string& target) {
+                    file.output.write_to(fd, target);
+                });
+            }
+            return 0;
+        }
+
+        if (watch) return watch_files(inputs, out_dir, expander, io);
+
+        std::optional<nmac::driver::TokenCache> cache;
+        if (!token_cache.empty()) cache.emplace(token_cache);
+        auto tokenize = [&](std::string_view contents) {
+            if (cache) return cache->tokens(contents).tokens();
+            nmac::Tokenizer tokenizer(contents);
+            return tokenizer.tokenize();
+        };
+
+        auto expand_file = [&](std::string_view contents) {
+            auto tokens = tokenize(contents);
+            std::string output;
+            expander.expand(contents, tokens, output);
+            return output;
+        };
+
+        // Large files bypass the batched read. Their output is written to `fd`
+        // a prefix at a time as the parallel expansion completes.
+        auto splice_file = [&](const std::string& path, int fd, const std::string& target) {
+            nmac::io::MappedFile mapped(path);
+            std::string_view source = mapped.view();
+            auto tokens = tokenize(source);
+            nmac::driver::OutputRope rope(source);
+            nmac::driver::parallel_splice(pool, expander, source, tokens, rope, [&] { rope.flush(fd, target); });
+            rope.finish(fd, target);
+        };
+
+        std::vector<std::string> read_paths;
+        std::vector<size_t> read_index;
+        std::vector<size_t> spliced;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            std::error_code ec;
+            auto size = std::filesystem::file_size(inputs[i], ec);
+            if (!ec && size >= splice_file_bytes) {
+                spliced.push_back(i);
+            } else {
+                read_paths.push_back(inputs[i]);
+                read_index.push_back(i);
+            }
+        }
+
+        // Tokenize and expand each file on the pool as soon as its read completes.
+        // On stdout, files are streamed in input order as soon as their
+        // predecessors have been written; a large file is spliced when its turn comes.
+        if (out_dir.empty()) {
+            struct Output {
+                size_t index;
+                std::string text;
+                bool splice;
+            };
+            // Files are read a window at a time, so at most `window` outputs
+            // wait behind a slow predecessor. Every file of a window is inside
+            // the reorder window once the previous one is written, so the
+            // wait_for_slot() calls below never block a pool worker.
+            size_t window = 4 * std::max<size_t>(pool.concurrency(), 1);
+            nmac::ReorderBuffer<Output> ordered(window, [&](Output&& output) {
+                if (output.splice) {
+                    splice_file(inputs[output.index], STDOUT_FILENO, "standard output");
+                } else {
+                    std::string_view text = output.text;
+                    nmac::io::write_vectored(STDOUT_FILENO, {&text, 1}, "standard output");
+                }
+            });
+            size_t next_read = 0;
+            size_t next_splice = 0;
+            for (size_t start = 0; start < inputs.size(); start += window) {
+                size_t end = std::min(start + window, inputs.size());
+                for (; next_splice < spliced.size() && spliced[next_splice] < end; ++next_splice) {
+                    size_t i = spliced[next_splice];
+                    ordered.wait_for_slot(i);
+                    ordered.push(i, Output{i, {}, true});
+                }
+                size_t first = next_read;
+                while (next_read < read_paths.size() && read_index[next_read] < end) ++next_read;
+                io.read({read_paths.data() + first, next_read - first}, [&](size_t k, std::string_view contents) {
+                    size_t i = read_index[first + k];
+                    if (!ordered.wait_for_slot(i)) return;
+                    ordered.push(i, Output{i, expand_file(contents), false});
+                });
+            }
+            return 0;
+        }
+
+        std::vector<std::string> outputs(read_paths.size());
+        io.read(read_paths, [&](size_t k, std::string_view contents) {
+            outputs[k] = expand_file(contents);
+        });
+        write_tree(io, out_dir, {read_paths.begin(), read_paths.end()}, {outputs.begin(), outputs.end()});
+
+        for (size_t i : spliced) {
+            write_under(out_dir, inputs[i], [&](int fd, const std::string& target) {
+                splice_file(inputs[i], fd, target);
+            });
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "nmac-expand: " << e.what() << "\n";
+        return 1;
+    }
+
+    return 0;
+}